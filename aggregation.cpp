@@ -0,0 +1,133 @@
+#include "aggregation.h"
+
+#include <math.h>
+#include <string.h>
+
+void QuantileSketch::reset()
+{
+    memset(this->positive, 0, sizeof(this->positive));
+    memset(this->negative, 0, sizeof(this->negative));
+}
+
+void QuantileSketch::add(int32_t value, uint32_t weight)
+{
+    if (value >= 0)
+        this->positive[getBucket((uint32_t)value)] += weight;
+    else
+        this->negative[getBucket((uint32_t)-(int64_t)value)] += weight;
+}
+
+// Negative values are ranked first, from the largest magnitude
+int64_t QuantileSketch::getValueAtRank(uint64_t rank)
+{
+    uint64_t seen = 0;
+    for (size_t i = QUANTILE_SKETCH_BUCKETS; i-- > 0;) {
+        seen += this->negative[i];
+        if (seen >= rank)
+            return -getBucketValue(i);
+    }
+    for (size_t i = 0; i < QUANTILE_SKETCH_BUCKETS; ++i) {
+        seen += this->positive[i];
+        if (seen >= rank)
+            return getBucketValue(i);
+    }
+    return 0;
+}
+
+size_t QuantileSketch::getBucket(uint32_t magnitude)
+{
+    if (magnitude < QUANTILE_SKETCH_SUB_COUNT)
+        return magnitude;
+
+    // the leading bit and the next QUANTILE_SKETCH_SUB_BITS ones
+    int shift = 31 - __builtin_clz(magnitude) - QUANTILE_SKETCH_SUB_BITS;
+    size_t sub = (magnitude >> shift) - QUANTILE_SKETCH_SUB_COUNT;
+    return QUANTILE_SKETCH_SUB_COUNT + (size_t)shift * QUANTILE_SKETCH_SUB_COUNT + sub;
+}
+
+int64_t QuantileSketch::getBucketValue(size_t bucket)
+{
+    if (bucket < QUANTILE_SKETCH_SUB_COUNT)
+        return bucket;
+
+    int shift = (int)((bucket - QUANTILE_SKETCH_SUB_COUNT) / QUANTILE_SKETCH_SUB_COUNT);
+    int64_t sub = (bucket - QUANTILE_SKETCH_SUB_COUNT) % QUANTILE_SKETCH_SUB_COUNT;
+    int64_t lower = (QUANTILE_SKETCH_SUB_COUNT + sub) << shift;
+    return lower + (((int64_t)1 << shift) - 1) / 2;
+}
+
+void StreamingAggregate::reset()
+{
+    this->count = 0;
+    this->sum = 0;
+    this->min = 0;
+    this->max = 0;
+    this->mean = 0;
+    this->m2 = 0;
+    this->sketch.reset();
+}
+
+void StreamingAggregate::add(int32_t value)
+{
+    if (this->count == 0 || value < this->min)
+        this->min = value;
+    if (this->count == 0 || value > this->max)
+        this->max = value;
+
+    ++this->count;
+    this->sum += value;
+
+    double delta = value - this->mean;
+    this->mean += delta / this->count;
+    this->m2 += delta * (value - this->mean);
+
+    this->sketch.add(value);
+}
+
+void StreamingAggregate::merge(uint64_t count, int64_t sum, double m2, int32_t min, int32_t max)
+{
+    if (count == 0)
+        return;
+
+    if (this->count == 0 || min < this->min)
+        this->min = min;
+    if (this->count == 0 || max > this->max)
+        this->max = max;
+
+    uint64_t total = this->count + count;
+    double mean = (double)sum / count;
+    double delta = mean - this->mean;
+    this->m2 += m2 + delta * delta * ((double)this->count * count / total);
+    this->mean += delta * count / total;
+    this->count = total;
+    this->sum += sum;
+
+    this->sketch.add((int32_t)lround(mean), (uint32_t)count);
+}
+
+double StreamingAggregate::getVariance()
+{
+    if (this->count == 0)
+        return 0;
+    return this->m2 / this->count;
+}
+
+int32_t StreamingAggregate::getQuantile(double q)
+{
+    if (this->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)ceil(q * this->count);
+    if (rank <= 1)
+        return this->min;
+    if (rank >= this->count)
+        return this->max;
+
+    // a bucket value may lie out of the values of its bucket
+    int64_t value = this->sketch.getValueAtRank(rank);
+    if (value < this->min)
+        return this->min;
+    if (value > this->max)
+        return this->max;
+    return (int32_t)value;
+}
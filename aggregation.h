@@ -0,0 +1,60 @@
+#ifndef AGGREGATION_H
+#define AGGREGATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-linear histogram: magnitudes below 2^QUANTILE_SKETCH_SUB_BITS have a
+// bucket each, larger ones share buckets of 2^QUANTILE_SKETCH_SUB_BITS per
+// power of two, so a quantile is within 1/2^(QUANTILE_SKETCH_SUB_BITS + 1)
+// of the true value relatively. Memory is fixed whatever the count of
+// values: 896 counters per sign.
+#define QUANTILE_SKETCH_SUB_BITS 5
+#define QUANTILE_SKETCH_SUB_COUNT (1 << QUANTILE_SKETCH_SUB_BITS)
+#define QUANTILE_SKETCH_BUCKETS ((32 - QUANTILE_SKETCH_SUB_BITS + 1) * QUANTILE_SKETCH_SUB_COUNT)
+
+struct QuantileSketch
+{
+    uint32_t positive[QUANTILE_SKETCH_BUCKETS];
+    // of the magnitudes of negative values
+    uint32_t negative[QUANTILE_SKETCH_BUCKETS];
+
+    void reset();
+    void add(int32_t value, uint32_t weight = 1);
+    // Value of the given rank, from 1 to the count of values added
+    int64_t getValueAtRank(uint64_t rank);
+
+private:
+    static size_t getBucket(uint32_t magnitude);
+    // middle of the magnitudes of the bucket
+    static int64_t getBucketValue(size_t bucket);
+};
+
+// Count, sum, extremes, mean and variance (Welford), and quantiles of a
+// stream of values, each updated in O(1) as a value arrives
+struct StreamingAggregate
+{
+    uint64_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    double mean;
+    // sum of squared differences from the mean
+    double m2;
+
+    struct QuantileSketch sketch;
+
+    void reset();
+    void add(int32_t value);
+    // Adds the aggregate of other values (Chan et al.). They count in the
+    // quantiles as count values at their mean.
+    void merge(uint64_t count, int64_t sum, double m2, int32_t min, int32_t max);
+
+    // Population variance, 0 without values
+    double getVariance();
+    // Nearest-rank quantile for 0 <= q <= 1, approximate within the
+    // sketch accuracy and exact at 0 and 1; 0 without values
+    int32_t getQuantile(double q);
+};
+
+#endif // AGGREGATION_H
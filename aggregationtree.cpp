@@ -0,0 +1,108 @@
+#include "aggregationtree.h"
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "messages.h"
+
+void AggregationTree::init(size_t degree)
+{
+    this->nodes = NULL;
+    this->count = 0;
+    this->capacity = 0;
+    this->degree = degree;
+    this->height = 0;
+    this->epoch = 0;
+}
+
+void AggregationTree::deinit()
+{
+    free(this->nodes);
+    this->nodes = NULL;
+    this->count = 0;
+    this->capacity = 0;
+}
+
+static int compareNodes(const void *a, const void *b)
+{
+    return NodeIdentity::compareNodeIdentities(&((struct AggregationTreeNode *)a)->id,
+                                               &((struct AggregationTreeNode *)b)->id);
+}
+
+int AggregationTree::build(struct MembershipTable *members)
+{
+    if (members->count > this->capacity) {
+        struct AggregationTreeNode *nodes = (struct AggregationTreeNode *)realloc(this->nodes, members->count * sizeof(struct AggregationTreeNode));
+        if (nodes == NULL) {
+            logPosition();
+            return -1;
+        }
+        this->nodes = nodes;
+        this->capacity = members->count;
+    }
+
+    // nodes which only know v1 could not read their AggregationAssign
+    this->count = 0;
+    for (size_t i = 0; i < members->count; ++i) {
+        members->members[i].treeIndex = 0;
+        if (members->members[i].wireVersion < WireV2)
+            continue;
+        this->nodes[this->count].id = members->members[i].id;
+        this->nodes[this->count].position = i;
+        ++this->count;
+    }
+    qsort(this->nodes, this->count, sizeof(struct AggregationTreeNode), compareNodes);
+
+    this->height = this->count > 0 ? this->linkRange(0, this->count, -1) : 0;
+    for (size_t i = 0; i < this->count; ++i)
+        members->members[this->nodes[i].position].treeIndex = i + 1;
+
+    // 0 is the epoch of no tree
+    if (++this->epoch == 0)
+        this->epoch = 1;
+    return 0;
+}
+
+uint32_t AggregationTree::linkRange(size_t first, size_t size, int32_t parent)
+{
+    size_t parts = size < this->degree ? size : this->degree;
+    uint32_t height = 0;
+    for (size_t j = 0; j < parts; ++j) {
+        size_t start = first + size * j / parts;
+        size_t end = first + size * (j + 1) / parts;
+
+        struct AggregationTreeNode *node = &this->nodes[start];
+        node->parent = parent;
+        node->subtreeSize = end - start;
+        node->height = end - start > 1 ? this->linkRange(start + 1, end - start - 1, start) : 0;
+        if (node->height >= height)
+            height = node->height + 1;
+    }
+    return height;
+}
+
+void AggregationTree::getRange(long index, size_t *first, size_t *size)
+{
+    if (index < 0) {
+        *first = 0;
+        *size = this->count;
+        return;
+    }
+    *first = index + 1;
+    *size = this->nodes[index].subtreeSize - 1;
+}
+
+size_t AggregationTree::getChildrenCount(long index)
+{
+    size_t first, size;
+    this->getRange(index, &first, &size);
+    return size < this->degree ? size : this->degree;
+}
+
+size_t AggregationTree::getChild(long index, size_t i)
+{
+    size_t first, size;
+    this->getRange(index, &first, &size);
+    size_t parts = size < this->degree ? size : this->degree;
+    return first + size * i / parts;
+}
@@ -0,0 +1,61 @@
+#ifndef AGGREGATIONTREE_H
+#define AGGREGATIONTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "identity.h"
+#include "membership.h"
+
+// the children of a node fit one AggregationAssign datagram
+#define AGGREGATION_MAX_DEGREE 512
+
+struct AggregationTreeNode
+{
+    struct NodeIdentity id;
+    // in the membership table as of the build
+    uint32_t position;
+    // index of the parent in nodes, -1 for the master
+    int32_t parent;
+    // the node and its descendants, which follow it in nodes
+    uint32_t subtreeSize;
+    // 0 for a leaf
+    uint32_t height;
+};
+
+// Tree of the master's slaves with a fan-in of at most degree at every
+// node, the master included. The slaves are sorted by identity, so each
+// subtree covers a range of identities: the first slave of a range
+// aggregates the rest of it, split into at most degree subranges, and
+// the master splits the whole list the same way.
+struct AggregationTree
+{
+    struct AggregationTreeNode *nodes;
+    size_t count;
+    size_t capacity;
+    size_t degree;
+    // of the master
+    uint32_t height;
+    // numbers the builds, 0 before the first one
+    uint32_t epoch;
+
+    void init(size_t degree);
+    void deinit();
+
+    // Builds the tree of the members which have replied in v2 and sets
+    // their treeIndex, the others stay direct slaves of the master
+    int build(struct MembershipTable *members);
+
+    // The master is the node -1
+    size_t getChildrenCount(long index);
+    // Index in nodes of the i-th child
+    size_t getChild(long index, size_t i);
+
+private:
+    // Links the nodes of the range under parent, returns the height of
+    // the parent
+    uint32_t linkRange(size_t first, size_t size, int32_t parent);
+    void getRange(long index, size_t *first, size_t *size);
+};
+
+#endif // AGGREGATIONTREE_H
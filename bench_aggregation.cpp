@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "aggregation.h"
+#include "membership.h"
+#include "messages.h"
+#include "logging.h"
+
+// Cost of the master's streaming aggregation: adding the sample of a
+// ControlResponse, and closing a round of a given count of samples,
+// which reads the statistics and three quantiles. Also the whole work
+// the loop thread does for a ControlResponse that a receive thread has
+// queued, decoding it, recording the reply in the membership and
+// aggregating its sample, for a given count of slaves.
+
+#define BENCH_VALUES_COUNT 4096
+// a v2 ControlResponse takes less
+#define BENCH_RESPONSE_SIZE 32
+
+static struct StreamingAggregate aggregate;
+static int32_t values[BENCH_VALUES_COUNT];
+
+static volatile int64_t sink;
+
+static void prepareValues()
+{
+    // sensor-like luminosities
+    unsigned int seed = 1;
+    for (int i = 0; i < BENCH_VALUES_COUNT; ++i)
+        values[i] = 1000 + rand_r(&seed) % 100;
+}
+
+static void BM_AggregateAdd(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareValues();
+    aggregate.reset();
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it) {
+        for (int i = 0; i < BENCH_VALUES_COUNT; ++i)
+            aggregate.add(values[i]);
+    }
+    sink = aggregate.sum;
+    state->itemsProcessed = state->iterations * BENCH_VALUES_COUNT;
+}
+
+// Independent of the count of samples in the round
+static void BM_AggregateCloseRound(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareValues();
+    aggregate.reset();
+    for (long i = 0; i < state->range; ++i)
+        aggregate.add(values[i % BENCH_VALUES_COUNT]);
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it) {
+        sink = (int64_t)aggregate.mean + (int64_t)aggregate.getVariance()
+            + aggregate.getQuantile(0.5) + aggregate.getQuantile(0.9) + aggregate.getQuantile(0.99);
+    }
+    state->itemsProcessed = state->iterations;
+}
+
+static void BM_AggregateReset(struct BenchmarkState *state)
+{
+    for (long it = 0; it < state->iterations; ++it)
+        aggregate.reset();
+    sink = aggregate.count;
+    state->itemsProcessed = state->iterations;
+}
+
+// As SelfNode::onMessageReceived() with recordControlReply() for a
+// ControlResponse, each slave replying once per round
+static void BM_IngestControlResponse(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareValues();
+    unsigned char *responses = (unsigned char *)malloc(state->range * BENCH_RESPONSE_SIZE);
+    size_t *sizes = (size_t *)malloc(state->range * sizeof(size_t));
+    struct MembershipTable slaves;
+    if (responses == NULL || sizes == NULL || slaves.init(MEMBERSHIP_INITIAL_CAPACITY) == -1)
+        die("Cannot allocate responses");
+    for (long i = 0; i < state->range; ++i) {
+        struct NodeIdentity id = { (int32_t)(1000 + i), { 0x02, 0x42, 0xac, 0x11, (uint8_t)(i >> 8), (uint8_t)i } };
+        struct SensorsInfoBody body;
+        body.luminosity = values[i % BENCH_VALUES_COUNT];
+        body.temperature = 10 + i % 20;
+        WriteByteStream s;
+        s.openStream(responses + i * BENCH_RESPONSE_SIZE, BENCH_RESPONSE_SIZE);
+        if (MessageSchemaOf<ControlResponse>::encode(&s, WireV2, &id, &body) == -1)
+            die("Cannot encode response");
+        sizes[i] = s.buffer - (responses + i * BENCH_RESPONSE_SIZE);
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    struct StreamingAggregate temperatureAggregate;
+    temperatureAggregate.reset();
+    aggregate.reset();
+    uint32_t round = 0;
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it) {
+        ++round;
+        for (long i = 0; i < state->range; ++i) {
+            ReadByteStream s;
+            s.openStream(responses + i * BENCH_RESPONSE_SIZE, sizes[i]);
+            enum MessageType type;
+            struct NodeIdentity id;
+            enum WireVersion version;
+            struct SensorsInfoBody body;
+            if (deserializeMessage(&s, &type, &id, &version) == -1 || type != ControlResponse
+                    || MessageSchemaOf<ControlResponse>::decodeBody(&s, version, &body) == -1)
+                die("Cannot decode response");
+
+            long position = slaves.findOrAdd(&id);
+            if (position == -1)
+                die("Cannot add slave");
+            struct Member *member = &slaves.members[position];
+            member->address = address;
+            member->lastSeenTime = round;
+            member->wireVersion = (uint8_t)version;
+            struct MemberSample *sample = &slaves.samples[position];
+            bool isFirstReply = sample->round != round;
+            sample->round = round;
+            sample->luminosity = body.luminosity;
+            sample->temperature = body.temperature;
+            if (isFirstReply) {
+                aggregate.add(body.luminosity);
+                temperatureAggregate.add(body.temperature);
+            }
+        }
+    }
+    sink = aggregate.sum + temperatureAggregate.sum;
+    state->itemsProcessed = state->iterations * state->range;
+
+    slaves.deinit();
+    free(sizes);
+    free(responses);
+}
+
+BENCHMARK(BM_AggregateAdd)
+BENCHMARK_RANGE(BM_AggregateCloseRound, 1000)
+BENCHMARK_RANGE(BM_AggregateCloseRound, 100000)
+BENCHMARK(BM_AggregateReset)
+BENCHMARK_RANGE(BM_IngestControlResponse, 1000)
+BENCHMARK_RANGE(BM_IngestControlResponse, 100000)
+
+int main(int argc, char *argv[])
+{
+    return runBenchmarks(argc, argv);
+}
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulation.h"
+#include "logging.h"
+
+// Measures how the election converges on the virtual clock, for
+// increasing counts of nodes and five scenarios:
+//   simultaneous - all nodes start at once
+//   staggered    - nodes start at random times over BENCH_STAGGER_MS
+//   killmaster   - the master of a converged network is killed
+//   handover     - the master of a converged network is shut down
+//   partition    - a converged network is cut in halves for
+//                  BENCH_PARTITION_MS, each elects its master, then heals
+// The time to a stable master is measured from the last start, the kill,
+// the shutdown or the heal until the single master that lasts to the end
+// of the run.
+// Prints one tab-separated line per scenario and count of nodes:
+// scenario, nodes, runs, runs converged, p50 ms, p99 ms, max ms,
+// datagrams sent per run, peak datagrams sent per virtual second,
+// election messages sent and received per node, split brains reported
+// per run by the masters that yielded and their mean duration in ms.
+//
+// Usage: bench_election [runs [max nodes]]
+
+#define BENCH_DEFAULT_RUNS 20
+#define BENCH_DEFAULT_MAX_NODES 1000
+#define BENCH_STAGGER_MS 10000
+// long enough for a monitoring timeout followed by a new election
+#define BENCH_SETTLE_MS 60000
+#define BENCH_LATENCY_MS 1
+#define BENCH_JITTER_MS 2
+#define BENCH_RATE_INTERVAL_MS 1000
+#define BENCH_PARTITION_MS 30000
+
+enum Scenario
+{
+    Simultaneous,
+    Staggered,
+    KillMaster,
+    Handover,
+    Partition
+};
+
+static const char *scenarioNames[] = { "simultaneous", "staggered", "killmaster", "handover", "partition" };
+
+struct RunResult
+{
+    bool converged;
+    uint64_t timeToStableMaster;
+    uint64_t datagrams;
+    uint64_t peakDatagramsRate;
+    uint64_t electionSent;
+    uint64_t electionReceived;
+    uint64_t splitBrains;
+    uint64_t splitBrainDuration;
+};
+
+struct NodeStart
+{
+    uint64_t time;
+    int index;
+};
+
+static int compareStarts(const void *a, const void *b)
+{
+    const struct NodeStart *x = (const struct NodeStart *)a;
+    const struct NodeStart *y = (const struct NodeStart *)b;
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return x->index - y->index;
+}
+
+static uint64_t getDatagramsSent(struct Simulation *simulation)
+{
+    struct SimulationStats stats;
+    simulation->getStats(&stats);
+    return stats.network.unicastsSent + stats.network.broadcastsSent;
+}
+
+// Runs until the given time in steps, to sample the send rate
+static int runSampled(struct Simulation *simulation, uint64_t time, struct RunResult *result, uint64_t *lastDatagrams)
+{
+    while (simulation->getTime() < time) {
+        uint64_t stepEnd = simulation->getTime() + BENCH_RATE_INTERVAL_MS;
+        if (stepEnd > time)
+            stepEnd = time;
+        if (simulation->runUntil(stepEnd) == -1) {
+            logPosition();
+            return -1;
+        }
+
+        uint64_t datagrams = getDatagramsSent(simulation);
+        if (datagrams - *lastDatagrams > result->peakDatagramsRate)
+            result->peakDatagramsRate = datagrams - *lastDatagrams;
+        *lastDatagrams = datagrams;
+    }
+    return 0;
+}
+
+// Runs the scenario on an inited simulation, which the caller deinits
+static int runScenarioOn(struct Simulation *simulation, enum Scenario scenario, int nodesCount, unsigned int seed,
+        struct RunResult *result)
+{
+    uint64_t lastDatagrams = 0;
+    uint64_t eventTime = 0;
+
+    if (scenario == Staggered) {
+        struct NodeStart *starts = (struct NodeStart *)malloc(nodesCount * sizeof(struct NodeStart));
+        if (starts == NULL) {
+            logPosition();
+            return -1;
+        }
+        for (int i = 0; i < nodesCount; ++i) {
+            starts[i].time = rand_r(&seed) % BENCH_STAGGER_MS;
+            starts[i].index = i;
+        }
+        qsort(starts, nodesCount, sizeof(struct NodeStart), compareStarts);
+
+        for (int i = 0; i < nodesCount; ++i) {
+            if (runSampled(simulation, starts[i].time, result, &lastDatagrams) == -1
+                    || simulation->startNode(starts[i].index) == -1) {
+                logPosition();
+                free(starts);
+                return -1;
+            }
+        }
+        free(starts);
+        eventTime = simulation->getTime();
+    }
+    else {
+        if (simulation->startAllNodes() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    if (scenario == KillMaster || scenario == Handover) {
+        if (runSampled(simulation, BENCH_SETTLE_MS, result, &lastDatagrams) == -1) {
+            logPosition();
+            return -1;
+        }
+        int master = simulation->getMaster();
+        if (master == -1) {
+            // never converged, nothing to kill
+            return 0;
+        }
+        int stopped = scenario == Handover ? simulation->shutdownNode(master) : simulation->stopNode(master);
+        if (stopped == -1) {
+            logPosition();
+            return -1;
+        }
+        eventTime = simulation->getTime();
+    }
+
+    if (scenario == Partition) {
+        if (runSampled(simulation, BENCH_SETTLE_MS, result, &lastDatagrams) == -1) {
+            logPosition();
+            return -1;
+        }
+        for (int i = 1; i < nodesCount; i += 2) {
+            if (simulation->setSegment(i, 1) == -1) {
+                logPosition();
+                return -1;
+            }
+        }
+        // heals at any phase of the heartbeats
+        uint64_t healTime = BENCH_SETTLE_MS + BENCH_PARTITION_MS + rand_r(&seed) % BENCH_RATE_INTERVAL_MS;
+        if (runSampled(simulation, healTime, result, &lastDatagrams) == -1) {
+            logPosition();
+            return -1;
+        }
+        for (int i = 1; i < nodesCount; i += 2) {
+            if (simulation->setSegment(i, 0) == -1) {
+                logPosition();
+                return -1;
+            }
+        }
+        eventTime = simulation->getTime();
+    }
+
+    if (runSampled(simulation, eventTime + BENCH_SETTLE_MS, result, &lastDatagrams) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    struct SimulationStats stats;
+    simulation->getStats(&stats);
+
+    result->converged = stats.singleMasterSince != -1;
+    if (result->converged)
+        result->timeToStableMaster = stats.singleMasterSince > (int64_t)eventTime
+            ? stats.singleMasterSince - eventTime : 0;
+    result->datagrams = stats.network.unicastsSent + stats.network.broadcastsSent;
+    result->electionSent = stats.election.whoIsMasterSent + stats.election.iAmMasterSent
+        + stats.election.pleaseWaitSent;
+    result->electionReceived = stats.election.messagesReceived;
+    result->splitBrains = stats.splitBrain.yieldsCount;
+    result->splitBrainDuration = stats.splitBrain.totalDuration;
+    return 0;
+}
+
+static int runScenario(enum Scenario scenario, int nodesCount, unsigned int seed, struct RunResult *result)
+{
+    memset(result, 0, sizeof(struct RunResult));
+
+    struct SimulationConfig config;
+    config.setDefaults();
+    config.nodesCount = nodesCount;
+    config.seed = seed;
+    config.network.latencyMs = BENCH_LATENCY_MS;
+    config.network.jitterMs = BENCH_JITTER_MS;
+
+    struct Simulation simulation;
+    if (simulation.init(&config) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    int ran = runScenarioOn(&simulation, scenario, nodesCount, seed, result);
+    if (simulation.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+    return ran;
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// nearest-rank percentile of sorted values
+static uint64_t percentile(uint64_t *values, int count, int percent)
+{
+    if (count == 0)
+        return 0;
+    int rank = (count * percent + 99) / 100;
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+static int benchScenario(enum Scenario scenario, int nodesCount, int runs)
+{
+    uint64_t *times = (uint64_t *)malloc(runs * sizeof(uint64_t));
+    if (times == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    int convergedCount = 0;
+    uint64_t datagrams = 0;
+    uint64_t peakDatagramsRate = 0;
+    uint64_t electionSent = 0;
+    uint64_t electionReceived = 0;
+    uint64_t splitBrains = 0;
+    uint64_t splitBrainDuration = 0;
+
+    for (int i = 0; i < runs; ++i) {
+        struct RunResult result;
+        if (runScenario(scenario, nodesCount, i + 1, &result) == -1) {
+            logPosition();
+            free(times);
+            return -1;
+        }
+        if (result.converged)
+            times[convergedCount++] = result.timeToStableMaster;
+        datagrams += result.datagrams;
+        electionSent += result.electionSent;
+        electionReceived += result.electionReceived;
+        splitBrains += result.splitBrains;
+        splitBrainDuration += result.splitBrainDuration;
+        if (result.peakDatagramsRate > peakDatagramsRate)
+            peakDatagramsRate = result.peakDatagramsRate;
+    }
+
+    qsort(times, convergedCount, sizeof(uint64_t), compareTimes);
+
+    printf("%s\t%d\t%d\t%d\t%llu\t%llu\t%llu\t%llu\t%llu\t%.1f\t%.1f\t%.1f\t%llu\n",
+        scenarioNames[scenario], nodesCount, runs, convergedCount,
+        (unsigned long long)percentile(times, convergedCount, 50),
+        (unsigned long long)percentile(times, convergedCount, 99),
+        (unsigned long long)(convergedCount > 0 ? times[convergedCount - 1] : 0),
+        (unsigned long long)(datagrams / runs),
+        (unsigned long long)peakDatagramsRate,
+        (double)electionSent / runs / nodesCount,
+        (double)electionReceived / runs / nodesCount,
+        (double)splitBrains / runs,
+        (unsigned long long)(splitBrains > 0 ? splitBrainDuration / splitBrains : 0));
+    fflush(stdout);
+
+    free(times);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    setLogInfoEnabled(false);
+
+    int runs = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_RUNS;
+    int maxNodesCount = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_MAX_NODES;
+    if (runs <= 0) {
+        fprintf(stderr, "Usage: %s [runs [max nodes]]\n", argv[0]);
+        return -1;
+    }
+
+    int nodesCounts[] = { 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+
+    printf("scenario\tnodes\truns\tconverged\tp50 ms\tp99 ms\tmax ms\tdatagrams\tpeak datagrams/s\telection sent/node\telection received/node\tsplit brains\tsplit brain ms\n");
+
+    for (int scenario = Simultaneous; scenario <= Partition; ++scenario) {
+        for (size_t i = 0; i < sizeof(nodesCounts) / sizeof(nodesCounts[0]); ++i) {
+            if (nodesCounts[i] > maxNodesCount)
+                break;
+            if (benchScenario((enum Scenario)scenario, nodesCounts[i], runs) == -1)
+                return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "membership.h"
+#include "logging.h"
+
+// Cost of the master's membership table for up to 100k slaves: adding
+// the slaves, recording one ControlResponse of each in a random order,
+// and a pass of aggregation over the samples.
+
+static struct MembershipTable table;
+static bool tableInitialized = false;
+
+static struct NodeIdentity *identities = NULL;
+// random order of replies
+static long *order = NULL;
+static long identitiesCount = 0;
+
+static volatile int64_t sink;
+
+// Slaves are processes with small ids on hosts with random MAC addresses
+static void prepareIdentities(long count)
+{
+    if (count > identitiesCount) {
+        identities = (struct NodeIdentity *)realloc(identities, count * sizeof(struct NodeIdentity));
+        order = (long *)realloc(order, count * sizeof(long));
+        if (identities == NULL || order == NULL)
+            die("Out of memory");
+        identitiesCount = count;
+    }
+
+    unsigned int seed = 1;
+    for (long i = 0; i < count; ++i) {
+        identities[i].processId = 1000 + rand_r(&seed) % 32768;
+        identities[i].macAddress[0] = 0x02;
+        for (int j = 1; j < 6; ++j)
+            identities[i].macAddress[j] = (unsigned char)rand_r(&seed);
+        order[i] = i;
+    }
+    for (long i = count - 1; i > 0; --i) {
+        long j = rand_r(&seed) % (i + 1);
+        long position = order[i];
+        order[i] = order[j];
+        order[j] = position;
+    }
+}
+
+static void prepareTable(long count)
+{
+    if (tableInitialized)
+        table.deinit();
+    if (table.init(MEMBERSHIP_INITIAL_CAPACITY) == -1)
+        die("Out of memory");
+    tableInitialized = true;
+
+    for (long i = 0; i < count; ++i) {
+        if (table.findOrAdd(&identities[i]) == -1)
+            die("Out of memory");
+    }
+}
+
+// The table grows from its initial capacity, as on a new master
+static void BM_MembershipAdd(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareIdentities(state->range);
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it)
+        prepareTable(state->range);
+    state->itemsProcessed = state->iterations * state->range;
+}
+
+static void BM_MembershipUpdate(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareIdentities(state->range);
+    prepareTable(state->range);
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it) {
+        uint32_t round = (uint32_t)it + 1;
+        for (long i = 0; i < state->range; ++i) {
+            long position = table.findOrAdd(&identities[order[i]]);
+            table.members[position].lastSeenTime = round;
+            table.samples[position].round = round;
+            table.samples[position].luminosity = 1000 + (int32_t)i;
+            table.samples[position].temperature = 20;
+        }
+    }
+    state->itemsProcessed = state->iterations * state->range;
+}
+
+static void BM_MembershipAggregate(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareIdentities(state->range);
+    prepareTable(state->range);
+    for (long i = 0; i < state->range; ++i) {
+        table.samples[i].round = 1;
+        table.samples[i].luminosity = 1000 + (int32_t)i;
+    }
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it) {
+        int64_t sum = 0;
+        for (size_t i = 0; i < table.count; ++i) {
+            if (table.samples[i].round == 1)
+                sum += table.samples[i].luminosity;
+        }
+        sink = sum;
+    }
+    state->itemsProcessed = state->iterations * state->range;
+}
+
+BENCHMARK_RANGE(BM_MembershipAdd, 1000)
+BENCHMARK_RANGE(BM_MembershipAdd, 10000)
+BENCHMARK_RANGE(BM_MembershipAdd, 100000)
+BENCHMARK_RANGE(BM_MembershipUpdate, 1000)
+BENCHMARK_RANGE(BM_MembershipUpdate, 10000)
+BENCHMARK_RANGE(BM_MembershipUpdate, 100000)
+BENCHMARK_RANGE(BM_MembershipAggregate, 1000)
+BENCHMARK_RANGE(BM_MembershipAggregate, 10000)
+BENCHMARK_RANGE(BM_MembershipAggregate, 100000)
+
+int main(int argc, char *argv[])
+{
+    return runBenchmarks(argc, argv);
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+#include "networking.h"
+#include "uringnet.h"
+#include "logging.h"
+
+// Compares the Networking backends on loopback: packets per second and
+// CPU time of the loop thread per packet, for receiving, for sending one
+// datagram at a time and for sending a fan-out of one payload as a batch.
+// Prints one tab-separated line per run.
+
+#define BENCH_PORT 10590
+#define BENCH_PACKETS 500000
+#define BENCH_PAYLOAD_SIZE 64
+// sends between loop iterations, like a burst of protocol replies
+#define BENCH_SEND_BURST 64
+#define BENCH_IDLE_CHECK_MS 100
+
+static uint64_t nowNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void initLoopbackAddress(struct sockaddr_in *addr, uint16_t port)
+{
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static void printResult(const char *backend, const char *direction,
+        long packets, long delivered, uint64_t wallNs, uint64_t cpuNs)
+{
+    printf("%s\t%s\t%ld\t%ld\t%.0f\t%.1f\n",
+        backend, direction, packets, delivered,
+        delivered * 1e9 / wallNs,
+        delivered > 0 ? (double)cpuNs / delivered : 0.0);
+    fflush(stdout);
+}
+
+struct RecvRun
+{
+    struct Networking *net;
+    long received;
+    long receivedAtLastCheck;
+    bool senderDone;
+    uint64_t lastReceiveTime;
+};
+
+static void *senderThread(void *arg)
+{
+    struct RecvRun *run = (struct RecvRun*)arg;
+
+    int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd == -1)
+        die("Cannot create sender socket");
+
+    struct sockaddr_in addr;
+    initLoopbackAddress(&addr, BENCH_PORT);
+
+    unsigned char payload[BENCH_PAYLOAD_SIZE];
+    memset(payload, 'x', sizeof(payload));
+
+    struct mmsghdr messages[SEND_BATCH_SIZE];
+    struct iovec vector;
+    vector.iov_base = payload;
+    vector.iov_len = sizeof(payload);
+    for (int i = 0; i < SEND_BATCH_SIZE; ++i) {
+        memset(&messages[i].msg_hdr, 0, sizeof(struct msghdr));
+        messages[i].msg_hdr.msg_name = &addr;
+        messages[i].msg_hdr.msg_namelen = sizeof(addr);
+        messages[i].msg_hdr.msg_iov = &vector;
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for (long sent = 0; sent < BENCH_PACKETS; ) {
+        int res = sendmmsg(socketFd, messages, SEND_BATCH_SIZE, 0);
+        if (res > 0)
+            sent += res;
+    }
+    close(socketFd);
+
+    __atomic_store_n(&run->senderDone, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void countReceived(struct RecvDatagram *datagrams, size_t count, void *arg)
+{
+    struct RecvRun *run = (struct RecvRun*)arg;
+    run->received += count;
+}
+
+static void idleCheck(TimerHandlerArgument arg)
+{
+    struct RecvRun *run = (struct RecvRun*)arg.ptrValue;
+
+    if (run->received != run->receivedAtLastCheck) {
+        run->receivedAtLastCheck = run->received;
+        run->lastReceiveTime = nowNs(CLOCK_MONOTONIC);
+        return;
+    }
+    if (__atomic_load_n(&run->senderDone, __ATOMIC_ACQUIRE))
+        run->net->breakRecvLoop = true;
+}
+
+static void benchReceive(const char *name, enum NetworkingBackend backend)
+{
+    struct EventLoop loop;
+    if (loop.init() == -1)
+        die("Cannot init event loop");
+
+    struct NetworkingConfig config;
+    config.setDefaults();
+    config.udpPort = BENCH_PORT;
+    config.backend = backend;
+
+    struct Networking net;
+    if (net.init(&config, &loop) == -1)
+        die("Cannot init networking");
+
+    struct RecvRun run;
+    run.net = &net;
+    run.received = 0;
+    run.receivedAtLastCheck = 0;
+    run.senderDone = false;
+
+    TimerHandlerArgument arg;
+    arg.ptrValue = &run;
+    struct Timer idleTimer;
+    if (idleTimer.init(&loop.timerSystem, BENCH_IDLE_CHECK_MS, true, idleCheck, arg) == -1)
+        die("Cannot init timer");
+    idleTimer.start();
+
+    pthread_t sender;
+    uint64_t wallStart = nowNs(CLOCK_MONOTONIC);
+    uint64_t cpuStart = nowNs(CLOCK_THREAD_CPUTIME_ID);
+    run.lastReceiveTime = wallStart;
+    if (pthread_create(&sender, NULL, senderThread, &run) != 0)
+        die("Cannot start sender");
+
+    if (net.runRecvBatchLoop(countReceived, &run) == -1)
+        die("Receive loop failed");
+
+    uint64_t cpuNs = nowNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    pthread_join(sender, NULL);
+
+    // the idle checks after the last datagram are not receive time
+    printResult(name, "recv", BENCH_PACKETS, run.received, run.lastReceiveTime - wallStart, cpuNs);
+
+    idleTimer.deinit();
+    net.deinit();
+    loop.deinit();
+}
+
+static void benchSend(const char *name, enum NetworkingBackend backend, bool batched)
+{
+    struct EventLoop loop;
+    if (loop.init() == -1)
+        die("Cannot init event loop");
+
+    struct NetworkingConfig config;
+    config.setDefaults();
+    config.udpPort = BENCH_PORT;
+    config.backend = backend;
+
+    struct Networking net;
+    if (net.init(&config, &loop) == -1)
+        die("Cannot init networking");
+
+    // a peer that never reads: the kernel drops what overflows its buffer
+    struct sockaddr_in sinkAddress;
+    initLoopbackAddress(&sinkAddress, BENCH_PORT + 1);
+    int sinkFd = Networking::bindDgramSocket(&sinkAddress, false);
+    if (sinkFd == -1)
+        die("Cannot bind sink socket");
+
+    unsigned char payload[BENCH_PAYLOAD_SIZE];
+    memset(payload, 'x', sizeof(payload));
+
+    // the burst as a fan-out of one message to as many peers
+    struct SendBatch batch;
+    batch.init(&net);
+
+    long sent = 0;
+    uint64_t wallStart = nowNs(CLOCK_MONOTONIC);
+    uint64_t cpuStart = nowNs(CLOCK_THREAD_CPUTIME_ID);
+
+    while (sent < BENCH_PACKETS) {
+        for (int i = 0; i < BENCH_SEND_BURST; ++i) {
+            int res = batched ? batch.add(&sinkAddress, payload, sizeof(payload))
+                : net.sendDgram(&sinkAddress, payload, sizeof(payload));
+            if (res == -1)
+                die("Send failed");
+        }
+        if (batch.flush() == -1)
+            die("Send failed");
+        sent += BENCH_SEND_BURST;
+        // flushes queued sends and reaps their completions
+        if (loop.runOnce(0) == -1)
+            die("Loop failed");
+    }
+    uint64_t cpuNs = nowNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    uint64_t wallNs = nowNs(CLOCK_MONOTONIC) - wallStart;
+    printResult(name, batched ? "send batch" : "send", sent, sent, wallNs, cpuNs);
+
+    close(sinkFd);
+    net.deinit();
+    loop.deinit();
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    printf("backend\tdirection\tpackets\tdelivered\tpackets/s\tcpu ns/packet\n");
+
+    if (filter == NULL || strstr("sockets", filter) != NULL) {
+        benchReceive("sockets", NETWORKING_BACKEND_SOCKETS);
+        benchSend("sockets", NETWORKING_BACKEND_SOCKETS, false);
+        benchSend("sockets", NETWORKING_BACKEND_SOCKETS, true);
+    }
+    if (filter == NULL || strstr("io_uring", filter) != NULL) {
+        benchReceive("io_uring", NETWORKING_BACKEND_IO_URING);
+        benchSend("io_uring", NETWORKING_BACKEND_IO_URING, false);
+        benchSend("io_uring", NETWORKING_BACKEND_IO_URING, true);
+    }
+    return 0;
+}
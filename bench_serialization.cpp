@@ -0,0 +1,524 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "benchmark.h"
+#include "messages.h"
+
+// Encode and decode time of each message type with the schemas of
+// messages.h, decoded through a table by type as SelfNode does, next to
+// the per-field streams they have replaced (Baseline), which
+// bounds-check every field and access it through a possibly misaligned
+// uint32_t pointer. The V2 benchmarks code the compact wire format.
+
+#define BENCH_DISPLAY_TEXT "Temperature: 22"
+#define BENCH_BUFFER_SIZE 128
+// messages coded per iteration, like a receive batch
+#define BENCH_BATCH_SIZE 64
+
+static unsigned char buffers[BENCH_BATCH_SIZE][BENCH_BUFFER_SIZE];
+static struct NodeIdentity senderId = { 4242, { 0x02, 0x42, 0xac, 0x11, 0x00, 0x02 } };
+
+static volatile uint32_t sink;
+
+struct BaselineWriteByteStream
+{
+    unsigned char *buffer;
+    size_t bufferSize;
+
+    void openStream(unsigned char *buffer, size_t bufferSize)
+    {
+        this->buffer = buffer;
+        this->bufferSize = bufferSize;
+    }
+
+    int writeInt32(uint32_t value)
+    {
+        if (bufferSize < sizeof(uint32_t))
+            return -1;
+        ((uint32_t*)buffer)[0] = htonl(value);
+        buffer += sizeof(uint32_t);
+        bufferSize -= sizeof(uint32_t);
+        return 0;
+    }
+
+    int writeBytes(const unsigned char *bytes, size_t bytesCount)
+    {
+        if (bufferSize < bytesCount)
+            return -1;
+        memcpy(buffer, bytes, bytesCount);
+        buffer += bytesCount;
+        bufferSize -= bytesCount;
+        return 0;
+    }
+};
+
+struct BaselineReadByteStream
+{
+    unsigned char *buffer;
+    size_t bufferSize;
+
+    void openStream(unsigned char *buffer, size_t bufferSize)
+    {
+        this->buffer = buffer;
+        this->bufferSize = bufferSize;
+    }
+
+    int readInt32(uint32_t *value)
+    {
+        if (bufferSize < sizeof(uint32_t))
+            return -1;
+        *value = ntohl(((uint32_t*)buffer)[0]);
+        buffer += sizeof(uint32_t);
+        bufferSize -= sizeof(uint32_t);
+        return 0;
+    }
+
+    int readBytes(unsigned char *bytes, size_t bytesCount)
+    {
+        if (bufferSize < bytesCount)
+            return -1;
+        memcpy(bytes, buffer, bytesCount);
+        buffer += bytesCount;
+        bufferSize -= bytesCount;
+        return 0;
+    }
+};
+
+static int baselineSerializeMessage(struct BaselineWriteByteStream *s, enum MessageType type, struct NodeIdentity *nodeId)
+{
+    if (s->writeInt32(type) == -1)
+        return -1;
+    if (s->writeInt32(nodeId->processId) == -1)
+        return -1;
+    if (s->writeBytes(nodeId->macAddress, 6) == -1)
+        return -1;
+    return 0;
+}
+
+static int baselineDeserializeMessage(struct BaselineReadByteStream *s, enum MessageType *type, struct NodeIdentity *nodeId)
+{
+    if (s->readInt32((uint32_t*)type) == -1)
+        return -1;
+    if (s->readInt32((uint32_t*)&nodeId->processId) == -1)
+        return -1;
+    if (s->readBytes(nodeId->macAddress, 6) == -1)
+        return -1;
+    return 0;
+}
+
+// Writes a message of the type with the body SelfNode sends,
+// returns its size or -1
+template <typename Stream, int (*serializeHeader)(Stream *, enum MessageType, struct NodeIdentity *)>
+static int encodeMessage(unsigned char *buffer, enum MessageType type)
+{
+    Stream s;
+    s.openStream(buffer, BENCH_BUFFER_SIZE);
+    if (serializeHeader(&s, type, &senderId) == -1)
+        return -1;
+
+    if (type == ControlResponse) {
+        if (s.writeInt32(1042) == -1 || s.writeInt32(22) == -1)
+            return -1;
+    }
+    else if (type == ControlSet) {
+        if (s.writeInt32(5168) == -1
+                || s.writeBytes((const unsigned char *)BENCH_DISPLAY_TEXT, strlen(BENCH_DISPLAY_TEXT)) == -1)
+            return -1;
+    }
+    return (int)(s.buffer - buffer);
+}
+
+// Reads the message back as SelfNode does, returns a checksum or -1
+template <typename Stream, int (*deserializeHeader)(Stream *, enum MessageType *, struct NodeIdentity *)>
+static int64_t decodeMessage(unsigned char *buffer, size_t size)
+{
+    Stream s;
+    s.openStream(buffer, size);
+
+    enum MessageType type;
+    struct NodeIdentity id;
+    if (deserializeHeader(&s, &type, &id) == -1)
+        return -1;
+
+    uint32_t checksum = type + id.processId + id.macAddress[5];
+    uint32_t value;
+    switch (type) {
+    case ControlResponse:
+        if (s.readInt32(&value) == -1)
+            return -1;
+        checksum += value;
+        if (s.readInt32(&value) == -1)
+            return -1;
+        checksum += value;
+        break;
+    case ControlSet:
+        if (s.readInt32(&value) == -1)
+            return -1;
+        // the text stays in the buffer
+        checksum += value + s.bufferSize;
+        break;
+    default:
+        break;
+    }
+    return checksum;
+}
+
+template <typename Stream, int (*serializeHeader)(Stream *, enum MessageType, struct NodeIdentity *)>
+static void encodeBatch(struct BenchmarkState *state)
+{
+    enum MessageType type = (enum MessageType)state->range;
+    for (long it = 0; it < state->iterations; ++it) {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_BATCH_SIZE; ++i)
+            sum += encodeMessage<Stream, serializeHeader>(buffers[i], type);
+        sink = sum;
+    }
+    state->itemsProcessed = state->iterations * BENCH_BATCH_SIZE;
+}
+
+template <typename WriteStream, int (*serializeHeader)(WriteStream *, enum MessageType, struct NodeIdentity *),
+          typename ReadStream, int (*deserializeHeader)(ReadStream *, enum MessageType *, struct NodeIdentity *)>
+static void decodeBatch(struct BenchmarkState *state)
+{
+    int size = 0;
+    for (int i = 0; i < BENCH_BATCH_SIZE; ++i)
+        size = encodeMessage<WriteStream, serializeHeader>(buffers[i], (enum MessageType)state->range);
+
+    for (long it = 0; it < state->iterations; ++it) {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_BATCH_SIZE; ++i)
+            sum += decodeMessage<ReadStream, deserializeHeader>(buffers[i], size);
+        sink = sum;
+    }
+    state->itemsProcessed = state->iterations * BENCH_BATCH_SIZE;
+}
+
+// The bodies SelfNode sends
+static void fillBody(struct EmptyBody *body)
+{
+}
+
+static void fillBody(struct MasterHeartbeatBody *body)
+{
+    body->heartbeatIntervalMs = 1000;
+    body->isHeartbeat = 1;
+    body->hasDeputy = 1;
+    body->masterForMs = 3600000;
+}
+
+static void fillBody(struct ControlRequestBody *body)
+{
+    body->responseWindowMs = 50;
+    body->treeEpoch = 3;
+}
+
+static void fillBody(struct SensorsInfoBody *body)
+{
+    body->luminosity = 1042;
+    body->temperature = 22;
+}
+
+static void fillBody(struct DisplayInfoBody *body)
+{
+    body->brightness = 5168;
+    body->text = BENCH_DISPLAY_TEXT;
+    body->textLength = strlen(BENCH_DISPLAY_TEXT);
+}
+
+static const unsigned char benchChildren[2 * AGGREGATION_CHILD_SIZE] = {
+    10, 0, 0, 2, 0x29, 0x04,
+    10, 0, 0, 3, 0x29, 0x04
+};
+
+static void fillBody(struct AggregationAssignBody *body)
+{
+    body->treeEpoch = 3;
+    body->underAggregator = 1;
+    body->collectMs = 750;
+    body->descendantsCount = 40;
+    body->children = benchChildren;
+    body->childrenSize = sizeof(benchChildren);
+}
+
+static void fillBody(struct SensorsSummaryBody *body)
+{
+    body->count = 32;
+    body->luminositySum = 33344;
+    body->luminosityM2 = 26656;
+    body->luminosityMin = 1001;
+    body->luminosityMax = 1099;
+    body->temperatureSum = 608;
+    body->temperatureM2 = 1064;
+    body->temperatureMin = 10;
+    body->temperatureMax = 29;
+}
+
+static const unsigned char benchMembers[2 * DEPUTY_MEMBER_SIZE] = {
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0, 0, 0x10, 0x01, 10, 0, 0, 2, 0x29, 0x04,
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0, 0, 0x10, 0x02, 10, 0, 0, 3, 0x29, 0x04
+};
+
+static void fillBody(struct DeputySyncBody *body)
+{
+    body->isDeputy = 1;
+    body->controlRound = 1200;
+    body->firstMember = 0;
+    body->membersCount = 2;
+    body->sequence = 31;
+    body->leftCount = 0;
+    body->members = benchMembers;
+    body->membersSize = sizeof(benchMembers);
+}
+
+static void fillBody(struct AbdicationBody *body)
+{
+    body->controlRound = 1200;
+    body->successor = benchMembers;
+    body->successorSize = DEPUTY_MEMBER_SIZE;
+}
+
+static void fillBody(struct MembershipMergeBody *body)
+{
+    body->members = benchMembers;
+    body->membersSize = sizeof(benchMembers);
+}
+
+static uint32_t bodyChecksum(const struct EmptyBody *body)
+{
+    return 0;
+}
+
+static uint32_t bodyChecksum(const struct MasterHeartbeatBody *body)
+{
+    return body->heartbeatIntervalMs + body->isHeartbeat + body->hasDeputy + body->masterForMs;
+}
+
+static uint32_t bodyChecksum(const struct ControlRequestBody *body)
+{
+    return body->responseWindowMs + body->treeEpoch;
+}
+
+static uint32_t bodyChecksum(const struct SensorsInfoBody *body)
+{
+    return body->luminosity + body->temperature;
+}
+
+static uint32_t bodyChecksum(const struct DisplayInfoBody *body)
+{
+    // the text stays in the buffer
+    return body->brightness + body->textLength;
+}
+
+static uint32_t bodyChecksum(const struct DeputySyncBody *body)
+{
+    return body->controlRound + body->firstMember + body->membersCount + body->sequence + body->leftCount
+        + body->membersSize;
+}
+
+static uint32_t bodyChecksum(const struct AbdicationBody *body)
+{
+    return body->controlRound + body->successorSize;
+}
+
+static uint32_t bodyChecksum(const struct MembershipMergeBody *body)
+{
+    return body->membersSize;
+}
+
+static uint32_t bodyChecksum(const struct AggregationAssignBody *body)
+{
+    return body->treeEpoch + body->collectMs + body->descendantsCount + body->childrenSize;
+}
+
+static uint32_t bodyChecksum(const struct SensorsSummaryBody *body)
+{
+    return body->count + body->luminositySum + body->luminosityM2 + body->temperatureSum + body->temperatureM2;
+}
+
+template <enum MessageType type>
+static int encodeSchemaMessage(unsigned char *buffer, enum WireVersion version)
+{
+    typename MessageSchemaOf<type>::Body body;
+    fillBody(&body);
+
+    WriteByteStream s;
+    s.openStream(buffer, BENCH_BUFFER_SIZE);
+    if (MessageSchemaOf<type>::encode(&s, version, &senderId, &body) == -1)
+        return -1;
+    return (int)(s.buffer - buffer);
+}
+
+template <enum MessageType type>
+static int64_t decodeSchemaBody(struct ReadByteStream *s, enum WireVersion version)
+{
+    typename MessageSchemaOf<type>::Body body;
+    if (MessageSchemaOf<type>::decodeBody(s, version, &body) == -1)
+        return -1;
+    return bodyChecksum(&body);
+}
+
+// The version is a constant of the batch, as it is for each call of
+// SelfNode::encodeMessage()
+template <enum MessageType type, enum WireVersion version>
+static void encodeSchemaBatch(struct BenchmarkState *state)
+{
+    for (long it = 0; it < state->iterations; ++it) {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_BATCH_SIZE; ++i)
+            sum += encodeSchemaMessage<type>(buffers[i], version);
+        sink = sum;
+    }
+    state->itemsProcessed = state->iterations * BENCH_BATCH_SIZE;
+}
+
+typedef int (*MessageEncoder)(unsigned char *buffer, enum WireVersion version);
+typedef int64_t (*BodyDecoder)(struct ReadByteStream *s, enum WireVersion version);
+
+template <typename List>
+struct SchemaCoders;
+
+template <int... Types>
+struct SchemaCoders<MessageTypeList<Types...> >
+{
+    static const BenchmarkFunction encodeBatchesV1[MESSAGE_TYPES_COUNT];
+    static const BenchmarkFunction encodeBatchesV2[MESSAGE_TYPES_COUNT];
+    static const MessageEncoder encoders[MESSAGE_TYPES_COUNT];
+    static const BodyDecoder bodyDecoders[MESSAGE_TYPES_COUNT];
+};
+
+template <int... Types>
+const BenchmarkFunction SchemaCoders<MessageTypeList<Types...> >::encodeBatchesV1[MESSAGE_TYPES_COUNT] = {
+    &encodeSchemaBatch<(enum MessageType)Types, WireV1>...
+};
+
+template <int... Types>
+const BenchmarkFunction SchemaCoders<MessageTypeList<Types...> >::encodeBatchesV2[MESSAGE_TYPES_COUNT] = {
+    &encodeSchemaBatch<(enum MessageType)Types, WireV2>...
+};
+
+template <int... Types>
+const MessageEncoder SchemaCoders<MessageTypeList<Types...> >::encoders[MESSAGE_TYPES_COUNT] = {
+    &encodeSchemaMessage<(enum MessageType)Types>...
+};
+
+template <int... Types>
+const BodyDecoder SchemaCoders<MessageTypeList<Types...> >::bodyDecoders[MESSAGE_TYPES_COUNT] = {
+    &decodeSchemaBody<(enum MessageType)Types>...
+};
+
+typedef SchemaCoders<AllMessageTypes<>::List> Coders;
+
+static int64_t decodeSchemaMessage(unsigned char *buffer, size_t size)
+{
+    ReadByteStream s;
+    s.openStream(buffer, size);
+
+    enum MessageType type;
+    struct NodeIdentity id;
+    enum WireVersion version;
+    if (deserializeMessage(&s, &type, &id, &version) == -1 || (unsigned int)type >= MESSAGE_TYPES_COUNT)
+        return -1;
+
+    return type + id.processId + id.macAddress[5] + Coders::bodyDecoders[type](&s, version);
+}
+
+static void decodeSchemaBatch(struct BenchmarkState *state, enum WireVersion version)
+{
+    int size = 0;
+    for (int i = 0; i < BENCH_BATCH_SIZE; ++i)
+        size = Coders::encoders[state->range](buffers[i], version);
+
+    for (long it = 0; it < state->iterations; ++it) {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_BATCH_SIZE; ++i)
+            sum += decodeSchemaMessage(buffers[i], size);
+        sink = sum;
+    }
+    state->itemsProcessed = state->iterations * BENCH_BATCH_SIZE;
+}
+
+static void BM_SerializeMessage(struct BenchmarkState *state)
+{
+    Coders::encodeBatchesV1[state->range](state);
+}
+
+static void BM_DeserializeMessage(struct BenchmarkState *state)
+{
+    decodeSchemaBatch(state, WireV1);
+}
+
+static void BM_SerializeMessageV2(struct BenchmarkState *state)
+{
+    Coders::encodeBatchesV2[state->range](state);
+}
+
+static void BM_DeserializeMessageV2(struct BenchmarkState *state)
+{
+    decodeSchemaBatch(state, WireV2);
+}
+
+static void BM_BaselineSerializeMessage(struct BenchmarkState *state)
+{
+    encodeBatch<BaselineWriteByteStream, baselineSerializeMessage>(state);
+}
+
+static void BM_BaselineDeserializeMessage(struct BenchmarkState *state)
+{
+    decodeBatch<BaselineWriteByteStream, baselineSerializeMessage, BaselineReadByteStream, baselineDeserializeMessage>(state);
+}
+
+BENCHMARK_RANGE(BM_SerializeMessage, WhoIsMaster)
+BENCHMARK_RANGE(BM_SerializeMessage, IAmMaster)
+BENCHMARK_RANGE(BM_SerializeMessage, PleaseWait)
+BENCHMARK_RANGE(BM_SerializeMessage, ControlRequest)
+BENCHMARK_RANGE(BM_SerializeMessage, ControlResponse)
+BENCHMARK_RANGE(BM_SerializeMessage, ControlSet)
+BENCHMARK_RANGE(BM_SerializeMessage, AggregationAssign)
+BENCHMARK_RANGE(BM_SerializeMessage, ControlSummary)
+BENCHMARK_RANGE(BM_SerializeMessage, DeputySync)
+BENCHMARK_RANGE(BM_BaselineSerializeMessage, WhoIsMaster)
+BENCHMARK_RANGE(BM_BaselineSerializeMessage, IAmMaster)
+BENCHMARK_RANGE(BM_BaselineSerializeMessage, PleaseWait)
+BENCHMARK_RANGE(BM_BaselineSerializeMessage, ControlRequest)
+BENCHMARK_RANGE(BM_BaselineSerializeMessage, ControlResponse)
+BENCHMARK_RANGE(BM_BaselineSerializeMessage, ControlSet)
+BENCHMARK_RANGE(BM_DeserializeMessage, WhoIsMaster)
+BENCHMARK_RANGE(BM_DeserializeMessage, IAmMaster)
+BENCHMARK_RANGE(BM_DeserializeMessage, PleaseWait)
+BENCHMARK_RANGE(BM_DeserializeMessage, ControlRequest)
+BENCHMARK_RANGE(BM_DeserializeMessage, ControlResponse)
+BENCHMARK_RANGE(BM_DeserializeMessage, ControlSet)
+BENCHMARK_RANGE(BM_DeserializeMessage, AggregationAssign)
+BENCHMARK_RANGE(BM_DeserializeMessage, ControlSummary)
+BENCHMARK_RANGE(BM_DeserializeMessage, DeputySync)
+BENCHMARK_RANGE(BM_BaselineDeserializeMessage, WhoIsMaster)
+BENCHMARK_RANGE(BM_BaselineDeserializeMessage, IAmMaster)
+BENCHMARK_RANGE(BM_BaselineDeserializeMessage, PleaseWait)
+BENCHMARK_RANGE(BM_BaselineDeserializeMessage, ControlRequest)
+BENCHMARK_RANGE(BM_BaselineDeserializeMessage, ControlResponse)
+BENCHMARK_RANGE(BM_BaselineDeserializeMessage, ControlSet)
+BENCHMARK_RANGE(BM_SerializeMessageV2, WhoIsMaster)
+BENCHMARK_RANGE(BM_SerializeMessageV2, IAmMaster)
+BENCHMARK_RANGE(BM_SerializeMessageV2, PleaseWait)
+BENCHMARK_RANGE(BM_SerializeMessageV2, ControlRequest)
+BENCHMARK_RANGE(BM_SerializeMessageV2, ControlResponse)
+BENCHMARK_RANGE(BM_SerializeMessageV2, ControlSet)
+BENCHMARK_RANGE(BM_SerializeMessageV2, AggregationAssign)
+BENCHMARK_RANGE(BM_SerializeMessageV2, ControlSummary)
+BENCHMARK_RANGE(BM_SerializeMessageV2, DeputySync)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, WhoIsMaster)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, IAmMaster)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, PleaseWait)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, ControlRequest)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, ControlResponse)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, ControlSet)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, AggregationAssign)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, ControlSummary)
+BENCHMARK_RANGE(BM_DeserializeMessageV2, DeputySync)
+
+int main(int argc, char *argv[])
+{
+    return runBenchmarks(argc, argv);
+}
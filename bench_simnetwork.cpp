@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "eventloop.h"
+#include "simnetwork.h"
+#include "nodes.h"
+#include "logging.h"
+
+// Runs many nodes in one process on the in-memory network, all on one
+// loop thread, and reports the traffic of the election and of the
+// control rounds. Prints one tab-separated line per run:
+// nodes, seconds, unicasts, broadcasts, deliveries, deliveries/s,
+// datagrams dropped for lack of buffers, masters, slaves, seconds to
+// a single master, loop CPU seconds.
+//
+// Usage: bench_simnetwork [nodes [seconds [latency ms [jitter ms]]]]
+// Without arguments runs 1000, 2000, 5000 and 10000 nodes.
+
+#define BENCH_DEFAULT_SECONDS 12
+#define BENCH_CHECK_INTERVAL_MS 100
+
+static uint64_t nowNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void countStates(struct SelfNode *nodes, int nodesCount, int *masters, int *slaves)
+{
+    *masters = 0;
+    *slaves = 0;
+    for (int i = 0; i < nodesCount; ++i) {
+        enum NodeState state = nodes[i].getState();
+        if (state == Master)
+            ++*masters;
+        else if (state == Slave)
+            ++*slaves;
+    }
+}
+
+static int runNodes(int nodesCount, int seconds, int latencyMs, int jitterMs)
+{
+    struct EventLoop loop;
+    if (loop.init() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    struct SimNetworkConfig simConfig;
+    simConfig.setDefaults();
+    simConfig.latencyMs = latencyMs;
+    simConfig.jitterMs = jitterMs;
+
+    struct SimNetwork network;
+    if (network.init(&simConfig, &loop) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    struct SimEndpoint *endpoints = (struct SimEndpoint *)calloc(nodesCount, sizeof(struct SimEndpoint));
+    struct NodeIdentity *identities = (struct NodeIdentity *)calloc(nodesCount, sizeof(struct NodeIdentity));
+    struct SelfNode *nodes = (struct SelfNode *)calloc(nodesCount, sizeof(struct SelfNode));
+    if (endpoints == NULL || identities == NULL || nodes == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    for (int i = 0; i < nodesCount; ++i) {
+        if (network.addEndpoint(&endpoints[i]) == -1) {
+            logPosition();
+            return -1;
+        }
+
+        identities[i].processId = i + 1;
+        memset(identities[i].macAddress, 0x02, sizeof(identities[i].macAddress));
+
+        struct SelfNodeConfig config;
+        config.setDefaults();
+        config.net.transport = &endpoints[i].transport;
+        config.identity = &identities[i];
+
+        if (nodes[i].init(&config, &loop) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    uint64_t startTime = nowNs(CLOCK_MONOTONIC);
+    uint64_t startCpu = nowNs(CLOCK_PROCESS_CPUTIME_ID);
+
+    for (int i = 0; i < nodesCount; ++i) {
+        if (nodes[i].start() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    uint64_t endTime = startTime + (uint64_t)seconds * 1000000000ULL;
+    double singleMasterSeconds = -1;
+    int masters = 0;
+    int slaves = 0;
+
+    uint64_t currentTime = startTime;
+    while (currentTime < endTime) {
+        if (loop.runOnce(BENCH_CHECK_INTERVAL_MS) == -1) {
+            logPosition();
+            return -1;
+        }
+        currentTime = nowNs(CLOCK_MONOTONIC);
+
+        countStates(nodes, nodesCount, &masters, &slaves);
+        if (masters == 1 && slaves == nodesCount - 1) {
+            if (singleMasterSeconds < 0)
+                singleMasterSeconds = (currentTime - startTime) / 1e9;
+        }
+        else {
+            singleMasterSeconds = -1;
+        }
+    }
+
+    uint64_t cpuNs = nowNs(CLOCK_PROCESS_CPUTIME_ID) - startCpu;
+    uint64_t wallNs = currentTime - startTime;
+
+    struct SimNetworkStats stats;
+    network.getStats(&stats);
+
+    printf("%d\t%d\t%llu\t%llu\t%llu\t%.0f\t%llu\t%d\t%d\t%.2f\t%.2f\n",
+        nodesCount, seconds,
+        (unsigned long long)stats.unicastsSent,
+        (unsigned long long)stats.broadcastsSent,
+        (unsigned long long)stats.deliveries,
+        stats.deliveries * 1e9 / wallNs,
+        (unsigned long long)stats.drops,
+        masters, slaves, singleMasterSeconds,
+        cpuNs / 1e9);
+    fflush(stdout);
+
+    for (int i = 0; i < nodesCount; ++i) {
+        if (nodes[i].stop() == -1 || nodes[i].deinit() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    if (network.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+    free(nodes);
+    free(identities);
+    free(endpoints);
+
+    if (loop.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    setLogInfoEnabled(false);
+
+    int seconds = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_SECONDS;
+    int latencyMs = argc > 3 ? atoi(argv[3]) : 1;
+    int jitterMs = argc > 4 ? atoi(argv[4]) : 0;
+
+    printf("nodes\tseconds\tunicasts\tbroadcasts\tdeliveries\tdeliveries/s\tdrops\tmasters\tslaves\tsingle master s\tcpu s\n");
+
+    if (argc > 1)
+        return runNodes(atoi(argv[1]), seconds, latencyMs, jitterMs) == -1 ? -1 : 0;
+
+    int nodesCounts[] = { 1000, 2000, 5000, 10000 };
+    for (size_t i = 0; i < sizeof(nodesCounts) / sizeof(nodesCounts[0]); ++i) {
+        if (runNodes(nodesCounts[i], seconds, latencyMs, jitterMs) == -1)
+            return -1;
+    }
+    return 0;
+}
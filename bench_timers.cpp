@@ -0,0 +1,169 @@
+#include <stdlib.h>
+
+#include "benchmark.h"
+#include "eventloop.h"
+#include "timers.h"
+#include "timerwheel.h"
+#include "logging.h"
+
+// Deadlines spread like protocol timeouts: up to 30 s of 1 ms ticks
+#define MAX_TIMEOUT_TICKS 30000
+
+static struct TimerWheel wheel;
+
+static struct TimerWheelNode *nodes = NULL;
+static uint64_t *deadlines = NULL;
+static long nodesCount = 0;
+
+static void prepareNodes(long count)
+{
+    if (count > nodesCount) {
+        nodes = (struct TimerWheelNode *)realloc(nodes, count * sizeof(struct TimerWheelNode));
+        deadlines = (uint64_t *)realloc(deadlines, count * sizeof(uint64_t));
+        if (nodes == NULL || deadlines == NULL)
+            die("Out of memory");
+        nodesCount = count;
+    }
+
+    unsigned int seed = 1;
+    for (long i = 0; i < count; ++i) {
+        TimerWheel::initNode(&nodes[i]);
+        deadlines[i] = 1 + rand_r(&seed) % MAX_TIMEOUT_TICKS;
+    }
+    wheel.init(0);
+}
+
+static void scheduleAll(long count)
+{
+    for (long i = 0; i < count; ++i)
+        wheel.schedule(&nodes[i], deadlines[i]);
+}
+
+static void countExpired(struct TimerWheelNode *node, void *arg)
+{
+    ++*(long *)arg;
+}
+
+static void BM_TimerWheelArm(struct BenchmarkState *state)
+{
+    for (long it = 0; it < state->iterations; ++it) {
+        state->pauseTiming();
+        prepareNodes(state->range);
+        state->resumeTiming();
+
+        scheduleAll(state->range);
+    }
+    state->itemsProcessed = state->iterations * state->range;
+}
+
+static void BM_TimerWheelRearm(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareNodes(state->range);
+    scheduleAll(state->range);
+    state->resumeTiming();
+
+    // every node is already scheduled: models heartbeat refresh
+    for (long it = 0; it < state->iterations; ++it) {
+        for (long i = 0; i < state->range; ++i)
+            wheel.schedule(&nodes[i], deadlines[(i + it) % state->range]);
+    }
+    state->itemsProcessed = state->iterations * state->range;
+}
+
+static void BM_TimerWheelCancel(struct BenchmarkState *state)
+{
+    for (long it = 0; it < state->iterations; ++it) {
+        state->pauseTiming();
+        prepareNodes(state->range);
+        scheduleAll(state->range);
+        state->resumeTiming();
+
+        for (long i = 0; i < state->range; ++i)
+            wheel.cancel(&nodes[i]);
+    }
+    state->itemsProcessed = state->iterations * state->range;
+}
+
+static void BM_TimerWheelExpire(struct BenchmarkState *state)
+{
+    long expired = 0;
+    for (long it = 0; it < state->iterations; ++it) {
+        state->pauseTiming();
+        prepareNodes(state->range);
+        scheduleAll(state->range);
+        state->resumeTiming();
+
+        // one wakeup per millisecond, as the timerfd would do under load
+        for (uint64_t tick = 0; tick <= MAX_TIMEOUT_TICKS; ++tick)
+            wheel.advance(tick, countExpired, &expired);
+    }
+    if (expired != state->iterations * state->range)
+        die("Not all timers expired");
+    state->itemsProcessed = expired;
+}
+
+static struct EventLoop loop;
+static struct Timer *timers = NULL;
+static long timersCount = 0;
+
+static void emptyTimerHandler(TimerHandlerArgument arg)
+{
+}
+
+static void prepareTimers(long count)
+{
+    if (timersCount == 0) {
+        if (loop.init() == -1)
+            die("Cannot init event loop");
+    }
+
+    if (count <= timersCount)
+        return;
+
+    timers = (struct Timer *)realloc(timers, count * sizeof(struct Timer));
+    if (timers == NULL)
+        die("Out of memory");
+
+    unsigned int seed = 1;
+    TimerHandlerArgument arg;
+    arg.ptrValue = NULL;
+    for (long i = timersCount; i < count; ++i) {
+        int timeout = 1000 + rand_r(&seed) % MAX_TIMEOUT_TICKS;
+        if (timers[i].init(&loop.timerSystem, timeout, false, emptyTimerHandler, arg) == -1)
+            die("Cannot init timer");
+    }
+    timersCount = count;
+}
+
+// Same through the Timer API, including timerfd re-arming
+static void BM_TimerStartStop(struct BenchmarkState *state)
+{
+    state->pauseTiming();
+    prepareTimers(state->range);
+    state->resumeTiming();
+
+    for (long it = 0; it < state->iterations; ++it) {
+        for (long i = 0; i < state->range; ++i)
+            timers[i].start();
+        for (long i = 0; i < state->range; ++i)
+            timers[i].stop();
+    }
+    state->itemsProcessed = state->iterations * state->range * 2;
+}
+
+BENCHMARK_RANGE(BM_TimerWheelArm, 1000)
+BENCHMARK_RANGE(BM_TimerWheelArm, 100000)
+BENCHMARK_RANGE(BM_TimerWheelRearm, 1000)
+BENCHMARK_RANGE(BM_TimerWheelRearm, 100000)
+BENCHMARK_RANGE(BM_TimerWheelCancel, 1000)
+BENCHMARK_RANGE(BM_TimerWheelCancel, 100000)
+BENCHMARK_RANGE(BM_TimerWheelExpire, 1000)
+BENCHMARK_RANGE(BM_TimerWheelExpire, 100000)
+BENCHMARK_RANGE(BM_TimerStartStop, 1000)
+BENCHMARK_RANGE(BM_TimerStartStop, 100000)
+
+int main(int argc, char *argv[])
+{
+    return runBenchmarks(argc, argv);
+}
@@ -0,0 +1,96 @@
+#include "benchmark.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+
+struct BenchmarkDescriptor
+{
+    const char *name;
+    BenchmarkFunction function;
+    long range;
+};
+
+static struct BenchmarkDescriptor benchmarks[MAX_BENCHMARKS_COUNT];
+static int benchmarksCount = 0;
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void BenchmarkState::pauseTiming()
+{
+    this->elapsedTime += nowNs() - this->startTime;
+}
+
+void BenchmarkState::resumeTiming()
+{
+    this->startTime = nowNs();
+}
+
+int registerBenchmark(const char *name, BenchmarkFunction function, long range)
+{
+    if (benchmarksCount == MAX_BENCHMARKS_COUNT) {
+        logPosition();
+        return -1;
+    }
+
+    struct BenchmarkDescriptor *benchmark = &benchmarks[benchmarksCount];
+    benchmark->name = name;
+    benchmark->function = function;
+    benchmark->range = range;
+    return benchmarksCount++;
+}
+
+static void runBenchmark(struct BenchmarkDescriptor *benchmark)
+{
+    struct BenchmarkState state;
+    state.range = benchmark->range;
+    state.iterations = 1;
+
+    while (true) {
+        state.itemsProcessed = 0;
+        state.elapsedTime = 0;
+        state.resumeTiming();
+        benchmark->function(&state);
+        state.pauseTiming();
+
+        if (state.elapsedTime >= BENCHMARK_MIN_TIME_NS || state.iterations >= (1L << 30))
+            break;
+
+        // aim slightly above the minimal time to avoid another round
+        uint64_t perIteration = state.elapsedTime / state.iterations + 1;
+        long next = (long)(BENCHMARK_MIN_TIME_NS * 12 / 10 / perIteration);
+        if (next <= state.iterations)
+            next = state.iterations * 2;
+        if (next > state.iterations * 100)
+            next = state.iterations * 100;
+        state.iterations = next;
+    }
+
+    double nsPerIteration = (double)state.elapsedTime / state.iterations;
+    double nsPerItem = state.itemsProcessed > 0
+            ? (double)state.elapsedTime / state.itemsProcessed
+            : nsPerIteration;
+
+    printf("%s\t%ld\t%.1f\t%.2f\n", benchmark->name, state.iterations, nsPerIteration, nsPerItem);
+    fflush(stdout);
+}
+
+int runBenchmarks(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    printf("benchmark\titerations\tns/iteration\tns/item\n");
+    for (int i = 0; i < benchmarksCount; ++i) {
+        if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL)
+            continue;
+        runBenchmark(&benchmarks[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal Google-Benchmark-style harness: a benchmark function runs
+// state->iterations times its measured body and reports the count of
+// processed items. The harness grows iterations until the run takes at
+// least BENCHMARK_MIN_TIME_NS.
+
+#define BENCHMARK_MIN_TIME_NS 200000000ULL
+#define MAX_BENCHMARKS_COUNT 128
+
+struct BenchmarkState
+{
+    long range;
+    long iterations;
+    long itemsProcessed;
+
+    uint64_t startTime;
+    uint64_t elapsedTime;
+
+    // Excludes setup and teardown from the measured time
+    void pauseTiming();
+    void resumeTiming();
+};
+
+typedef void (*BenchmarkFunction)(struct BenchmarkState *state);
+
+int registerBenchmark(const char *name, BenchmarkFunction function, long range);
+
+// Runs benchmarks whose name contains argv[1], all of them without
+// arguments. Prints one tab-separated line per benchmark:
+// name, iterations, ns per iteration, ns per item
+int runBenchmarks(int argc, char *argv[]);
+
+#define BENCHMARK_CONCAT_(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+
+#define BENCHMARK_RANGE(function, range) \
+    static int BENCHMARK_CONCAT(function##Registered, __LINE__) = \
+        registerBenchmark(#function "/" #range, function, range);
+
+#define BENCHMARK(function) BENCHMARK_RANGE(function, 0)
+
+#endif // BENCHMARK_H
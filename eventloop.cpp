@@ -0,0 +1,182 @@
+#include "eventloop.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "logging.h"
+
+int EventLoop::init()
+{
+    for (int i = 0; i < MAX_EVENT_SOURCES; ++i) {
+        struct EventSource *source = &this->sources[i];
+        source->fd = -1;
+        source->handler = NULL;
+        source->handlerArgument = NULL;
+    }
+
+    for (int i = 0; i < MAX_PREPARE_HANDLERS; ++i) {
+        this->prepareHooks[i].handler = NULL;
+        this->prepareHooks[i].handlerArgument = NULL;
+    }
+
+    this->breakLoop = false;
+
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epollFd == -1) {
+        perror("epoll_create1");
+        logPosition();
+        return -1;
+    }
+
+    if (this->timerSystem.init(this) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int EventLoop::deinit()
+{
+    if (this->timerSystem.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    if (this->epollFd != -1) {
+        if (close(this->epollFd) == -1) {
+            logPosition();
+            return -1;
+        }
+        this->epollFd = -1;
+    }
+    return 0;
+}
+
+int EventLoop::addFd(int fd, uint32_t events, EventHandler handler, void *arg)
+{
+    struct EventSource *source = NULL;
+    for (int i = 0; i < MAX_EVENT_SOURCES; ++i) {
+        if (this->sources[i].fd == -1) {
+            source = &this->sources[i];
+            break;
+        }
+    }
+
+    if (source == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    struct epoll_event event;
+    event.events = events | EPOLLET;
+    event.data.ptr = source;
+
+    if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl add");
+        logPosition();
+        return -1;
+    }
+
+    source->fd = fd;
+    source->handler = handler;
+    source->handlerArgument = arg;
+    return 0;
+}
+
+int EventLoop::removeFd(int fd)
+{
+    for (int i = 0; i < MAX_EVENT_SOURCES; ++i) {
+        struct EventSource *source = &this->sources[i];
+        if (source->fd != fd)
+            continue;
+
+        if (epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+            perror("epoll_ctl del");
+            logPosition();
+            return -1;
+        }
+
+        source->fd = -1;
+        source->handler = NULL;
+        source->handlerArgument = NULL;
+        return 0;
+    }
+
+    logPosition();
+    return -1;
+}
+
+int EventLoop::addPrepareHandler(PrepareHandler handler, void *arg)
+{
+    for (int i = 0; i < MAX_PREPARE_HANDLERS; ++i) {
+        struct PrepareHook *hook = &this->prepareHooks[i];
+        if (hook->handler != NULL)
+            continue;
+
+        hook->handler = handler;
+        hook->handlerArgument = arg;
+        return 0;
+    }
+
+    logPosition();
+    return -1;
+}
+
+int EventLoop::removePrepareHandler(PrepareHandler handler, void *arg)
+{
+    for (int i = 0; i < MAX_PREPARE_HANDLERS; ++i) {
+        struct PrepareHook *hook = &this->prepareHooks[i];
+        if (hook->handler != handler || hook->handlerArgument != arg)
+            continue;
+
+        hook->handler = NULL;
+        hook->handlerArgument = NULL;
+        return 0;
+    }
+
+    logPosition();
+    return -1;
+}
+
+int EventLoop::runOnce(int timeout)
+{
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+
+    for (int i = 0; i < MAX_PREPARE_HANDLERS; ++i) {
+        struct PrepareHook *hook = &this->prepareHooks[i];
+        if (hook->handler != NULL)
+            hook->handler(hook->handlerArgument);
+    }
+
+    int count = epoll_wait(this->epollFd, events, MAX_EVENTS_PER_WAIT, timeout);
+    if (count < 0) {
+        if (errno == EINTR)
+            return 0;
+        perror("epoll_wait");
+        logPosition();
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        struct EventSource *source = (struct EventSource *)events[i].data.ptr;
+        // a previous handler of this batch may have removed the source
+        if (source->fd == -1)
+            continue;
+        source->handler(events[i].events, source->handlerArgument);
+    }
+    return count;
+}
+
+int EventLoop::run()
+{
+    this->breakLoop = false;
+
+    while (!this->breakLoop) {
+        if (this->runOnce(-1) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdint.h>
+
+// epoll
+#include <sys/epoll.h>
+
+#include "timers.h"
+
+#define MAX_EVENT_SOURCES 16
+#define MAX_EVENTS_PER_WAIT 16
+#define MAX_PREPARE_HANDLERS 4
+
+typedef void (*EventHandler)(uint32_t events, void *arg);
+typedef void (*PrepareHandler)(void *arg);
+
+struct EventSource
+{
+    int fd;
+    EventHandler handler;
+    void *handlerArgument;
+};
+
+struct PrepareHook
+{
+    PrepareHandler handler;
+    void *handlerArgument;
+};
+
+// One loop per thread. Everything driven by the loop, including its
+// timers, is owned by it, so independent loops share no state.
+struct EventLoop
+{
+    int epollFd;
+    struct EventSource sources[MAX_EVENT_SOURCES];
+    struct PrepareHook prepareHooks[MAX_PREPARE_HANDLERS];
+
+    struct TimerSystem timerSystem;
+
+    bool breakLoop;
+
+    int init();
+    int deinit();
+
+    // Sources are registered edge-triggered (EPOLLET is added to events),
+    // so the handler must drain the fd until EAGAIN.
+    int addFd(int fd, uint32_t events, EventHandler handler, void *arg);
+    int removeFd(int fd);
+
+    // Prepare handlers run each time before the loop goes to sleep,
+    // e.g. to flush work batched by the event handlers.
+    int addPrepareHandler(PrepareHandler handler, void *arg);
+    int removePrepareHandler(PrepareHandler handler, void *arg);
+
+    // Waits for events once and dispatches them.
+    // Returns 0 when interrupted by a signal.
+    int runOnce(int timeout);
+    // Dispatches events until breakLoop is set
+    int run();
+};
+
+#endif // EVENTLOOP_H
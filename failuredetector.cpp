@@ -0,0 +1,92 @@
+#include "failuredetector.h"
+
+#include <math.h>
+
+// Logistic approximation of the normal distribution tail (Bowling et
+// al.), as in the Akka and Cassandra detectors:
+// P(X > mean + y * stddev) ~= 1 / (1 + exp(y * (PHI_A + PHI_B * y * y)))
+#define PHI_A 1.5976
+#define PHI_B 0.070566
+
+void PhiAccrualDetector::reset(uint64_t time, int expectedIntervalMs)
+{
+    this->intervalsCount = 0;
+    this->nextInterval = 0;
+    this->intervalsSum = 0;
+    this->intervalsSquaresSum = 0;
+    this->lastHeartbeatTime = time;
+    this->minStdDev = (double)expectedIntervalMs / PHI_MIN_STDDEV_DIVISOR;
+
+    // a deviation of a quarter of the interval until it is measured
+    double deviation = expectedIntervalMs / 4.0;
+    this->addInterval(expectedIntervalMs - deviation);
+    this->addInterval(expectedIntervalMs + deviation);
+}
+
+void PhiAccrualDetector::heartbeat(uint64_t time)
+{
+    if (time < this->lastHeartbeatTime)
+        return;
+    this->addInterval((double)(time - this->lastHeartbeatTime));
+    this->lastHeartbeatTime = time;
+}
+
+void PhiAccrualDetector::addInterval(double interval)
+{
+    if (this->intervalsCount == PHI_WINDOW_SIZE) {
+        double oldest = this->intervals[this->nextInterval];
+        this->intervalsSum -= oldest;
+        this->intervalsSquaresSum -= oldest * oldest;
+    }
+    else {
+        ++this->intervalsCount;
+    }
+    this->intervals[this->nextInterval] = interval;
+    this->intervalsSum += interval;
+    this->intervalsSquaresSum += interval * interval;
+    this->nextInterval = (this->nextInterval + 1) % PHI_WINDOW_SIZE;
+}
+
+double PhiAccrualDetector::getMean()
+{
+    return this->intervalsSum / this->intervalsCount;
+}
+
+double PhiAccrualDetector::getStdDev()
+{
+    double mean = this->getMean();
+    double variance = this->intervalsSquaresSum / this->intervalsCount - mean * mean;
+    double stdDev = variance > 0 ? sqrt(variance) : 0;
+    return stdDev > this->minStdDev ? stdDev : this->minStdDev;
+}
+
+double PhiAccrualDetector::getPhi(uint64_t time)
+{
+    double silence = time > this->lastHeartbeatTime ? (double)(time - this->lastHeartbeatTime) : 0;
+    double y = (silence - this->getMean()) / this->getStdDev();
+    double e = exp(-y * (PHI_A + PHI_B * y * y));
+    // the smaller of the two forms keeps the precision on its side
+    if (silence > this->getMean())
+        return -log10(e / (1 + e));
+    return -log10(1 - 1 / (1 + e));
+}
+
+// Solves y * (PHI_A + PHI_B * y * y) = -ln(e) for the e of the threshold
+// by Newton's method from y = -ln(e) / PHI_A, above the root, where the
+// convex left side makes it converge from above
+uint64_t PhiAccrualDetector::getSuspicionTime(double threshold)
+{
+    double p = pow(10, -threshold);
+    double target = -log(p / (1 - p));
+
+    double y = target / PHI_A;
+    for (int i = 0; i < 16 && y > 0; ++i) {
+        double f = y * (PHI_A + PHI_B * y * y) - target;
+        y -= f / (PHI_A + 3 * PHI_B * y * y);
+    }
+
+    double silence = this->getMean() + y * this->getStdDev();
+    if (silence < 1)
+        silence = 1;
+    return this->lastHeartbeatTime + (uint64_t)ceil(silence);
+}
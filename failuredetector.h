@@ -0,0 +1,44 @@
+#ifndef FAILUREDETECTOR_H
+#define FAILUREDETECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// heartbeat intervals the distribution is estimated from
+#define PHI_WINDOW_SIZE 64
+// the deviation is at least the expected interval divided by it, so that
+// a very regular sender is not suspected for a few ms of delay
+#define PHI_MIN_STDDEV_DIVISOR 8
+
+// Phi accrual failure detector (Hayashibara et al.): the suspicion of a
+// sender is phi = -log10(probability that its next heartbeat is still to
+// come), from a normal distribution of its latest heartbeat intervals.
+// It grows with the silence of the sender, faster the more regular its
+// heartbeats have been.
+struct PhiAccrualDetector
+{
+    double intervals[PHI_WINDOW_SIZE];
+    size_t intervalsCount;
+    size_t nextInterval;
+    double intervalsSum;
+    double intervalsSquaresSum;
+    uint64_t lastHeartbeatTime;
+    double minStdDev;
+
+    // Starts over from a heartbeat at time, assuming the sender beats
+    // every expectedIntervalMs until it has been measured
+    void reset(uint64_t time, int expectedIntervalMs);
+    void heartbeat(uint64_t time);
+
+    double getPhi(uint64_t time);
+    // Time of the last heartbeat plus the silence for phi to reach the
+    // threshold
+    uint64_t getSuspicionTime(double threshold);
+
+private:
+    void addInterval(double interval);
+    double getMean();
+    double getStdDev();
+};
+
+#endif // FAILUREDETECTOR_H
@@ -3,8 +3,23 @@
 #include <time.h>
 #include <stdlib.h>
 
+static bool logInfoEnabled = true;
+
+void setLogInfoEnabled(bool enabled)
+{
+    logInfoEnabled = enabled;
+}
+
+bool isLogInfoEnabled()
+{
+    return logInfoEnabled;
+}
+
 void logInfo(const char *message)
 {
+    if (!logInfoEnabled)
+        return;
+
     time_t now = time(0);
     tm *ltm = localtime(&now);
     printf("\033[1;31m%.2d:%.2d:%.2d\033[0m %s\n",
@@ -6,6 +6,11 @@
 
 #define logPosition(...) fprintf(stderr, "error at file \'%s\':%d, function: %s\n", __FILE__, __LINE__, __func__)
 
+// Info messages are printed unless disabled, e.g. when a process
+// runs many nodes
+void setLogInfoEnabled(bool enabled);
+bool isLogInfoEnabled();
+
 void logInfo(const char *message);
 
 void logError(const char *message);
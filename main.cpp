@@ -1,25 +1,137 @@
 #include <stdio.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/signalfd.h>
 
 #include "nodes.h"
 #include "logging.h"
 
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-u] [-t recv threads] [-a cpu,cpu,...] [-1] [-g aggregation degree] [-h heartbeat ms] [-p phi threshold]\n", program);
+}
+
+// Parses a comma separated list of CPUs to pin receive threads to
+static int parseCpus(char *list, struct NetworkingConfig *config)
+{
+    int count = 0;
+    for (char *token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+        if (count == MAX_RECV_THREADS)
+            return -1;
+        config->recvThreadsCpus[count++] = atoi(token);
+    }
+    return 0;
+}
+
+struct Shutdown
+{
+    int signalFd;
+    struct SelfNode *node;
+    struct EventLoop *loop;
+};
+
+// SIGTERM hands the mastership over before the node stops, so that a
+// restart does not leave the slaves without a master
+static void terminateSignalHandler(uint32_t events, void *arg)
+{
+    struct Shutdown *shutdown = (struct Shutdown *)arg;
+
+    struct signalfd_siginfo info;
+    if (read(shutdown->signalFd, &info, sizeof(info)) != sizeof(info))
+        return;
+
+    logInfo("Terminated");
+    if (shutdown->node->handOver() == -1 || shutdown->node->stop() == -1)
+        logPosition();
+    shutdown->loop->breakLoop = true;
+}
+
 int main(int argc, char * argv[])
 {
     srand(time(NULL));
 
-    struct NetworkingConfig config;
-    config.udpPort = 10500;
+    struct SelfNodeConfig config;
+    config.setDefaults();
+
+    int option;
+    while ((option = getopt(argc, argv, "ut:a:1g:h:p:")) != -1) {
+        switch (option) {
+        case 'u':
+            config.net.backend = NETWORKING_BACKEND_IO_URING;
+            break;
+        case 't':
+            config.net.recvThreadsCount = atoi(optarg);
+            break;
+        case 'a':
+            if (parseCpus(optarg, &config.net) == -1) {
+                printUsage(argv[0]);
+                return -1;
+            }
+            break;
+        case '1':
+            // broadcast in the fixed-width format of older nodes
+            config.wireVersion = WireV1;
+            break;
+        case 'g':
+            // poll the slaves through a tree of this fan-in
+            config.aggregationDegree = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            config.heartbeatIntervalMs = atoi(optarg);
+            break;
+        case 'p':
+            // suspect the master later, for loaded networks
+            config.phiThreshold = atof(optarg);
+            break;
+        default:
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    // blocked before the receive threads start, so they inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1) {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    struct EventLoop loop;
+    if (loop.init() == -1) {
+        logPosition();
+        return -1;
+    }
 
     SelfNode node;
-    if (node.init(&config) == -1) {
+    if (node.init(&config, &loop) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    struct Shutdown shutdown;
+    shutdown.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    shutdown.node = &node;
+    shutdown.loop = &loop;
+    if (shutdown.signalFd == -1) {
+        perror("signalfd");
+        return -1;
+    }
+    if (loop.addFd(shutdown.signalFd, EPOLLIN, terminateSignalHandler, &shutdown) == -1) {
         logPosition();
         return -1;
     }
 
     node.run();
 
+    // io_uring sends, the Abdication among them, are submitted before
+    // the loop sleeps
+    loop.runOnce(0);
+
     return 0;
 }
@@ -0,0 +1,206 @@
+#include "membership.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+int MembershipTable::init(size_t initialCapacity)
+{
+    this->members = NULL;
+    this->samples = NULL;
+    this->slots = NULL;
+    this->count = 0;
+    this->capacity = 0;
+    this->slotsMask = 0;
+
+    if (this->allocate(initialCapacity > 0 ? initialCapacity : 1) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+void MembershipTable::deinit()
+{
+    free(this->slots);
+    free(this->samples);
+    free(this->members);
+    this->slots = NULL;
+    this->samples = NULL;
+    this->members = NULL;
+    this->count = 0;
+    this->capacity = 0;
+}
+
+long MembershipTable::find(struct NodeIdentity *id)
+{
+    size_t slot = this->findSlot(id, hashIdentity(id));
+    return (long)this->slots[slot].position - 1;
+}
+
+long MembershipTable::findOrAdd(struct NodeIdentity *id)
+{
+    uint32_t hash = hashIdentity(id);
+    size_t slot = this->findSlot(id, hash);
+    if (this->slots[slot].position != 0)
+        return this->slots[slot].position - 1;
+
+    if (this->count == this->capacity) {
+        if (this->grow() == -1) {
+            logPosition();
+            return -1;
+        }
+        slot = this->findSlot(id, hash);
+    }
+
+    size_t position = this->count++;
+    memset(&this->members[position], 0, sizeof(struct Member));
+    memset(&this->samples[position], 0, sizeof(struct MemberSample));
+    this->members[position].id = *id;
+
+    this->slots[slot].position = position + 1;
+    this->slots[slot].hash = hash;
+    return position;
+}
+
+int MembershipTable::remove(struct NodeIdentity *id)
+{
+    size_t slot = this->findSlot(id, hashIdentity(id));
+    if (this->slots[slot].position == 0)
+        return -1;
+
+    this->removeAt(slot);
+    return 0;
+}
+
+size_t MembershipTable::removeNotSeenSince(uint64_t time)
+{
+    size_t removedCount = 0;
+    size_t i = 0;
+    while (i < this->count) {
+        if (this->members[i].lastSeenTime < time) {
+            // the last member moves to i
+            this->remove(&this->members[i].id);
+            ++removedCount;
+        }
+        else {
+            ++i;
+        }
+    }
+    return removedCount;
+}
+
+void MembershipTable::clear()
+{
+    memset(this->slots, 0, (this->slotsMask + 1) * sizeof(struct MembershipSlot));
+    this->count = 0;
+}
+
+// MAC address and process id mixed by the 64-bit MurmurHash3 finalizer
+uint32_t MembershipTable::hashIdentity(struct NodeIdentity *id)
+{
+    uint64_t key = 0;
+    memcpy(&key, id->macAddress, sizeof(id->macAddress));
+    key ^= (uint64_t)(uint32_t)id->processId << 32;
+
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+size_t MembershipTable::findSlot(struct NodeIdentity *id, uint32_t hash)
+{
+    size_t slot = hash & this->slotsMask;
+    while (this->slots[slot].position != 0) {
+        if (this->slots[slot].hash == hash) {
+            struct NodeIdentity *memberId = &this->members[this->slots[slot].position - 1].id;
+            if (memberId->processId == id->processId
+                    && memcmp(memberId->macAddress, id->macAddress, sizeof(id->macAddress)) == 0)
+                return slot;
+        }
+        slot = (slot + 1) & this->slotsMask;
+    }
+    return slot;
+}
+
+// Reallocates the members for capacity and rebuilds the index
+int MembershipTable::allocate(size_t capacity)
+{
+    size_t slotsCount = 1;
+    while (slotsCount < 2 * capacity)
+        slotsCount <<= 1;
+
+    struct Member *members = (struct Member *)realloc(this->members, capacity * sizeof(struct Member));
+    if (members == NULL) {
+        logPosition();
+        return -1;
+    }
+    this->members = members;
+
+    struct MemberSample *samples = (struct MemberSample *)realloc(this->samples, capacity * sizeof(struct MemberSample));
+    if (samples == NULL) {
+        logPosition();
+        return -1;
+    }
+    this->samples = samples;
+
+    struct MembershipSlot *slots = (struct MembershipSlot *)calloc(slotsCount, sizeof(struct MembershipSlot));
+    if (slots == NULL) {
+        logPosition();
+        return -1;
+    }
+    free(this->slots);
+    this->slots = slots;
+    this->slotsMask = slotsCount - 1;
+    this->capacity = capacity;
+
+    for (size_t position = 0; position < this->count; ++position) {
+        uint32_t hash = hashIdentity(&this->members[position].id);
+        size_t slot = hash & this->slotsMask;
+        while (this->slots[slot].position != 0)
+            slot = (slot + 1) & this->slotsMask;
+        this->slots[slot].position = position + 1;
+        this->slots[slot].hash = hash;
+    }
+    return 0;
+}
+
+int MembershipTable::grow()
+{
+    return this->allocate(2 * this->capacity);
+}
+
+// Backward shift deletion: the entries after the hole which could have
+// been placed in it move back, so no probe sequence is broken and no
+// tombstones are needed
+void MembershipTable::removeAt(size_t slot)
+{
+    size_t position = this->slots[slot].position - 1;
+
+    size_t hole = slot;
+    size_t next = (hole + 1) & this->slotsMask;
+    while (this->slots[next].position != 0) {
+        size_t home = this->slots[next].hash & this->slotsMask;
+        // the entry may move unless its home lies cyclically in (hole, next]
+        if (((next - home) & this->slotsMask) >= ((next - hole) & this->slotsMask)) {
+            this->slots[hole] = this->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & this->slotsMask;
+    }
+    this->slots[hole].position = 0;
+
+    // the last member fills the hole in the dense arrays
+    size_t last = this->count - 1;
+    if (position != last) {
+        size_t lastSlot = this->findSlot(&this->members[last].id, hashIdentity(&this->members[last].id));
+        this->members[position] = this->members[last];
+        this->samples[position] = this->samples[last];
+        this->slots[lastSlot].position = position + 1;
+    }
+    --this->count;
+}
@@ -0,0 +1,85 @@
+#ifndef MEMBERSHIP_H
+#define MEMBERSHIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include "identity.h"
+
+#define MEMBERSHIP_INITIAL_CAPACITY 64
+
+// What the master knows about a slave
+struct Member
+{
+    struct NodeIdentity id;
+    struct sockaddr_in address;
+    uint64_t lastSeenTime;
+    // index + 1 in the master's AggregationTree, 0 while not in it
+    uint32_t treeIndex;
+    // enum WireVersion of the member's last reply, 0 until one arrives
+    uint8_t wireVersion;
+};
+
+// Latest sensor sample of a member, kept apart from Member so that an
+// aggregation walks 12-byte records only
+struct MemberSample
+{
+    // round of the sample, 0 when there is none
+    uint32_t round;
+    int32_t luminosity;
+    int32_t temperature;
+};
+
+struct MembershipSlot
+{
+    // of the member + 1, 0 for an empty slot
+    uint32_t position;
+    // of the member identity, compared before the identity itself
+    uint32_t hash;
+};
+
+// Members are stored densely in insertion order: members[i] and
+// samples[i] describe the same node, for i < count. An open-addressing
+// index with linear probing maps identities to positions. Removal moves
+// the last member into the hole, so positions are not stable across
+// remove() and removeNotSeenSince().
+struct MembershipTable
+{
+    struct Member *members;
+    struct MemberSample *samples;
+    size_t count;
+    size_t capacity;
+
+    // the count of slots is a power of two at least twice the capacity
+    struct MembershipSlot *slots;
+    size_t slotsMask;
+
+    int init(size_t initialCapacity);
+    void deinit();
+
+    // Position of the member or -1
+    long find(struct NodeIdentity *id);
+    // Position of the member, added with zeroed fields if new, or -1
+    // when out of memory. O(1) on average.
+    long findOrAdd(struct NodeIdentity *id);
+    // Returns -1 if there is no such member
+    int remove(struct NodeIdentity *id);
+    // Removes the members last seen before time, returns their count
+    size_t removeNotSeenSince(uint64_t time);
+    // Removes all members, keeping the memory
+    void clear();
+
+    // Well mixed in all bits, also used to spread the slaves' replies
+    static uint32_t hashIdentity(struct NodeIdentity *id);
+
+private:
+    // Slot of the member or the empty slot where it would be added
+    size_t findSlot(struct NodeIdentity *id, uint32_t hash);
+    int allocate(size_t capacity);
+    int grow();
+    void removeAt(size_t slot);
+};
+
+#endif // MEMBERSHIP_H
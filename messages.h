@@ -0,0 +1,874 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "identity.h"
+
+enum MessageType
+{
+    WhoIsMaster,
+    IAmMaster,
+    PleaseWait,
+
+    ControlRequest,
+    ControlResponse,
+    ControlSet,
+
+    // aggregation tree, see AggregationTree
+    AggregationAssign,
+    ControlSummary,
+
+    // state of the master streamed to its deputy, its handover, and the
+    // members a master which yields to another passes on to it
+    DeputySync,
+    Abdication,
+    MembershipMerge,
+
+    // count of the types above, which are numbered from 0
+    MESSAGE_TYPES_COUNT
+};
+
+// Wire formats, detected on receive by the first byte of each message
+enum WireVersion
+{
+    // fixed-width fields
+    WireV1 = 1,
+    // varint fields and a one-byte header
+    WireV2
+};
+
+// Every v1 message starts with its type and the identity of the sender
+#define MESSAGE_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint32_t) + 6)
+
+// A v2 message starts with a byte of MESSAGE_V2_FLAG and the type, then
+// the process id of the sender as a varint and its MAC address. Nothing
+// sends MESSAGE_V2_SHORT_IDENTITY_FLAG, without the MAC address, any
+// more; it is still accepted on receive.
+// The first byte of a v1 message is the high byte of its type, always 0.
+#define MESSAGE_V2_FLAG 0x80
+#define MESSAGE_V2_SHORT_IDENTITY_FLAG 0x40
+#define MESSAGE_V2_TYPE_MASK 0x3f
+
+#define VARINT32_MAX_SIZE 5
+#define VARINT64_MAX_SIZE 10
+
+// Network order loads and stores at any alignment: datagrams are read
+// in place, where fields do not have to be 4-byte aligned
+static inline void storeInt32(unsigned char *destination, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(destination, &value, sizeof(uint32_t));
+}
+
+static inline uint32_t loadInt32(const unsigned char *source)
+{
+    uint32_t value;
+    memcpy(&value, source, sizeof(uint32_t));
+    return ntohl(value);
+}
+
+static inline void storeInt64(unsigned char *destination, uint64_t value)
+{
+    storeInt32(destination, (uint32_t)(value >> 32));
+    storeInt32(destination + sizeof(uint32_t), (uint32_t)value);
+}
+
+static inline uint64_t loadInt64(const unsigned char *source)
+{
+    return (uint64_t)loadInt32(source) << 32 | loadInt32(source + sizeof(uint32_t));
+}
+
+// Little-endian base 128, 7 bits per byte with the high bit set on all
+// bytes but the last. Returns the size written.
+static inline size_t storeVarUInt32(unsigned char *destination, uint32_t value)
+{
+    size_t size = 0;
+    while (value >= 0x80) {
+        destination[size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    destination[size++] = (unsigned char)value;
+    return size;
+}
+
+static inline size_t storeVarUInt64(unsigned char *destination, uint64_t value)
+{
+    size_t size = 0;
+    while (value >= 0x80) {
+        destination[size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    destination[size++] = (unsigned char)value;
+    return size;
+}
+
+// Small negative values get short varints too
+static inline uint32_t zigzagInt32(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzagInt32(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline uint64_t zigzagInt64(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzagInt64(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// A fixed-size part is checked once by reserve() or take(), then its
+// fields are stored or loaded unchecked at offsets of the returned pointer.
+
+struct WriteByteStream
+{
+    unsigned char *buffer;
+    size_t bufferSize;
+
+    void openStream(unsigned char *buffer, size_t bufferSize)
+    {
+        this->buffer = buffer;
+        this->bufferSize = bufferSize;
+    }
+
+    // Returns NULL if size bytes do not fit
+    unsigned char *reserve(size_t size)
+    {
+        if (this->bufferSize < size)
+            return NULL;
+        unsigned char *fields = this->buffer;
+        this->buffer += size;
+        this->bufferSize -= size;
+        return fields;
+    }
+
+    int writeInt32(uint32_t value)
+    {
+        unsigned char *field = this->reserve(sizeof(uint32_t));
+        if (field == NULL)
+            return -1;
+        storeInt32(field, value);
+        return 0;
+    }
+
+    int writeBytes(const unsigned char *bytes, size_t bytesCount)
+    {
+        unsigned char *field = this->reserve(bytesCount);
+        if (field == NULL)
+            return -1;
+        memcpy(field, bytes, bytesCount);
+        return 0;
+    }
+};
+
+struct ReadByteStream
+{
+    unsigned char *buffer;
+    size_t bufferSize;
+
+    void openStream(unsigned char *buffer, size_t bufferSize)
+    {
+        this->buffer = buffer;
+        this->bufferSize = bufferSize;
+    }
+
+    // Returns NULL if fewer than size bytes are left
+    const unsigned char *take(size_t size)
+    {
+        if (this->bufferSize < size)
+            return NULL;
+        const unsigned char *fields = this->buffer;
+        this->buffer += size;
+        this->bufferSize -= size;
+        return fields;
+    }
+
+    int readInt32(uint32_t *value)
+    {
+        const unsigned char *field = this->take(sizeof(uint32_t));
+        if (field == NULL)
+            return -1;
+        *value = loadInt32(field);
+        return 0;
+    }
+
+    int readBytes(unsigned char *bytes, size_t bytesCount)
+    {
+        const unsigned char *field = this->take(bytesCount);
+        if (field == NULL)
+            return -1;
+        memcpy(bytes, field, bytesCount);
+        return 0;
+    }
+
+    // Returns -1 if the varint is cut or longer than VARINT32_MAX_SIZE
+    int readVarUInt32(uint32_t *value)
+    {
+        if (this->bufferSize == 0)
+            return -1;
+
+        const unsigned char *field = this->buffer;
+        uint32_t result = field[0] & 0x7f;
+        size_t size = 1;
+
+        // unrolled when the longest varint fits, the common case
+        if (this->bufferSize >= VARINT32_MAX_SIZE) {
+            if (field[0] & 0x80) {
+                result |= (uint32_t)(field[1] & 0x7f) << 7;
+                ++size;
+                if (field[1] & 0x80) {
+                    result |= (uint32_t)(field[2] & 0x7f) << 14;
+                    ++size;
+                    if (field[2] & 0x80) {
+                        result |= (uint32_t)(field[3] & 0x7f) << 21;
+                        ++size;
+                        if (field[3] & 0x80) {
+                            if (field[4] & 0x80)
+                                return -1;
+                            result |= (uint32_t)field[4] << 28;
+                            ++size;
+                        }
+                    }
+                }
+            }
+        }
+        else {
+            while (field[size - 1] & 0x80) {
+                if (size == this->bufferSize)
+                    return -1;
+                result |= (uint32_t)(field[size] & 0x7f) << (7 * size);
+                ++size;
+            }
+        }
+
+        this->buffer += size;
+        this->bufferSize -= size;
+        *value = result;
+        return 0;
+    }
+
+    // Returns -1 if the varint is cut or longer than VARINT64_MAX_SIZE.
+    // Not unrolled, 64-bit fields are rare.
+    int readVarUInt64(uint64_t *value)
+    {
+        uint64_t result = 0;
+        for (size_t size = 0; size < this->bufferSize && size < VARINT64_MAX_SIZE; ++size) {
+            result |= (uint64_t)(this->buffer[size] & 0x7f) << (7 * size);
+            if ((this->buffer[size] & 0x80) == 0) {
+                this->buffer += size + 1;
+                this->bufferSize -= size + 1;
+                *value = result;
+                return 0;
+            }
+        }
+        return -1;
+    }
+};
+
+static inline void storeMessageHeader(unsigned char *header, enum MessageType type, struct NodeIdentity *nodeId)
+{
+    storeInt32(header, type);
+    storeInt32(header + sizeof(uint32_t), nodeId->processId);
+    memcpy(header + 2 * sizeof(uint32_t), nodeId->macAddress, 6);
+}
+
+static inline int serializeMessage(struct WriteByteStream *s, enum MessageType type, struct NodeIdentity *nodeId)
+{
+    unsigned char *header = s->reserve(MESSAGE_HEADER_SIZE);
+    if (header == NULL)
+        return -1;
+
+    storeMessageHeader(header, type, nodeId);
+    return 0;
+}
+
+// Reads a header of either version. The MAC address of a short
+// identity is zero.
+static inline int deserializeMessage(struct ReadByteStream *s, enum MessageType *type, struct NodeIdentity *nodeId,
+                                     enum WireVersion *version)
+{
+    const unsigned char *header = s->take(1);
+    if (header == NULL)
+        return -1;
+
+    if ((header[0] & MESSAGE_V2_FLAG) == 0) {
+        // the rest of the v1 header follows the first byte
+        if (s->take(MESSAGE_HEADER_SIZE - 1) == NULL)
+            return -1;
+
+        *version = WireV1;
+        *type = (enum MessageType)loadInt32(header);
+        nodeId->processId = loadInt32(header + sizeof(uint32_t));
+        memcpy(nodeId->macAddress, header + 2 * sizeof(uint32_t), 6);
+        return 0;
+    }
+
+    *version = WireV2;
+    *type = (enum MessageType)(header[0] & MESSAGE_V2_TYPE_MASK);
+
+    uint32_t processId;
+    if (s->readVarUInt32(&processId) == -1)
+        return -1;
+    nodeId->processId = processId;
+
+    if (header[0] & MESSAGE_V2_SHORT_IDENTITY_FLAG) {
+        memset(nodeId->macAddress, 0, 6);
+        return 0;
+    }
+    return s->readBytes(nodeId->macAddress, 6);
+}
+
+// Message schemas
+//
+// The body of each message type is a plain struct, and its schema lists
+// the fields of the struct in wire order. The schema generates the
+// encoder and the decoder of the message at compile time: all fixed-size
+// fields are checked by a single reserve() or take() and stored or
+// loaded at constant offsets. Optional fields follow them in the tail,
+// in both versions as they are; a variable-size field takes the rest of
+// the datagram, so it is the last one. In v2, integer fields are zigzag
+// varints and are read one by one.
+//
+// A new message type needs its MessageType, a body struct if none fits,
+// and a MessageSchemaOf specialization below. Receivers dispatch on the
+// type through a table built from MessageTypeList (see SelfNode).
+
+struct EmptyBody
+{
+};
+
+// IAmMaster: the interval of the master's heartbeats, 0 from masters
+// which predate it, whether the message is one of them rather than a
+// reply to an election message, whether a deputy is to take over from
+// the master, and for how long it has been the master, 0 if unknown
+struct MasterHeartbeatBody
+{
+    int32_t heartbeatIntervalMs;
+    int32_t isHeartbeat;
+    int32_t hasDeputy;
+    int32_t masterForMs;
+};
+
+// ControlRequest: slaves spread their replies over the window, 0 to
+// reply at once. Slaves assigned to the tree of the epoch reply through
+// it, 0 when the master has no tree.
+struct ControlRequestBody
+{
+    int32_t responseWindowMs;
+    int32_t treeEpoch;
+};
+
+// ControlResponse
+struct SensorsInfoBody
+{
+    int32_t luminosity;
+    int32_t temperature;
+};
+
+// ControlSummary: the samples of a subtree of the aggregation tree
+struct SensorsSummaryBody
+{
+    int32_t count;
+    int64_t luminositySum;
+    // sum of squared differences from the mean, rounded
+    int64_t luminosityM2;
+    int32_t luminosityMin;
+    int32_t luminosityMax;
+    int64_t temperatureSum;
+    int64_t temperatureM2;
+    int32_t temperatureMin;
+    int32_t temperatureMax;
+};
+
+// AggregationAssign: the place of a slave in the aggregation tree. The
+// children are AGGREGATION_CHILD_SIZE bytes each, the IPv4 address and
+// the port in network order, and point into the datagram received.
+struct AggregationAssignBody
+{
+    int32_t treeEpoch;
+    // replies to its aggregator rather than to the master
+    int32_t underAggregator;
+    // wait for the replies of the children
+    int32_t collectMs;
+    // samples the subtree below the slave replies with
+    int32_t descendantsCount;
+    const unsigned char *children;
+    size_t childrenSize;
+};
+
+#define AGGREGATION_CHILD_SIZE 6
+
+// DeputySync: a part of the master's membership, from the member
+// firstMember of membersCount, and the round the master is at. With
+// firstMember -1 the part carries the changes since the last one, the
+// first leftCount members are gone and the others have joined or moved.
+// The parts to a deputy are numbered by sequence, so that it can tell
+// whether it has missed one. The members are DEPUTY_MEMBER_SIZE bytes
+// each, the MAC address, the process id, the IPv4 address and the port
+// in network order, and point into the datagram received. A master
+// which has picked another deputy sends isDeputy 0 with no members to
+// the former one.
+struct DeputySyncBody
+{
+    int32_t isDeputy;
+    int32_t controlRound;
+    int32_t firstMember;
+    int32_t membersCount;
+    int32_t sequence;
+    int32_t leftCount;
+    const unsigned char *members;
+    size_t membersSize;
+};
+
+#define DEPUTY_MEMBER_SIZE 16
+
+// Abdication: the master is leaving and names its successor, which takes
+// over from the round the master is at. The successor is a
+// DEPUTY_MEMBER_SIZE record, as the members of DeputySync.
+struct AbdicationBody
+{
+    int32_t controlRound;
+    const unsigned char *successor;
+    size_t successorSize;
+};
+
+// MembershipMerge: slaves of a master which has heard a higher one and
+// yielded to it, DEPUTY_MEMBER_SIZE records as the members of DeputySync
+struct MembershipMergeBody
+{
+    const unsigned char *members;
+    size_t membersSize;
+};
+
+// ControlSet: the text is not copied, it points into the datagram
+// received or to the text sent
+struct DisplayInfoBody
+{
+    int32_t brightness;
+    const char *text;
+    size_t textLength;
+};
+
+template <typename Body, int32_t Body::*member>
+struct Int32Field
+{
+    static const size_t fixedSize = sizeof(uint32_t);
+
+    static void store(unsigned char *field, const Body *body)
+    {
+        storeInt32(field, (uint32_t)(body->*member));
+    }
+
+    static void load(const unsigned char *field, Body *body)
+    {
+        body->*member = (int32_t)loadInt32(field);
+    }
+
+    static const size_t maxSizeV2 = VARINT32_MAX_SIZE;
+
+    static unsigned char *storeV2(unsigned char *field, const Body *body)
+    {
+        return field + storeVarUInt32(field, zigzagInt32(body->*member));
+    }
+
+    static int loadV2(struct ReadByteStream *s, Body *body)
+    {
+        uint32_t value;
+        if (s->readVarUInt32(&value) == -1)
+            return -1;
+        body->*member = unzigzagInt32(value);
+        return 0;
+    }
+
+    static size_t tailSize(const Body *) { return 0; }
+    static void storeTail(unsigned char *, const Body *) {}
+    static size_t loadTail(const unsigned char *, size_t, Body *) { return 0; }
+};
+
+// Variable-size bytes up to the end of the message, the last field only
+template <typename Body, typename Byte, const Byte *Body::*bytes, size_t Body::*bytesCount>
+struct TailBytesField
+{
+    static const size_t fixedSize = 0;
+
+    static void store(unsigned char *, const Body *) {}
+    static void load(const unsigned char *, Body *) {}
+
+    static const size_t maxSizeV2 = 0;
+    static unsigned char *storeV2(unsigned char *field, const Body *) { return field; }
+    static int loadV2(struct ReadByteStream *, Body *) { return 0; }
+
+    static size_t tailSize(const Body *body)
+    {
+        return body->*bytesCount;
+    }
+
+    static void storeTail(unsigned char *tail, const Body *body)
+    {
+        memcpy(tail, body->*bytes, body->*bytesCount);
+    }
+
+    static size_t loadTail(const unsigned char *tail, size_t tailSize, Body *body)
+    {
+        body->*bytes = (const Byte *)tail;
+        body->*bytesCount = tailSize;
+        return tailSize;
+    }
+};
+
+template <typename Body, const char *Body::*text, size_t Body::*textLength>
+using TailTextField = TailBytesField<Body, char, text, textLength>;
+
+template <typename Body, int64_t Body::*member>
+struct Int64Field
+{
+    static const size_t fixedSize = sizeof(uint64_t);
+
+    static void store(unsigned char *field, const Body *body)
+    {
+        storeInt64(field, (uint64_t)(body->*member));
+    }
+
+    static void load(const unsigned char *field, Body *body)
+    {
+        body->*member = (int64_t)loadInt64(field);
+    }
+
+    static const size_t maxSizeV2 = VARINT64_MAX_SIZE;
+
+    static unsigned char *storeV2(unsigned char *field, const Body *body)
+    {
+        return field + storeVarUInt64(field, zigzagInt64(body->*member));
+    }
+
+    static int loadV2(struct ReadByteStream *s, Body *body)
+    {
+        uint64_t value;
+        if (s->readVarUInt64(&value) == -1)
+            return -1;
+        body->*member = unzigzagInt64(value);
+        return 0;
+    }
+
+    static size_t tailSize(const Body *) { return 0; }
+    static void storeTail(unsigned char *, const Body *) {}
+    static size_t loadTail(const unsigned char *, size_t, Body *) { return 0; }
+};
+
+// Optional int32 in the tail, 4 bytes in both versions. Older nodes
+// skip it as they skip any tail, and it is 0 in their messages.
+template <typename Body, int32_t Body::*member>
+struct TailInt32Field
+{
+    static const size_t fixedSize = 0;
+
+    static void store(unsigned char *, const Body *) {}
+    static void load(const unsigned char *, Body *) {}
+
+    static const size_t maxSizeV2 = 0;
+    static unsigned char *storeV2(unsigned char *field, const Body *) { return field; }
+    static int loadV2(struct ReadByteStream *, Body *) { return 0; }
+
+    static size_t tailSize(const Body *) { return sizeof(uint32_t); }
+
+    static void storeTail(unsigned char *tail, const Body *body)
+    {
+        storeInt32(tail, (uint32_t)(body->*member));
+    }
+
+    static size_t loadTail(const unsigned char *tail, size_t tailSize, Body *body)
+    {
+        if (tailSize < sizeof(uint32_t)) {
+            body->*member = 0;
+            return 0;
+        }
+        body->*member = (int32_t)loadInt32(tail);
+        return sizeof(uint32_t);
+    }
+};
+
+template <typename Body, typename... Fields>
+struct MessageFields;
+
+template <typename Body>
+struct MessageFields<Body>
+{
+    static const size_t fixedSize = 0;
+
+    static void store(unsigned char *, const Body *) {}
+    static void load(const unsigned char *, Body *) {}
+    static const size_t maxSizeV2 = 0;
+    static unsigned char *storeV2(unsigned char *fields, const Body *) { return fields; }
+    static int loadV2(struct ReadByteStream *, Body *) { return 0; }
+    static size_t tailSize(const Body *) { return 0; }
+    static void storeTail(unsigned char *, const Body *) {}
+    static size_t loadTail(const unsigned char *, size_t, Body *) { return 0; }
+};
+
+// Fixed-size fields are laid out one after another, the tails follow
+// all of them in the same order.
+template <typename Body, typename Field, typename... Fields>
+struct MessageFields<Body, Field, Fields...>
+{
+    typedef MessageFields<Body, Fields...> Next;
+
+    static const size_t fixedSize = Field::fixedSize + Next::fixedSize;
+
+    static void store(unsigned char *fields, const Body *body)
+    {
+        Field::store(fields, body);
+        Next::store(fields + Field::fixedSize, body);
+    }
+
+    static void load(const unsigned char *fields, Body *body)
+    {
+        Field::load(fields, body);
+        Next::load(fields + Field::fixedSize, body);
+    }
+
+    static const size_t maxSizeV2 = Field::maxSizeV2 + Next::maxSizeV2;
+
+    static unsigned char *storeV2(unsigned char *fields, const Body *body)
+    {
+        return Next::storeV2(Field::storeV2(fields, body), body);
+    }
+
+    static int loadV2(struct ReadByteStream *s, Body *body)
+    {
+        if (Field::loadV2(s, body) == -1)
+            return -1;
+        return Next::loadV2(s, body);
+    }
+
+    static size_t tailSize(const Body *body)
+    {
+        return Field::tailSize(body) + Next::tailSize(body);
+    }
+
+    static void storeTail(unsigned char *tail, const Body *body)
+    {
+        Field::storeTail(tail, body);
+        Next::storeTail(tail + Field::tailSize(body), body);
+    }
+
+    // Returns the size of the tails loaded
+    static size_t loadTail(const unsigned char *tail, size_t tailSize, Body *body)
+    {
+        size_t size = Field::loadTail(tail, tailSize, body);
+        return size + Next::loadTail(tail + size, tailSize - size, body);
+    }
+};
+
+template <enum MessageType messageType, typename BodyType, typename... Fields>
+struct MessageSchema
+{
+    typedef BodyType Body;
+    typedef MessageFields<Body, Fields...> BodyFields;
+
+    static const enum MessageType type = messageType;
+    // size of the v1 message without its variable-size tail
+    static const size_t wireSize = MESSAGE_HEADER_SIZE + BodyFields::fixedSize;
+    // bound of the v2 message without its tail
+    static const size_t maxWireSizeV2 = 1 + VARINT32_MAX_SIZE + 6 + BodyFields::maxSizeV2;
+
+    static int encode(struct WriteByteStream *s, enum WireVersion version, struct NodeIdentity *nodeId, const Body *body)
+    {
+        if (version == WireV2)
+            return encodeV2(s, nodeId, body);
+
+        unsigned char *message = s->reserve(wireSize + BodyFields::tailSize(body));
+        if (message == NULL)
+            return -1;
+
+        storeMessageHeader(message, messageType, nodeId);
+        BodyFields::store(message + MESSAGE_HEADER_SIZE, body);
+        BodyFields::storeTail(message + wireSize, body);
+        return 0;
+    }
+
+    // Decodes the body of a message which header has been deserialized
+    static int decodeBody(struct ReadByteStream *s, enum WireVersion version, Body *body)
+    {
+        if (version == WireV2) {
+            if (BodyFields::loadV2(s, body) == -1)
+                return -1;
+        }
+        else {
+            const unsigned char *fields = s->take(BodyFields::fixedSize);
+            if (fields == NULL)
+                return -1;
+            BodyFields::load(fields, body);
+        }
+
+        size_t tailSize = s->bufferSize;
+        BodyFields::loadTail(s->take(tailSize), tailSize, body);
+        return 0;
+    }
+
+private:
+    // Checks the bound once, then stores varints one after another
+    static int encodeV2(struct WriteByteStream *s, struct NodeIdentity *nodeId, const Body *body)
+    {
+        size_t tailSize = BodyFields::tailSize(body);
+        if (s->bufferSize < maxWireSizeV2 + tailSize)
+            return -1;
+
+        unsigned char *message = s->buffer;
+        unsigned char *field = message;
+        *field++ = MESSAGE_V2_FLAG | messageType;
+        field += storeVarUInt32(field, nodeId->processId);
+        memcpy(field, nodeId->macAddress, 6);
+        field += 6;
+        field = BodyFields::storeV2(field, body);
+        BodyFields::storeTail(field, body);
+
+        s->reserve((size_t)(field - message) + tailSize);
+        return 0;
+    }
+};
+
+template <enum MessageType type>
+struct MessageSchemaOf;
+
+template <>
+struct MessageSchemaOf<WhoIsMaster> : MessageSchema<WhoIsMaster, EmptyBody>
+{
+    static const char *name() { return "WhoIsMaster"; }
+};
+
+template <>
+struct MessageSchemaOf<IAmMaster>
+    : MessageSchema<IAmMaster, MasterHeartbeatBody,
+        TailInt32Field<MasterHeartbeatBody, &MasterHeartbeatBody::heartbeatIntervalMs>,
+        TailInt32Field<MasterHeartbeatBody, &MasterHeartbeatBody::isHeartbeat>,
+        TailInt32Field<MasterHeartbeatBody, &MasterHeartbeatBody::hasDeputy>,
+        TailInt32Field<MasterHeartbeatBody, &MasterHeartbeatBody::masterForMs> >
+{
+    static const char *name() { return "IAmMaster"; }
+};
+
+template <>
+struct MessageSchemaOf<PleaseWait> : MessageSchema<PleaseWait, EmptyBody>
+{
+    static const char *name() { return "PleaseWait"; }
+};
+
+template <>
+struct MessageSchemaOf<ControlRequest>
+    : MessageSchema<ControlRequest, ControlRequestBody,
+        TailInt32Field<ControlRequestBody, &ControlRequestBody::responseWindowMs>,
+        TailInt32Field<ControlRequestBody, &ControlRequestBody::treeEpoch> >
+{
+    static const char *name() { return "ControlRequest"; }
+};
+
+template <>
+struct MessageSchemaOf<ControlResponse>
+    : MessageSchema<ControlResponse, SensorsInfoBody,
+        Int32Field<SensorsInfoBody, &SensorsInfoBody::luminosity>,
+        Int32Field<SensorsInfoBody, &SensorsInfoBody::temperature> >
+{
+    static const char *name() { return "ControlResponse"; }
+};
+
+template <>
+struct MessageSchemaOf<ControlSet>
+    : MessageSchema<ControlSet, DisplayInfoBody,
+        Int32Field<DisplayInfoBody, &DisplayInfoBody::brightness>,
+        TailTextField<DisplayInfoBody, &DisplayInfoBody::text, &DisplayInfoBody::textLength> >
+{
+    static const char *name() { return "ControlSet"; }
+};
+
+template <>
+struct MessageSchemaOf<AggregationAssign>
+    : MessageSchema<AggregationAssign, AggregationAssignBody,
+        Int32Field<AggregationAssignBody, &AggregationAssignBody::treeEpoch>,
+        Int32Field<AggregationAssignBody, &AggregationAssignBody::underAggregator>,
+        Int32Field<AggregationAssignBody, &AggregationAssignBody::collectMs>,
+        Int32Field<AggregationAssignBody, &AggregationAssignBody::descendantsCount>,
+        TailBytesField<AggregationAssignBody, unsigned char, &AggregationAssignBody::children, &AggregationAssignBody::childrenSize> >
+{
+    static const char *name() { return "AggregationAssign"; }
+};
+
+template <>
+struct MessageSchemaOf<ControlSummary>
+    : MessageSchema<ControlSummary, SensorsSummaryBody,
+        Int32Field<SensorsSummaryBody, &SensorsSummaryBody::count>,
+        Int64Field<SensorsSummaryBody, &SensorsSummaryBody::luminositySum>,
+        Int64Field<SensorsSummaryBody, &SensorsSummaryBody::luminosityM2>,
+        Int32Field<SensorsSummaryBody, &SensorsSummaryBody::luminosityMin>,
+        Int32Field<SensorsSummaryBody, &SensorsSummaryBody::luminosityMax>,
+        Int64Field<SensorsSummaryBody, &SensorsSummaryBody::temperatureSum>,
+        Int64Field<SensorsSummaryBody, &SensorsSummaryBody::temperatureM2>,
+        Int32Field<SensorsSummaryBody, &SensorsSummaryBody::temperatureMin>,
+        Int32Field<SensorsSummaryBody, &SensorsSummaryBody::temperatureMax> >
+{
+    static const char *name() { return "ControlSummary"; }
+};
+
+template <>
+struct MessageSchemaOf<DeputySync>
+    : MessageSchema<DeputySync, DeputySyncBody,
+        Int32Field<DeputySyncBody, &DeputySyncBody::isDeputy>,
+        Int32Field<DeputySyncBody, &DeputySyncBody::controlRound>,
+        Int32Field<DeputySyncBody, &DeputySyncBody::firstMember>,
+        Int32Field<DeputySyncBody, &DeputySyncBody::membersCount>,
+        Int32Field<DeputySyncBody, &DeputySyncBody::sequence>,
+        Int32Field<DeputySyncBody, &DeputySyncBody::leftCount>,
+        TailBytesField<DeputySyncBody, unsigned char, &DeputySyncBody::members, &DeputySyncBody::membersSize> >
+{
+    static const char *name() { return "DeputySync"; }
+};
+
+template <>
+struct MessageSchemaOf<Abdication>
+    : MessageSchema<Abdication, AbdicationBody,
+        Int32Field<AbdicationBody, &AbdicationBody::controlRound>,
+        TailBytesField<AbdicationBody, unsigned char, &AbdicationBody::successor, &AbdicationBody::successorSize> >
+{
+    static const char *name() { return "Abdication"; }
+};
+
+template <>
+struct MessageSchemaOf<MembershipMerge>
+    : MessageSchema<MembershipMerge, MembershipMergeBody,
+        TailBytesField<MembershipMergeBody, unsigned char, &MembershipMergeBody::members, &MembershipMergeBody::membersSize> >
+{
+    static const char *name() { return "MembershipMerge"; }
+};
+
+// MessageTypeList<0, 1, ..., MESSAGE_TYPES_COUNT - 1> is
+// AllMessageTypes<>::List, to expand a table indexed by the type,
+// e.g. { handler<(enum MessageType)Types>... }
+static_assert(MESSAGE_TYPES_COUNT <= MESSAGE_V2_TYPE_MASK + 1, "v2 header has no room for the message types");
+
+template <int... Types>
+struct MessageTypeList
+{
+};
+
+template <int count = MESSAGE_TYPES_COUNT, int... Types>
+struct AllMessageTypes : AllMessageTypes<count - 1, count - 1, Types...>
+{
+};
+
+template <int... Types>
+struct AllMessageTypes<0, Types...>
+{
+    typedef MessageTypeList<Types...> List;
+};
+
+#endif // MESSAGES_H
@@ -1,6 +1,7 @@
 #include "networking.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // int types
@@ -15,10 +16,21 @@
 
 #include <errno.h>
 
-#include "timers.h"
 #include "logging.h"
+#include "recvshard.h"
+#include "uringnet.h"
 
-static int bindDgramSocket(struct sockaddr_in *addr)
+void NetworkingConfig::setDefaults()
+{
+    this->udpPort = 10500;
+    this->backend = NETWORKING_BACKEND_SOCKETS;
+    this->recvThreadsCount = 0;
+    for (int i = 0; i < MAX_RECV_THREADS; ++i)
+        this->recvThreadsCpus[i] = -1;
+    this->transport = NULL;
+}
+
+int Networking::bindDgramSocket(struct sockaddr_in *addr, bool reusePort)
 {
     int socketFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
 
@@ -35,6 +47,7 @@ static int bindDgramSocket(struct sockaddr_in *addr)
             &broadcastSocketOption, sizeof(int)) == -1) {
         perror("Set broadcast socket oprion");
         logPosition();
+        close(socketFd);
         return -1;
     }
 
@@ -44,13 +57,25 @@ static int bindDgramSocket(struct sockaddr_in *addr)
             &reuseAddressSocketOption, sizeof(int)) == -1) {
         perror("Set reuse address socket option");
         logPosition();
-        return 1;
+        close(socketFd);
+        return -1;
     }
 
+    // every socket of a SO_REUSEPORT group has to set the option
+    int reusePortSocketOption = 1;
+    if (reusePort && setsockopt(socketFd,
+            SOL_SOCKET, SO_REUSEPORT,
+            &reusePortSocketOption, sizeof(int)) == -1) {
+        perror("Set reuse port socket option");
+        logPosition();
+        close(socketFd);
+        return -1;
+    }
 
     if (bind(socketFd, (struct sockaddr*)addr, sizeof(struct sockaddr_in)) == -1) {
         perror("Bind dgram socket");
         logPosition();
+        close(socketFd);
         return -1;
     }
 
@@ -60,29 +85,132 @@ static int bindDgramSocket(struct sockaddr_in *addr)
 
 static void initSocketAddress(struct sockaddr_in *addr, uint32_t ipAddress, uint16_t port)
 {
+    memset(addr, 0, sizeof(struct sockaddr_in));
     addr->sin_family = AF_INET;
     addr->sin_port = htons(port);
     addr->sin_addr.s_addr = htonl(ipAddress);
 }
 
-int Networking::init(struct NetworkingConfig *config) {
+int Networking::init(struct NetworkingConfig *config, struct EventLoop *loop) {
     this->breakRecvLoop = false;
+    this->loop = loop;
+    this->recvStarted = false;
+    this->dgramSocketFd = -1;
+    this->shards = NULL;
+    this->shardsCount = 0;
+    this->uring = NULL;
+    this->transport = config->transport;
+    this->recvHandler = NULL;
+    this->recvHandlerArgument = NULL;
+    this->recvBatchHandler = NULL;
+    this->recvBatchHandlerArgument = NULL;
+
+    for (int i = 0; i < RECV_BATCH_SIZE; ++i)
+        this->batchBuffers[i] = NULL;
 
     initSocketAddress(&this->recvDgramAddress, INADDR_ANY, config->udpPort);
     initSocketAddress(&this->broadcastDgramAddress, INADDR_BROADCAST, config->udpPort);
 
-    int socketFd = bindDgramSocket(&this->recvDgramAddress);
+    // the transport brings its own buffers
+    if (this->transport != NULL)
+        return 0;
+
+    if (this->recvBufferPool.init(RECV_BUFFERS_INITIAL_COUNT) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    int shardsCount = config->recvThreadsCount;
+    if (shardsCount < 0 || shardsCount > MAX_RECV_THREADS) {
+        logPosition();
+        return -1;
+    }
+
+    int socketFd = Networking::bindDgramSocket(&this->recvDgramAddress, shardsCount > 0);
     if (socketFd == -1) {
         logPosition();
         return -1;
     }
 
     this->dgramSocketFd = socketFd;
+
+    if (config->backend == NETWORKING_BACKEND_IO_URING) {
+        this->uring = (struct UringNet *)malloc(sizeof(struct UringNet));
+        if (this->uring == NULL) {
+            logPosition();
+            return -1;
+        }
+        if (this->uring->init(socketFd, loop, &this->recvBufferPool) == -1) {
+            logError("io_uring is unavailable, falling back to sockets");
+            this->uring->deinit();
+            free(this->uring);
+            this->uring = NULL;
+        }
+    }
+
+    if (shardsCount > 0) {
+        void *shards;
+        // shards hold cache line aligned rings
+        if (posix_memalign(&shards, CACHE_LINE_SIZE, shardsCount * sizeof(struct RecvShard)) != 0) {
+            logPosition();
+            return -1;
+        }
+        this->shards = (struct RecvShard *)shards;
+
+        for (int i = 0; i < shardsCount; ++i) {
+            if (this->shards[i].init(i, config->recvThreadsCpus[i], &this->recvDgramAddress, &this->recvBufferPool) == -1) {
+                logPosition();
+                return -1;
+            }
+            ++this->shardsCount;
+        }
+    }
     return 0;
 }
 
 int Networking::deinit()
 {
+    if (this->stopRecv() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    if (this->transport != NULL) {
+        this->transport = NULL;
+        return 0;
+    }
+
+    for (int i = 0; i < RECV_BATCH_SIZE; ++i) {
+        if (this->batchBuffers[i] != NULL)
+            this->batchBuffers[i]->release();
+        this->batchBuffers[i] = NULL;
+    }
+
+    for (int i = 0; i < this->shardsCount; ++i) {
+        if (this->shards[i].deinit() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    free(this->shards);
+    this->shards = NULL;
+    this->shardsCount = 0;
+
+    if (this->uring != NULL) {
+        if (this->uring->deinit() == -1) {
+            logPosition();
+            return -1;
+        }
+        free(this->uring);
+        this->uring = NULL;
+    }
+
+    // leases still held by handlers are lost with the pool
+    if (this->recvBufferPool.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+
     if (this->dgramSocketFd != -1)
     {
         if (close(this->dgramSocketFd) == -1)
@@ -97,6 +225,12 @@ int Networking::deinit()
 
 int Networking::broadcastDgram(unsigned char *content, size_t contentSize)
 {
+    if (this->transport != NULL)
+        return this->transport->ops->broadcastDgram(this->transport, content, contentSize);
+
+    if (this->uring != NULL)
+        return this->uring->queueSend(&this->broadcastDgramAddress, content, contentSize);
+
     ssize_t sizeBeSent =
         sendto(this->dgramSocketFd,
             content, contentSize,
@@ -114,6 +248,12 @@ int Networking::broadcastDgram(unsigned char *content, size_t contentSize)
 
 int Networking::sendDgram(struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize)
 {
+    if (this->transport != NULL)
+        return this->transport->ops->sendDgram(this->transport, peerAddress, content, contentSize);
+
+    if (this->uring != NULL)
+        return this->uring->queueSend(peerAddress, content, contentSize);
+
     ssize_t sizeBeSent =
         sendto(this->dgramSocketFd,
             content, contentSize,
@@ -128,63 +268,269 @@ int Networking::sendDgram(struct sockaddr_in *peerAddress, unsigned char *conten
     return sizeBeSent;
 }
 
-#define RECV_BUFFER_SIZE 8196
+int Networking::sendDgramBatch(struct SendDatagram *datagrams, size_t count)
+{
+    if (this->uring != NULL || this->transport != NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            struct SendDatagram *datagram = &datagrams[i];
+            if (this->sendDgram(datagram->peerAddress, datagram->content, datagram->contentSize) == -1)
+                return i > 0 ? (int)i : -1;
+        }
+        return count;
+    }
 
-unsigned char recvBuffer[RECV_BUFFER_SIZE];
+    struct mmsghdr messages[SEND_BATCH_SIZE];
+    struct iovec vectors[SEND_BATCH_SIZE];
+
+    size_t sentCount = 0;
+    while (sentCount < count) {
+        size_t batchSize = count - sentCount;
+        if (batchSize > SEND_BATCH_SIZE)
+            batchSize = SEND_BATCH_SIZE;
+
+        for (size_t i = 0; i < batchSize; ++i) {
+            struct SendDatagram *datagram = &datagrams[sentCount + i];
+            vectors[i].iov_base = datagram->content;
+            vectors[i].iov_len = datagram->contentSize;
+
+            struct msghdr *header = &messages[i].msg_hdr;
+            memset(header, 0, sizeof(struct msghdr));
+            header->msg_name = datagram->peerAddress;
+            header->msg_namelen = sizeof(struct sockaddr_in);
+            header->msg_iov = &vectors[i];
+            header->msg_iovlen = 1;
+        }
 
-int Networking::runRecvLoop(RecvHandler handler, void *arg)
+        int res = sendmmsg(this->dgramSocketFd, messages, batchSize, 0);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Send dgram batch");
+            logPosition();
+            return sentCount > 0 ? (int)sentCount : -1;
+        }
+        sentCount += res;
+    }
+
+    return sentCount;
+}
+
+void SendBatch::init(struct Networking *net)
+{
+    this->net = net;
+    this->count = 0;
+}
+
+int SendBatch::add(struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize)
 {
-    if (this->dgramSocketFd < 0) {
+    struct SendDatagram *datagram = &this->datagrams[this->count++];
+    datagram->peerAddress = peerAddress;
+    datagram->content = content;
+    datagram->contentSize = contentSize;
+
+    if (this->count == SEND_BATCH_SIZE)
+        return this->flush();
+    return 0;
+}
+
+int SendBatch::flush()
+{
+    if (this->count == 0)
+        return 0;
+
+    size_t count = this->count;
+    this->count = 0;
+    if (this->net->sendDgramBatch(this->datagrams, count) != (int)count) {
         logPosition();
         return -1;
     }
+    return 0;
+}
 
-    this->breakRecvLoop = false;
+int Networking::drainDgramSocket()
+{
+    struct mmsghdr messages[RECV_BATCH_SIZE];
+    struct iovec vectors[RECV_BATCH_SIZE];
+    struct RecvDatagram datagrams[RECV_BATCH_SIZE];
+    // receives and drops datagrams when the buffer pool is exhausted
+    unsigned char discardBuffer[RECV_BUFFER_SIZE];
 
-    sigset_t old_mask;
+    // edge-triggered: read until the socket is empty
+    while (!this->breakRecvLoop) {
+        int batchSize = 0;
+        for (; batchSize < RECV_BATCH_SIZE; ++batchSize) {
+            if (this->batchBuffers[batchSize] == NULL)
+                this->batchBuffers[batchSize] = this->recvBufferPool.acquire();
+            if (this->batchBuffers[batchSize] == NULL)
+                break;
+        }
 
-    Timer::lockTimers(&old_mask);
+        bool discard = batchSize == 0;
+        if (discard)
+            batchSize = 1;
 
-    while (!this->breakRecvLoop) {
-        fd_set fds;
-        int res;
+        for (int i = 0; i < batchSize; ++i) {
+            vectors[i].iov_base = discard ? discardBuffer : this->batchBuffers[i]->data + RECV_BUFFER_HEADROOM;
+            vectors[i].iov_len = RECV_BUFFER_SIZE;
+
+            struct msghdr *header = &messages[i].msg_hdr;
+            memset(header, 0, sizeof(struct msghdr));
+            header->msg_name = &datagrams[i].senderAddress;
+            header->msg_namelen = sizeof(struct sockaddr_in);
+            header->msg_iov = &vectors[i];
+            header->msg_iovlen = 1;
+        }
 
-        FD_ZERO (&fds);
-        FD_SET (this->dgramSocketFd, &fds);
-        res = pselect(this->dgramSocketFd + 1, &fds, NULL, NULL, NULL, &old_mask);
+        int count = recvmmsg(this->dgramSocketFd, messages, batchSize, 0, NULL);
 
-        if (res < 0 && errno != EINTR) {
-            perror ("select");
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            perror("Receive dgram batch");
+            logPosition();
             return -1;
         }
-        else if (this->breakRecvLoop) {
-            break;
-        }
-        else if (res == 0)
+
+        if (discard) {
+            logError("Receive buffers are exhausted, datagram is dropped");
             continue;
+        }
 
-        if (FD_ISSET(this->dgramSocketFd, &fds)) {
-            struct sockaddr_in senderAddress;
-            socklen_t addressLength = sizeof(struct sockaddr_in);
+        for (int i = 0; i < count; ++i) {
+            datagrams[i].buffer = this->batchBuffers[i];
+            datagrams[i].message = this->batchBuffers[i]->data + RECV_BUFFER_HEADROOM;
+            datagrams[i].messageSize = messages[i].msg_len;
+        }
 
-            ssize_t sizeBeRecieved =
-                recvfrom(this->dgramSocketFd, recvBuffer, RECV_BUFFER_SIZE,
-                    0,
-                    (struct sockaddr*)&senderAddress, &addressLength);
+        this->recvBatchHandler(datagrams, count, this->recvBatchHandlerArgument);
 
-            if (sizeBeRecieved < 0) {
-                if (errno != EINTR && errno != EAGAIN) {
-                    perror("Receive dgram");
-                    logPosition();
-                }
-            }
-            else {
-                handler(&senderAddress, recvBuffer, sizeBeRecieved, arg);
-            }
+        // buffers retained by the handler stay out of the pool
+        for (int i = 0; i < count; ++i) {
+            this->batchBuffers[i]->release();
+            this->batchBuffers[i] = NULL;
         }
-        Timer::runAllPendingTimouts();
+
+        // a short batch means the socket has been drained
+        if (count < batchSize)
+            return 0;
     }
     return 0;
 }
 
+void Networking::recvBatchToDgramHandler(struct RecvDatagram *datagrams, size_t count, void *arg)
+{
+    struct Networking *self = (struct Networking*)arg;
+
+    for (size_t i = 0; i < count && !self->breakRecvLoop; ++i) {
+        struct RecvDatagram *datagram = &datagrams[i];
+        self->recvHandler(&datagram->senderAddress, datagram->message, datagram->messageSize, self->recvHandlerArgument);
+    }
+}
+
+void Networking::dgramSocketEventHandler(uint32_t events, void *arg)
+{
+    struct Networking *self = (struct Networking*)arg;
+
+    if (self->drainDgramSocket() == -1) {
+        logPosition();
+    }
+}
+
+int Networking::startRecv(RecvHandler handler, void *arg)
+{
+    this->recvHandler = handler;
+    this->recvHandlerArgument = arg;
+
+    return this->startRecvBatch(recvBatchToDgramHandler, this);
+}
+
+int Networking::startRecvBatch(RecvBatchHandler handler, void *arg)
+{
+    if ((this->dgramSocketFd < 0 && this->transport == NULL) || this->recvStarted) {
+        logPosition();
+        return -1;
+    }
+
+    this->breakRecvLoop = false;
+    this->recvBatchHandler = handler;
+    this->recvBatchHandlerArgument = arg;
+
+    int res;
+    if (this->transport != NULL)
+        res = this->transport->ops->startRecv(this->transport, handler, arg);
+    else if (this->uring != NULL)
+        res = this->uring->startRecv(handler, arg);
+    else
+        res = this->loop->addFd(this->dgramSocketFd, EPOLLIN, dgramSocketEventHandler, this);
+    if (res == -1) {
+        logPosition();
+        return -1;
+    }
+    this->recvStarted = true;
 
+    for (int i = 0; i < this->shardsCount; ++i) {
+        if (this->shards[i].start(this->loop, handler, arg) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int Networking::stopRecv()
+{
+    if (!this->recvStarted)
+        return 0;
+
+    for (int i = 0; i < this->shardsCount; ++i) {
+        if (this->shards[i].stop() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    int res;
+    if (this->transport != NULL)
+        res = this->transport->ops->stopRecv(this->transport);
+    else if (this->uring != NULL)
+        res = this->uring->stopRecv();
+    else
+        res = this->loop->removeFd(this->dgramSocketFd);
+    if (res == -1) {
+        logPosition();
+        return -1;
+    }
+    this->recvStarted = false;
+    return 0;
+}
+
+int Networking::runRecvLoop(RecvHandler handler, void *arg)
+{
+    this->recvHandler = handler;
+    this->recvHandlerArgument = arg;
+
+    return this->runRecvBatchLoop(recvBatchToDgramHandler, this);
+}
+
+int Networking::runRecvBatchLoop(RecvBatchHandler handler, void *arg)
+{
+    if (this->startRecvBatch(handler, arg) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    while (!this->breakRecvLoop) {
+        if (this->loop->runOnce(-1) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    if (this->stopRecv() == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
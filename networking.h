@@ -4,27 +4,130 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 
+#include "eventloop.h"
+#include "recvbufferpool.h"
+#include "transport.h"
+
+#define MAX_RECV_THREADS 16
+
+enum NetworkingBackend
+{
+    NETWORKING_BACKEND_SOCKETS,
+    // falls back to sockets when io_uring is unavailable
+    NETWORKING_BACKEND_IO_URING
+};
+
 struct NetworkingConfig
 {
     uint16_t udpPort;
+    enum NetworkingBackend backend;
+
+    // Extra receive threads, each with its own SO_REUSEPORT socket
+    // on udpPort. 0 receives on the loop thread only.
+    int recvThreadsCount;
+    // CPU to pin each receive thread to, -1 to leave it unpinned
+    int recvThreadsCpus[MAX_RECV_THREADS];
+
+    // When set, datagrams go through it instead of a kernel socket and
+    // the options above are ignored. NULL by default.
+    struct Transport *transport;
+
+    void setDefaults();
 };
 
+struct RecvShard;
+struct UringNet;
+
 typedef void (*RecvHandler)(struct sockaddr_in* senderAddress, unsigned char *message, size_t messageSize, void *arg);
 
+#define RECV_BATCH_SIZE 32
+#define RECV_BUFFERS_INITIAL_COUNT 256
+#define SEND_BATCH_SIZE 32
+
+struct RecvDatagram
+{
+    struct sockaddr_in senderAddress;
+    unsigned char *message;
+    size_t messageSize;
+    // holds message, retain it to keep the message past the handler
+    struct RecvBuffer *buffer;
+};
+
+struct SendDatagram
+{
+    struct sockaddr_in *peerAddress;
+    unsigned char *content;
+    size_t contentSize;
+};
+
+struct Networking;
+
+// Datagrams gathered to go out through one sendDgramBatch, sent when
+// SEND_BATCH_SIZE are gathered and on flush(). The contents and the
+// addresses must stay as they are until then.
+struct SendBatch
+{
+    struct Networking *net;
+    struct SendDatagram datagrams[SEND_BATCH_SIZE];
+    size_t count;
+
+    void init(struct Networking *net);
+    int add(struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize);
+    int flush();
+};
+
 struct Networking
 {
     struct sockaddr_in recvDgramAddress;
     struct sockaddr_in broadcastDgramAddress;
     int dgramSocketFd;
 
+    struct EventLoop *loop;
+    bool recvStarted;
+    struct RecvBufferPool recvBufferPool;
+    // buffers the next recvmmsg receives into
+    struct RecvBuffer *batchBuffers[RECV_BATCH_SIZE];
+
+    struct RecvShard *shards;
+    int shardsCount;
+
+    // NULL when the sockets backend is used
+    struct UringNet *uring;
+    // NULL unless injected by the config, then the socket is not opened
+    struct Transport *transport;
+
+    RecvHandler recvHandler;
+    void *recvHandlerArgument;
+    RecvBatchHandler recvBatchHandler;
+    void *recvBatchHandlerArgument;
+
     bool breakRecvLoop;
 
-    int init(struct NetworkingConfig *config);
+    int init(struct NetworkingConfig *config, struct EventLoop *loop);
     int deinit();
 
     int broadcastDgram(unsigned char *content, size_t contentSize);
     int sendDgram(sockaddr_in *peerAddress, unsigned char *content, size_t contentSize);
+    // Returns the count of datagrams sent
+    int sendDgramBatch(struct SendDatagram *datagrams, size_t count);
+
+    // Registers the socket with the loop, datagrams are received
+    // while the loop runs
+    int startRecv(RecvHandler handler, void *arg);
+    int startRecvBatch(RecvBatchHandler handler, void *arg);
+    int stopRecv();
+
+    // Runs the loop until breakRecvLoop is set
     int runRecvLoop(RecvHandler handler, void *arg);
+    int runRecvBatchLoop(RecvBatchHandler handler, void *arg);
+
+    static int bindDgramSocket(struct sockaddr_in *addr, bool reusePort);
+
+private:
+    int drainDgramSocket();
+
+    static void dgramSocketEventHandler(uint32_t events, void *arg);
+    static void recvBatchToDgramHandler(struct RecvDatagram *datagrams, size_t count, void *arg);
 };
 
 
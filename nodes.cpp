@@ -1,5 +1,6 @@
 #include "nodes.h"
 
+#include <math.h>
 #include <string.h>
 
 #include "logging.h"
@@ -8,18 +9,51 @@
 
 static void printNodeDescriptor(struct NodeDescriptor *node);
 static void printNodeIdentity(struct NodeIdentity *nodeId);
+static void printAggregate(const char *name, struct StreamingAggregate *aggregate);
+static void storeMemberRecord(unsigned char *record, struct NodeIdentity *id, struct sockaddr_in *address);
+static void loadMemberRecord(const unsigned char *record, struct NodeIdentity *id, struct sockaddr_in *address);
 
-int SelfNode::init(NetworkingConfig *netConfig)
+void SelfNodeConfig::setDefaults()
 {
-    memset(&this->net, 0, sizeof(struct Networking));
-    if (this->net.init(netConfig) == -1) {
+    this->net.setDefaults();
+    this->identity = NULL;
+    this->stateHandler = NULL;
+    this->stateHandlerArgument = NULL;
+    this->roundQuorum = 1;
+    this->wireVersion = WireV2;
+    this->aggregationDegree = 0;
+    this->heartbeatIntervalMs = 1000;
+    this->phiThreshold = 8;
+}
+
+int SelfNode::init(struct SelfNodeConfig *config, struct EventLoop *loop)
+{
+    this->loop = loop;
+
+    if (config->aggregationDegree == 1 || config->aggregationDegree > AGGREGATION_MAX_DEGREE) {
+        logError("Aggregation degree is out of range");
+        logPosition();
+        return -1;
+    }
+    if (config->heartbeatIntervalMs <= 0 || !(config->phiThreshold > 0)) {
+        logError("Heartbeat interval and phi threshold must be positive");
+        logPosition();
+        return -1;
+    }
+    this->heartbeatIntervalMs = config->heartbeatIntervalMs;
+    this->phiThreshold = config->phiThreshold;
+
+    if (this->net.init(&config->net, loop) == -1) {
         logPosition();
         return -1;
     }
 
     memset(&this->nodeIdentity, 0, sizeof(struct NodeIdentity));
 
-    if (NodeIdentity::getSelfNodeIdentity(&this->nodeIdentity) == -1) {
+    if (config->identity != NULL) {
+        this->nodeIdentity = *config->identity;
+    }
+    else if (NodeIdentity::getSelfNodeIdentity(&this->nodeIdentity) == -1) {
         logPosition();
         return -1;
     }
@@ -30,174 +64,200 @@ int SelfNode::init(NetworkingConfig *netConfig)
     }
 
     this->state = WithoutMaster;
-    this->clientsCount = 0;
+    this->stateHandler = config->stateHandler;
+    this->stateHandlerArgument = config->stateHandlerArgument;
+    this->wireVersion = config->wireVersion;
+    this->v1MessageReceived = false;
+    this->lastV1MessageTime = 0;
+    this->controlRound = 0;
+    this->controlRoundOpen = false;
+    this->controlRoundStartTime = 0;
+    this->controlRoundQuorum = 0;
+    this->controlRoundResponsesCount = 0;
+    this->roundQuorum = config->roundQuorum;
+    memset(&this->roundStats, 0, sizeof(struct ControlRoundStats));
+    this->luminosityAggregate.reset();
+    this->temperatureAggregate.reset();
+    if (this->slaves.init(MEMBERSHIP_INITIAL_CAPACITY) == -1) {
+        logPosition();
+        return -1;
+    }
+    this->aggregationTree.init(config->aggregationDegree);
+    this->aggregationTreeDirty = false;
+    this->nextTreeRebuildTime = 0;
+    this->assignedTreeEpoch = 0;
+    this->underAggregator = false;
+    this->aggregationCollectMs = 0;
+    this->aggregationDescendantsCount = 0;
+    this->aggregationChildren = NULL;
+    this->aggregationChildrenCount = 0;
+    this->aggregationChildrenCapacity = 0;
+    this->forwardControlSet = false;
+    this->hasDeputy = false;
+    if (this->deputySlaves.init(MEMBERSHIP_INITIAL_CAPACITY) == -1) {
+        logPosition();
+        return -1;
+    }
+    this->deputySyncSequence = 0;
+    this->deputyFullSyncTime = 0;
+    this->isDeputy = false;
+    this->masterHasDeputy = false;
+    if (this->standbySlaves.init(MEMBERSHIP_INITIAL_CAPACITY) == -1) {
+        logPosition();
+        return -1;
+    }
+    this->standbyControlRound = 0;
+    this->standbyFullySynced = false;
+    this->standbySyncBase = 0;
+    this->standbyLastSequence = 0;
+    this->standbyPartsCount = 0;
+    this->standbyMembersCount = 0;
+    this->hasAbdicatedMaster = false;
+    this->waitingForMaster = false;
+    this->whoIsMasterPending = false;
+    this->iAmMasterReplyPending = false;
+    this->lastIAmMasterTime = 0;
+    memset(&this->electionStats, 0, sizeof(struct ElectionStats));
+    this->masterSinceTime = 0;
+    memset(&this->splitBrainStats, 0, sizeof(struct SplitBrainStats));
 
     memset(this->displayText, 0, DISPLAY_TEXT_MAX_SIZE);
     this->brightness = 0;
+    this->shownTextBuffer = NULL;
+    this->setShownText(this->displayText, 0, NULL);
 
     return 0;
 }
 
-struct WriteByteStream {
-    unsigned char *buffer;
-    size_t bufferSize;
-
-    void openStream(unsigned char *buffer, size_t bufferSize)
-    {
-        this->buffer = buffer;
-        this->bufferSize = bufferSize;
-    }
-
-    int writeInt32(uint32_t value)
-    {
-        if (bufferSize < sizeof(uint32_t))
-            return -1;
-        ((uint32_t*)buffer)[0] = htonl(value);
-        buffer += sizeof(uint32_t);
-        bufferSize -= sizeof(uint32_t);
-        return 0;
-    }
-
-    int writeBytes(const unsigned char *bytes, size_t bytesCount)
-    {
-        if (bufferSize < bytesCount)
-            return -1;
-        memcpy(buffer, bytes, bytesCount);
-        buffer += bytesCount;
-        bufferSize -= bytesCount;
-        return 0;
-    }
-};
-
-struct ReadByteStream {
-    unsigned char *buffer;
-    size_t bufferSize;
-
-    void openStream(unsigned char *buffer, size_t bufferSize)
-    {
-        this->buffer = buffer;
-        this->bufferSize = bufferSize;
-    }
-
-    int readInt32(uint32_t *value)
-    {
-        if (bufferSize < sizeof(uint32_t))
-            return -1;
-        *value = ntohl(((uint32_t*)buffer)[0]);
-        buffer += sizeof(uint32_t);
-        bufferSize -= sizeof(uint32_t);
-        return 0;
-    }
-
-    int readBytes(unsigned char *bytes, size_t bytesCount)
-    {
-        if (bufferSize < bytesCount)
-            return -1;
-        memcpy(bytes, buffer, bytesCount);
-        buffer += bytesCount;
-        bufferSize -= bytesCount;
-        return 0;
-    }
-};
-
-int serializeNodeIdentity(struct WriteByteStream *s, struct NodeIdentity *id)
+enum NodeState SelfNode::getState()
 {
-    if (s->writeInt32(id->processId) == -1)
-        return -1;
+    return this->state;
+}
 
-    if (s->writeBytes(id->macAddress, 6) == -1)
-        return -1;
+void SelfNode::getIdentity(struct NodeIdentity *id)
+{
+    *id = this->nodeIdentity;
+}
 
-    return 0;
+bool SelfNode::getMasterIdentity(struct NodeIdentity *id)
+{
+    if (this->state != Slave)
+        return false;
+    *id = this->myMaster.id;
+    return true;
 }
 
-int serializeMessage(struct WriteByteStream *s, MessageType type, struct NodeIdentity *nodeId)
+void SelfNode::getControlRoundStats(struct ControlRoundStats *stats)
 {
-    if (s->writeInt32(type) == -1)
-        return -1;
+    *stats = this->roundStats;
+}
 
-    if (serializeNodeIdentity(s, nodeId) == -1)
-        return -1;
+void SelfNode::getElectionStats(struct ElectionStats *stats)
+{
+    *stats = this->electionStats;
+}
 
-    return 0;
+void SelfNode::getSplitBrainStats(struct SplitBrainStats *stats)
+{
+    *stats = this->splitBrainStats;
 }
 
-int deserializeNodeIdentity(struct ReadByteStream *s, struct NodeIdentity *id)
+int SelfNode::deinit()
 {
-    if (s->readInt32((uint32_t*)&id->processId) == -1)
+    if (this->deinitTimers() == -1) {
+        logPosition();
         return -1;
-
-    if (s->readBytes(id->macAddress, 6) == -1)
+    }
+    this->setShownText(this->displayText, 0, NULL);
+    this->slaves.deinit();
+    this->deputySlaves.deinit();
+    this->standbySlaves.deinit();
+    this->aggregationTree.deinit();
+    free(this->aggregationChildren);
+    this->aggregationChildren = NULL;
+    if (this->net.deinit() == -1) {
+        logPosition();
         return -1;
-
+    }
     return 0;
 }
 
-int deserializeMessage(struct ReadByteStream *s,  MessageType *type, struct NodeIdentity *nodeId)
+void SelfNode::recvDgramBatchHandler(struct RecvDatagram *datagrams, size_t count, void *arg)
 {
-    if (s->readInt32((uint32_t*)type) == -1)
-        return -1;
-
-    if (deserializeNodeIdentity(s, nodeId) == -1)
-        return -1;
+    struct SelfNode *self = (struct SelfNode*)arg;
 
-    return 0;
+    for (size_t i = 0; i < count; ++i)
+        self->onDatagramReceived(&datagrams[i]);
 }
 
-void SelfNode::recvDgramHandler(struct sockaddr_in* senderAddress, unsigned char *message, size_t messageSize, void *arg)
+template <int... Types>
+struct SelfNode::MessageReceivers<MessageTypeList<Types...> >
 {
-    struct SelfNode *self = (struct SelfNode*)arg;
+    static const MessageReceiver receivers[MESSAGE_TYPES_COUNT];
+};
 
+template <int... Types>
+const SelfNode::MessageReceiver SelfNode::MessageReceivers<MessageTypeList<Types...> >::receivers[MESSAGE_TYPES_COUNT] = {
+    &SelfNode::receiveMessage<(enum MessageType)Types>...
+};
+
+void SelfNode::onDatagramReceived(struct RecvDatagram *datagram)
+{
     struct NodeDescriptor senderNode;
-    senderNode.peerAddress = *senderAddress;
+    senderNode.peerAddress = datagram->senderAddress;
 
     ReadByteStream s;
-    s.openStream(message, messageSize);
+    s.openStream(datagram->message, datagram->messageSize);
 
     MessageType type;
-    if (deserializeMessage(&s, &type, &senderNode.id) == -1) {
+    if (deserializeMessage(&s, &type, &senderNode.id, &senderNode.wireVersion) == -1) {
         logError("Error deserialize message");
         logPosition();
         return;
     }
+    if ((unsigned int)type >= MESSAGE_TYPES_COUNT) {
+        logError("Unknown message type");
+        logPosition();
+        return;
+    }
 
-    if (self->compareWithSelf(&senderNode.id) != 0) {
-        switch (type) {
-        case ControlResponse: {
-            int luminosity;
-            int temperature;
-            if (s.readInt32((uint32_t*)&luminosity) == -1) {
-                logPosition();
-                return;
-            }
-            if (s.readInt32((uint32_t*)&temperature) == -1) {
-                logPosition();
-                return;
-            }
-            self->onSensorsInfoReceived(&senderNode, luminosity, temperature);
-            break;
-        }
-        case ControlSet: {
-            int brightness;
-            if (s.readInt32((uint32_t*)&brightness) == -1) {
-                logPosition();
-                return;
-            }
-            self->onDisplayInfoReceived(&senderNode, brightness, (char*)s.buffer, s.bufferSize);
-            break;
-        }
-        default:
-            self->onMessageReceived(type, &senderNode);
-            break;
-        }
+    if (this->compareWithSelf(&senderNode.id) == 0)
+        return;
 
+    if (senderNode.wireVersion == WireV1) {
+        this->v1MessageReceived = true;
+        this->lastV1MessageTime = this->loop->timerSystem.getTime();
     }
+    MessageReceivers<AllMessageTypes<>::List>::receivers[type](this, &senderNode, &s, datagram->buffer);
 }
 
-int SelfNode::run()
+template <enum MessageType type>
+void SelfNode::receiveMessage(struct SelfNode *self, struct NodeDescriptor *sender,
+                              struct ReadByteStream *s, struct RecvBuffer *buffer)
+{
+    typedef MessageSchemaOf<type> Schema;
+
+    typename Schema::Body body;
+    if (Schema::decodeBody(s, sender->wireVersion, &body) == -1) {
+        logError("Error deserialize message");
+        logPosition();
+        return;
+    }
+
+    if (isLogInfoEnabled()) {
+        char text[64];
+        snprintf(text, sizeof(text), "%s received from ", Schema::name());
+        logInfo(text);
+        printNodeDescriptor(sender);
+    }
+    self->onMessageReceived(type, sender, &body, buffer);
+}
+
+int SelfNode::start()
 {
     logInfo("Running...");
-    printNodeIdentity(&this->nodeIdentity);
+    if (isLogInfoEnabled())
+        printNodeIdentity(&this->nodeIdentity);
 
     this->generateSensorsInfo();
 
@@ -206,18 +266,59 @@ int SelfNode::run()
         return -1;
     }
 
-    logInfo("\t\tBroadcast WhoIsMaster");
-    if (this->broadcastMessage(WhoIsMaster)) {
+    if (this->becomeWithoutMaster() == -1) {
         logPosition();
         return -1;
     }
-    if (this->becomeWithoutMaster() == -1) {
+    // nodes powered on together spread their WhoIsMasters, most of which
+    // are then suppressed by a higher one heard first; the identity
+    // tells apart nodes whose rand() is seeded alike
+    uint32_t backoff = ((uint32_t)rand() ^ MembershipTable::hashIdentity(&this->nodeIdentity)) % ELECTION_BACKOFF_MS;
+    this->whoIsMasterPending = true;
+    if (this->whoIsMasterBackoffTimer.setInterval((int)backoff + 1) == -1
+            || this->whoIsMasterBackoffTimer.start() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    if (this->net.startRecvBatch(recvDgramBatchHandler, (void*)this) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int SelfNode::stop()
+{
+    struct Timer *timers[NODE_TIMERS_COUNT];
+    this->listTimers(timers);
+
+    for (int i = 0; i < NODE_TIMERS_COUNT; ++i) {
+        if (timers[i]->stop() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    this->whoIsMasterPending = false;
+    this->iAmMasterReplyPending = false;
+
+    if (this->net.stopRecv() == -1) {
+        logPosition();
+        return -1;
+    }
+    this->setState(WithoutMaster);
+    return 0;
+}
+
+int SelfNode::run()
+{
+    if (this->start() == -1) {
         logPosition();
         return -1;
     }
 
     logInfo("Run recv loop");
-    if (this->net.runRecvLoop(recvDgramHandler, (void*)this) == -1) {
+    if (this->loop->run() == -1) {
         logPosition();
         return -1;
     }
@@ -225,6 +326,21 @@ int SelfNode::run()
     return 0;
 }
 
+void SelfNode::setState(enum NodeState state)
+{
+    enum NodeState oldState = this->state;
+    this->state = state;
+
+    if (oldState != state)
+        this->notifyStateChanged(oldState);
+}
+
+void SelfNode::notifyStateChanged(enum NodeState oldState)
+{
+    if (this->stateHandler != NULL)
+        this->stateHandler(this, oldState, this->state, this->stateHandlerArgument);
+}
+
 int SelfNode::becomeWithoutMaster()
 {
     logInfo("\033[1;33m\tBecome WithoutMaster\033[0m");
@@ -233,7 +349,8 @@ int SelfNode::becomeWithoutMaster()
         return -1;
     }
 
-    this->state = WithoutMaster;
+    this->setState(WithoutMaster);
+    this->waitingForMaster = false;
     logInfo("\t\tStart WhoIsMaster timer");
     if (this->whoIsMasterTimer.start()) {
         logPosition();
@@ -250,7 +367,12 @@ int SelfNode::becomeWaitingForMaster()
         return -1;
     }
 
-    this->state = WithoutMaster;
+    this->setState(WithoutMaster);
+    this->waitingForMaster = true;
+    if (this->cancelWhoIsMaster() == -1) {
+        logPosition();
+        return -1;
+    }
 
     logInfo("\t\tStщз WhoIsMaster timer");
     if (this->whoIsMasterTimer.stop() == -1) {
@@ -268,9 +390,18 @@ int SelfNode::becomeWaitingForMaster()
 int SelfNode::becomeMaster()
 {
     logInfo("\033[1;33m\tBecome Master\033[0m");
-    this->state = Master;
-    logInfo("\t\tBroadcast IAmMaster");
-    if (this->broadcastMessage(IAmMaster) == -1) {
+    this->setState(Master);
+    this->masterSinceTime = this->loop->timerSystem.getTime();
+    this->waitingForMaster = false;
+    if (this->cancelWhoIsMaster() == -1) {
+        logPosition();
+        return -1;
+    }
+    // slaves may have come and gone since an earlier term
+    this->aggregationTreeDirty = true;
+    this->nextTreeRebuildTime = 0;
+    this->hasDeputy = false;
+    if (this->broadcastIAmMaster(false) == -1) {
         logPosition();
         return -1;
     }
@@ -288,7 +419,7 @@ int SelfNode::becomeMaster()
     return 0;
 }
 
-int SelfNode::becomeSlave(NodeDescriptor *master)
+int SelfNode::becomeSlave(NodeDescriptor *master, const struct MasterHeartbeatBody *heartbeat)
 {
     logInfo("\033[1;33m\tBecome Slave\033[0m");
     if (this->stopMasterTimers() == -1) {
@@ -296,14 +427,49 @@ int SelfNode::becomeSlave(NodeDescriptor *master)
         return -1;
     }
 
-    this->state = Slave;
+    bool isNewMaster = this->state == Slave && this->compareWithCurrentMaster(&master->id) != 0;
+    // an assignment only holds in the tree of the master which made it
+    if (this->state != Slave || isNewMaster) {
+        this->assignedTreeEpoch = 0;
+        this->aggregationChildrenCount = 0;
+        this->isDeputy = false;
+        this->standbySlaves.clear();
+    }
+    this->masterHasDeputy = heartbeat->hasDeputy != 0;
+    uint64_t now = this->loop->timerSystem.getTime();
+    // masters which predate the body beat every LEGACY_HEARTBEAT_INTERVAL_MS
+    // and do not tell their heartbeats from their replies
+    bool isLegacyMaster = heartbeat->heartbeatIntervalMs <= 0;
+    if (this->state != Slave || isNewMaster) {
+        this->masterFailureDetector.reset(now, isLegacyMaster
+            ? LEGACY_HEARTBEAT_INTERVAL_MS : heartbeat->heartbeatIntervalMs);
+    }
+    else if (heartbeat->isHeartbeat || isLegacyMaster) {
+        this->masterFailureDetector.heartbeat(now);
+    }
+
     this->myMaster = *master;
+    this->setState(Slave);
+    this->waitingForMaster = false;
+    if (isNewMaster)
+        this->notifyStateChanged(Slave);
+    if (this->cancelWhoIsMaster() == -1) {
+        logPosition();
+        return -1;
+    }
 
     if (this->whoIsMasterTimer.stop() == -1) {
         logPosition();
         return -1;
     }
+    // a node waiting for a master has found it
+    if (this->waitForMasterTimer.stop() == -1) {
+        logPosition();
+        return -1;
+    }
     logInfo("\t\tRestart MonitoringMaster timer");
+    uint64_t suspicionTime = this->masterFailureDetector.getSuspicionTime(this->phiThreshold);
+    this->monitoringMasterTimer.setInterval(suspicionTime > now ? suspicionTime - now : 1);
     if (this->monitoringMasterTimer.start() == -1) {
         logPosition();
         return -1;
@@ -312,114 +478,179 @@ int SelfNode::becomeSlave(NodeDescriptor *master)
     return 0;
 }
 
-int SelfNode::stopMasterTimers()
+int SelfNode::takeOverAsDeputy()
 {
-    if (this->state == Master) {
-        logInfo("\t\tStop IAmAlive heartbeet timer");
-        if (this->iAmAliveHeartbeetTimer.stop()) {
-            logPosition();
-            return -1;
-        }
-        logInfo("\t\tStop ControlRequest  timer");
-        if (this->controlRequestTimer.stop()) {
+    // a master with members the node does not know of would lose them
+    if (!this->isStandbyComplete()) {
+        logInfo("\033[1;33m\tDeputy state is incomplete\033[0m");
+        this->isDeputy = false;
+        this->standbySlaves.clear();
+        if (this->becomeWithoutMaster() == -1) {
             logPosition();
             return -1;
         }
+        return 0;
+    }
+
+    logInfo("\033[1;33m\tTake over as deputy\033[0m");
+
+    // the standby membership becomes the master's, the old one is only
+    // of the children the node has aggregated
+    struct MembershipTable slaves = this->slaves;
+    this->slaves = this->standbySlaves;
+    this->standbySlaves = slaves;
+    this->standbySlaves.clear();
+    this->slaves.remove(&this->nodeIdentity);
+
+    // the members have until SLAVE_TIMEOUT_MS to reply to the new master
+    uint64_t now = this->loop->timerSystem.getTime();
+    for (size_t i = 0; i < this->slaves.count; ++i)
+        this->slaves.members[i].lastSeenTime = now;
+    this->controlRound = this->standbyControlRound;
+
+    // a round the node aggregates as a slave is dropped, and a master
+    // which has handed over is not waited for
+    if (this->controlWaitResponceTimer.stop() == -1 || this->controlResponseTimer.stop() == -1
+            || this->monitoringMasterTimer.stop() == -1) {
+        logPosition();
+        return -1;
+    }
+    this->controlRoundOpen = false;
+    this->assignedTreeEpoch = 0;
+    this->aggregationChildrenCount = 0;
+    this->isDeputy = false;
+
+    if (this->becomeMaster() == -1) {
+        logPosition();
+        return -1;
     }
     return 0;
 }
 
-#define MESSAGE_BUFFER_SIZE 8192
-unsigned char sendMessageBuffer[MESSAGE_BUFFER_SIZE];
-
-int SelfNode::sendMessage(MessageType type, struct sockaddr_in *peerAddress)
+bool SelfNode::isStandbyComplete()
 {
+    return this->standbyFullySynced
+        && this->standbyPartsCount == this->standbyLastSequence - this->standbySyncBase + 1
+        && this->standbySlaves.count == this->standbyMembersCount;
+}
 
-    switch (type) {
-    case WhoIsMaster:
-        logInfo("\t\tSend WhoIsMaster");
-        break;
-    case IAmMaster:
-        logInfo("\t\tSend IAmMaster");
-        break;
-    case PleaseWait:
-        logInfo("\t\tSend IAmMaster");
-        break;
-    case ControlRequest:
-        logInfo("\t\tSend ControlRequest");
-        break;
-    }
+int SelfNode::broadcastIAmMaster(bool isHeartbeat)
+{
+    uint64_t now = this->loop->timerSystem.getTime();
+    this->lastIAmMasterTime = now;
+    if (!isHeartbeat)
+        ++this->electionStats.iAmMasterSent;
+
+    struct MasterHeartbeatBody body;
+    body.heartbeatIntervalMs = this->heartbeatIntervalMs;
+    body.isHeartbeat = isHeartbeat ? 1 : 0;
+    body.hasDeputy = this->hasDeputy ? 1 : 0;
+    uint64_t masterFor = now - this->masterSinceTime;
+    body.masterForMs = masterFor < INT32_MAX ? (int32_t)masterFor : INT32_MAX;
+    return this->broadcastMessage<IAmMaster>(&body);
+}
 
-    WriteByteStream s;
-    s.openStream(sendMessageBuffer, MESSAGE_BUFFER_SIZE);
-    if (serializeMessage(&s, type, &this->nodeIdentity) == -1) {
-        logError("Error serialize message");
-        logPosition();
-        return -1;
+int SelfNode::replyIAmMaster()
+{
+    if (this->iAmMasterReplyPending) {
+        ++this->electionStats.iAmMasterRepliesCoalesced;
+        return 0;
     }
 
-    size_t size = (size_t)(s.buffer - sendMessageBuffer);
+    uint64_t now = this->loop->timerSystem.getTime();
+    if (now - this->lastIAmMasterTime >= ELECTION_REPLY_HOLDOFF_MS)
+        return this->broadcastIAmMaster(false);
 
-    if (this->net.sendDgram(peerAddress, sendMessageBuffer, size) == -1) {
+    // the IAmMaster just sent may have crossed the message, one more
+    // follows for all that arrive until then
+    ++this->electionStats.iAmMasterRepliesCoalesced;
+    this->iAmMasterReplyPending = true;
+    if (this->iAmMasterReplyTimer.setInterval((int)(this->lastIAmMasterTime + ELECTION_REPLY_HOLDOFF_MS - now)) == -1
+            || this->iAmMasterReplyTimer.start() == -1) {
         logPosition();
         return -1;
     }
-
     return 0;
 }
 
-int SelfNode::broadcastMessage(MessageType type)
+int SelfNode::cancelWhoIsMaster()
 {
-    switch (type) {
-    case WhoIsMaster:
-        logInfo("\t\tBroadcast WhoIsMaster");
-        break;
-    case IAmMaster:
-        logInfo("\t\tBroadcast IAmMaster");
-        break;
-    case PleaseWait:
-        logInfo("\t\tBroadcast IAmMaster");
-        break;
-    case ControlRequest:
-        logInfo("\t\tBroadcast ControlRequest");
-        break;
-    }
-
-    WriteByteStream s;
-    s.openStream(sendMessageBuffer, MESSAGE_BUFFER_SIZE);
-    serializeMessage(&s, type, &this->nodeIdentity);
-
-    size_t size = (size_t)(s.buffer - sendMessageBuffer);
+    if (!this->whoIsMasterPending)
+        return 0;
 
-    if (this->net.broadcastDgram(sendMessageBuffer, size) == -1) {
+    this->whoIsMasterPending = false;
+    ++this->electionStats.whoIsMasterSuppressed;
+    if (this->whoIsMasterBackoffTimer.stop() == -1) {
         logPosition();
         return -1;
     }
+    return 0;
+}
 
+int SelfNode::stopMasterTimers()
+{
+    if (this->state == Master) {
+        logInfo("\t\tStop IAmAlive heartbeet timer");
+        if (this->iAmAliveHeartbeetTimer.stop()) {
+            logPosition();
+            return -1;
+        }
+        logInfo("\t\tStop ControlRequest  timer");
+        if (this->controlRequestTimer.stop()) {
+            logPosition();
+            return -1;
+        }
+        // a round in progress is dropped
+        if (this->controlWaitResponceTimer.stop()) {
+            logPosition();
+            return -1;
+        }
+        this->controlRoundOpen = false;
+        if (this->iAmMasterReplyTimer.stop()) {
+            logPosition();
+            return -1;
+        }
+        this->iAmMasterReplyPending = false;
+    }
     return 0;
 }
 
-int SelfNode::sendMessageWithSensorInfo(sockaddr_in *peerAddress, int luminosity, int temperature)
+template <enum MessageType type>
+int SelfNode::encodeMessage(enum WireVersion version, const typename MessageSchemaOf<type>::Body *body)
 {
-    logInfo("\t\tSend ControlResponse");
+    return this->encodeMessage<type>(version, body, this->sendMessageBuffer, MESSAGE_BUFFER_SIZE);
+}
 
+template <enum MessageType type>
+int SelfNode::encodeMessage(enum WireVersion version, const typename MessageSchemaOf<type>::Body *body,
+                            unsigned char *buffer, size_t bufferSize)
+{
     WriteByteStream s;
-    s.openStream(sendMessageBuffer, MESSAGE_BUFFER_SIZE);
-    if (serializeMessage(&s, ControlResponse, &this->nodeIdentity) == -1) {
+    s.openStream(buffer, bufferSize);
+    if (MessageSchemaOf<type>::encode(&s, version, &this->nodeIdentity, body) == -1) {
         logError("Error serialize message");
         logPosition();
         return -1;
     }
+    return (int)(s.buffer - buffer);
+}
 
-    if (s.writeInt32(luminosity) == -1)
-        return -1;
+template <enum MessageType type>
+int SelfNode::sendMessage(struct NodeDescriptor *peer, const typename MessageSchemaOf<type>::Body *body)
+{
+    if (isLogInfoEnabled()) {
+        char text[64];
+        snprintf(text, sizeof(text), "\t\tSend %s", MessageSchemaOf<type>::name());
+        logInfo(text);
+    }
 
-    if (s.writeInt32(temperature) == -1)
+    int size = this->encodeMessage<type>(peer->wireVersion, body);
+    if (size == -1) {
+        logPosition();
         return -1;
+    }
 
-    size_t size = (size_t)(s.buffer - sendMessageBuffer);
-
-    if (this->net.sendDgram(peerAddress, sendMessageBuffer, size) == -1) {
+    if (this->net.sendDgram(&peer->peerAddress, this->sendMessageBuffer, size) == -1) {
         logPosition();
         return -1;
     }
@@ -427,27 +658,29 @@ int SelfNode::sendMessageWithSensorInfo(sockaddr_in *peerAddress, int luminosity
     return 0;
 }
 
-int SelfNode::sendMessageWithDisplayInfo(int brightness, char *displayText, size_t textLength)
+template <enum MessageType type>
+int SelfNode::sendMessage(struct NodeDescriptor *peer)
 {
-    logInfo("\t\tSend ControlSet");
+    struct EmptyBody body;
+    return this->sendMessage<type>(peer, &body);
+}
 
-    WriteByteStream s;
-    s.openStream(sendMessageBuffer, MESSAGE_BUFFER_SIZE);
-    if (serializeMessage(&s, ControlSet, &this->nodeIdentity) == -1) {
-        logError("Error serialize message");
-        logPosition();
-        return -1;
+template <enum MessageType type>
+int SelfNode::broadcastMessage(const typename MessageSchemaOf<type>::Body *body)
+{
+    if (isLogInfoEnabled()) {
+        char text[64];
+        snprintf(text, sizeof(text), "\t\tBroadcast %s", MessageSchemaOf<type>::name());
+        logInfo(text);
     }
 
-    if (s.writeInt32(brightness) == -1)
-        return -1;
-
-    if (s.writeBytes((unsigned char*)displayText, textLength) == -1)
+    int size = this->encodeMessage<type>(this->getBroadcastWireVersion(), body);
+    if (size == -1) {
+        logPosition();
         return -1;
+    }
 
-    size_t size = (size_t)(s.buffer - sendMessageBuffer);
-
-    if (this->net.broadcastDgram(sendMessageBuffer, size) == -1) {
+    if (this->net.broadcastDgram(this->sendMessageBuffer, size) == -1) {
         logPosition();
         return -1;
     }
@@ -455,32 +688,56 @@ int SelfNode::sendMessageWithDisplayInfo(int brightness, char *displayText, size
     return 0;
 }
 
-int SelfNode::compareWithSelf(NodeIdentity *senderId)
+template <enum MessageType type>
+int SelfNode::broadcastMessage()
 {
-    return NodeIdentity::compareNodeIdentities(senderId, &this->nodeIdentity);
+    struct EmptyBody body;
+    return this->broadcastMessage<type>(&body);
 }
 
-int SelfNode::compareWithCurrentMaster(NodeIdentity *senderId)
+// Children are sent in the format of the node, the tree only takes in
+// nodes which have replied in v2. The message is encoded once for all.
+template <enum MessageType type>
+int SelfNode::sendToAggregationChildren(const typename MessageSchemaOf<type>::Body *body)
 {
-    return NodeIdentity::compareNodeIdentities(senderId, &this->myMaster.id);
-}
+    int size = this->encodeMessage<type>(this->wireVersion, body);
+    if (size == -1) {
+        logPosition();
+        return -1;
+    }
 
-void logMessageReceived(MessageType type)
-{
-    switch (type) {
-    case WhoIsMaster:
-        logInfo("WhoIsMaster received");
-        break;
-    case IAmMaster:
-        logInfo("IAmMaster received");
-        break;
-    case PleaseWait:
-        logInfo("IAmMaster received");
-        break;
-    case ControlRequest:
-        logInfo("ControlRequest received");
-        break;
+    struct SendBatch batch;
+    batch.init(&this->net);
+    for (size_t i = 0; i < this->aggregationChildrenCount; ++i) {
+        if (batch.add(&this->aggregationChildren[i], this->sendMessageBuffer, size) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    if (batch.flush() == -1) {
+        logPosition();
+        return -1;
     }
+    return 0;
+}
+
+// Nodes which only know v1 could not hear v2 broadcasts
+enum WireVersion SelfNode::getBroadcastWireVersion()
+{
+    if (this->wireVersion == WireV2 && this->v1MessageReceived
+            && this->loop->timerSystem.getTime() - this->lastV1MessageTime < WIRE_V1_FALLBACK_MS)
+        return WireV1;
+    return this->wireVersion;
+}
+
+int SelfNode::compareWithSelf(NodeIdentity *senderId)
+{
+    return NodeIdentity::compareNodeIdentities(senderId, &this->nodeIdentity);
+}
+
+int SelfNode::compareWithCurrentMaster(NodeIdentity *senderId)
+{
+    return NodeIdentity::compareNodeIdentities(senderId, &this->myMaster.id);
 }
 
 void logState(NodeState state)
@@ -500,68 +757,63 @@ void logState(NodeState state)
     }
 }
 
-void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender)
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct EmptyBody *body, struct RecvBuffer *buffer)
 {
     struct NodeIdentity *senderId = &sender->id;
-    struct sockaddr_in *senderAddress = &sender->peerAddress;
 
-    logInfo("Message received from ");
-    printNodeDescriptor(sender);
-
-    logMessageReceived(type);
     logState(this->state);
 
+    ++this->electionStats.messagesReceived;
+
     switch (type) {
     case WhoIsMaster:
         if (this->state == Master) {
+            // a lower node joins and is replied to
             if (this->compareWithSelf(senderId) < 0) {
-                if (this->broadcastMessage(IAmMaster) == -1) {
+                if (this->replyIAmMaster() == -1) {
                     logPosition();
                     return;
                 }
+                break;
             }
-            else {
-                logInfo("\t\tBroadcast WhoIsMaster");
-                if (this->broadcastMessage(WhoIsMaster)) {
-                    logPosition();
-                    return;
-                }
-                if (this->becomeWithoutMaster() == -1) {
-                    logPosition();
-                    return;
-                }
+            ++this->electionStats.whoIsMasterSent;
+            if (this->broadcastMessage<WhoIsMaster>() == -1) {
+                logPosition();
+                return;
             }
-        }
-        else {
-            if (this->compareWithSelf(senderId) < 0) {
-                if (this->sendMessage(PleaseWait, senderAddress) == -1) {
-                    logPosition();
-                    return;
-                }
+            if (this->becomeWithoutMaster() == -1) {
+                logPosition();
+                return;
             }
-            break;
+            // and goes on as for an IAmMaster of the sender
+            struct MasterHeartbeatBody reply;
+            reply.heartbeatIntervalMs = this->heartbeatIntervalMs;
+            reply.isHeartbeat = 0;
+            reply.hasDeputy = 0;
+            reply.masterForMs = 0;
+            this->onIAmMaster(sender, &reply);
         }
-    case IAmMaster:
-        if (this->compareWithSelf(senderId) < 0) {
-            if (this->state == Master) {
-                if (this->broadcastMessage(IAmMaster)) {
+        // slaves leave the reply to their master, and a node waiting for
+        // a higher one to it
+        else if (this->state == WithoutMaster && !this->waitingForMaster) {
+            int order = this->compareWithSelf(senderId);
+            if (order < 0) {
+                ++this->electionStats.pleaseWaitSent;
+                if (this->sendMessage<PleaseWait>(sender) == -1) {
                     logPosition();
                     return;
                 }
             }
-            else {
-                if (this->sendMessage(PleaseWait, senderAddress) == -1) {
+            // a higher node is looking for the master, which is not this
+            // one, so it waits without a WhoIsMaster of its own
+            else if (order > 0) {
+                if (this->becomeWaitingForMaster() == -1) {
                     logPosition();
                     return;
                 }
             }
         }
-        else {
-            if (this->becomeSlave(sender) == -1) {
-                logPosition();
-                return;
-            }
-        }
         break;
     case PleaseWait:
         if (this->state == Slave) {
@@ -581,37 +833,465 @@ void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender
             }
         }
         break;
+    default:
+        break;
+    }
+}
 
-    case ControlRequest:
-        if (this->state == Slave) {
-            if (this->sendMessageWithSensorInfo(&sender->peerAddress, this->luminosity, this->temperature) == -1) {
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct MasterHeartbeatBody *body, struct RecvBuffer *buffer)
+{
+    if (!body->isHeartbeat)
+        ++this->electionStats.messagesReceived;
+    this->onIAmMaster(sender, body);
+}
+
+void SelfNode::onIAmMaster(struct NodeDescriptor *sender, const struct MasterHeartbeatBody *body)
+{
+    if (this->hasAbdicatedMaster) {
+        if (NodeIdentity::compareNodeIdentities(&sender->id, &this->abdicatedMaster) == 0)
+            return;
+        // what the abdicated master sent before its Abdication has
+        // arrived by then, and the same identity may come back after a
+        // restart
+        if (body->isHeartbeat)
+            this->hasAbdicatedMaster = false;
+    }
+
+    if (this->compareWithSelf(&sender->id) < 0) {
+        if (this->state == Master) {
+            // a lower master, as after a healed partition, is answered at
+            // once and yields to the reply
+            if (this->getSplitBrainDuration(body) > 0) {
+                ++this->splitBrainStats.competingMastersHeard;
+                logInfo("\033[1;31mCompeting master\033[0m");
+            }
+            if (this->replyIAmMaster() == -1) {
                 logPosition();
                 return;
             }
         }
-        break;
+        // as for WhoIsMaster, slaves and nodes waiting for a master leave
+        // a lower master to theirs
+        else if (this->state == WithoutMaster && !this->waitingForMaster) {
+            ++this->electionStats.pleaseWaitSent;
+            if (this->sendMessage<PleaseWait>(sender) == -1) {
+                logPosition();
+                return;
+            }
+        }
+    }
+    else if (this->state == Master) {
+        if (this->yieldToMaster(sender, body) == -1) {
+            logPosition();
+            return;
+        }
+    }
+    else {
+        if (this->becomeSlave(sender, body) == -1) {
+            logPosition();
+            return;
+        }
+    }
+}
+
+int SelfNode::yieldToMaster(struct NodeDescriptor *master, const struct MasterHeartbeatBody *heartbeat)
+{
+    uint64_t duration = this->getSplitBrainDuration(heartbeat);
+    if (duration == 0) {
+        ++this->splitBrainStats.collisionsCount;
+    }
+    else {
+        ++this->splitBrainStats.competingMastersHeard;
+        ++this->splitBrainStats.yieldsCount;
+        this->splitBrainStats.lastDuration = duration;
+        this->splitBrainStats.totalDuration += duration;
+        if (duration > this->splitBrainStats.maxDuration)
+            this->splitBrainStats.maxDuration = duration;
+        if (isLogInfoEnabled()) {
+            printf("\033[1;31mSplit brain of %llu ms, yield\n\033[0m", (unsigned long long)duration);
+        }
+    }
+
+    if (this->becomeSlave(master, heartbeat) == -1) {
+        logPosition();
+        return -1;
+    }
+    // the membership is still the master's one, the winner gets it rather
+    // than waiting for the members to reply to its control requests
+    if (this->sendMembershipMerge(master) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t SelfNode::getSplitBrainDuration(const struct MasterHeartbeatBody *heartbeat)
+{
+    // both masters have been live since the later of them took over,
+    // masters which predate masterForMs only tell their own term
+    uint64_t duration = this->loop->timerSystem.getTime() - this->masterSinceTime;
+    if (heartbeat->masterForMs > 0 && (uint64_t)heartbeat->masterForMs < duration)
+        duration = (uint64_t)heartbeat->masterForMs;
+    return duration >= (uint64_t)this->heartbeatIntervalMs ? duration : 0;
+}
+
+int SelfNode::sendMembershipMerge(struct NodeDescriptor *master)
+{
+    unsigned char members[DEPUTY_SYNC_MEMBERS_PER_MESSAGE * DEPUTY_MEMBER_SIZE];
+
+    struct MembershipMergeBody merge;
+    merge.members = members;
+
+    // the sender itself is a member as well, an empty part tells it
+    size_t first = 0;
+    do {
+        size_t count = this->slaves.count - first;
+        if (count > DEPUTY_SYNC_MEMBERS_PER_MESSAGE)
+            count = DEPUTY_SYNC_MEMBERS_PER_MESSAGE;
+
+        for (size_t i = 0; i < count; ++i) {
+            struct Member *member = &this->slaves.members[first + i];
+            storeMemberRecord(members + i * DEPUTY_MEMBER_SIZE, &member->id, &member->address);
+        }
+        merge.membersSize = count * DEPUTY_MEMBER_SIZE;
+        if (this->sendMessage<MembershipMerge>(master, &merge) == -1) {
+            logPosition();
+            return -1;
+        }
+        first += count;
+    } while (first < this->slaves.count);
+    return 0;
+}
+
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct ControlRequestBody *body, struct RecvBuffer *buffer)
+{
+    if (this->state != Slave)
+        return;
+
+    // a slave of the tree under an aggregator waits for the request
+    // passed down by it
+    bool inTree = body->treeEpoch != 0 && (uint32_t)body->treeEpoch == this->assignedTreeEpoch;
+    if (inTree && this->underAggregator && this->compareWithCurrentMaster(&sender->id) == 0)
+        return;
+
+    this->controlResponsePeer = *sender;
+
+    if (inTree && this->aggregationChildrenCount > 0) {
+        this->openAggregationRound(body->treeEpoch);
+        return;
+    }
+
+    // the slot of a slave is the same in every round, slaves are spread
+    // evenly over the window by the hash of their identities
+    int delay = 0;
+    if (body->responseWindowMs > 0)
+        delay = (int)(MembershipTable::hashIdentity(&this->nodeIdentity) % (uint32_t)body->responseWindowMs);
+
+    if (delay == 0) {
+        this->onControlResponseTimeout();
+        return;
+    }
+
+    // a new request before the slot replaces the pending reply
+    if (this->controlResponseTimer.setInterval(delay) == -1) {
+        logPosition();
+        return;
+    }
+    if (this->controlResponseTimer.start() == -1) {
+        logPosition();
+        return;
+    }
+}
+
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct SensorsInfoBody *body, struct RecvBuffer *buffer)
+{
+    bool isFirstReply;
+    long position = this->recordControlReply(sender, &isFirstReply);
+    if (position == -1) {
+        logPosition();
+        return;
+    }
+
+    struct MemberSample *sample = &this->slaves.samples[position];
+    sample->luminosity = body->luminosity;
+    sample->temperature = body->temperature;
+
+    if (isFirstReply) {
+        this->luminosityAggregate.add(body->luminosity);
+        this->temperatureAggregate.add(body->temperature);
+        this->countControlReplies(1);
+    }
+
+    // a slave of an aggregator replying directly has missed its assignment
+    if (this->state == Master && !this->aggregationTreeDirty && !this->isDirectSlave(position)) {
+        if (this->sendAggregationAssign(this->slaves.members[position].treeIndex - 1) == -1) {
+            logPosition();
+            return;
+        }
+    }
+}
+
+// The sample of an aggregator is the mean of its subtree
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct SensorsSummaryBody *body, struct RecvBuffer *buffer)
+{
+    if (body->count <= 0)
+        return;
+
+    bool isFirstReply;
+    long position = this->recordControlReply(sender, &isFirstReply);
+    if (position == -1) {
+        logPosition();
+        return;
+    }
+
+    struct MemberSample *sample = &this->slaves.samples[position];
+    sample->luminosity = (int32_t)(body->luminositySum / body->count);
+    sample->temperature = (int32_t)(body->temperatureSum / body->count);
+
+    if (!isFirstReply)
+        return;
+
+    this->luminosityAggregate.merge(body->count, body->luminositySum, body->luminosityM2,
+                                    body->luminosityMin, body->luminosityMax);
+    this->temperatureAggregate.merge(body->count, body->temperatureSum, body->temperatureM2,
+                                     body->temperatureMin, body->temperatureMax);
+
+    // a complete subtree is alive; slaves missing from a summary age out
+    // and join again directly. The tree may wait for its rebuild after
+    // slaves have been removed and others moved, so they are looked up.
+    uint32_t treeIndex = this->slaves.members[position].treeIndex;
+    if (this->state == Master && treeIndex != 0
+            && (uint32_t)body->count == this->aggregationTree.nodes[treeIndex - 1].subtreeSize) {
+        uint64_t now = this->loop->timerSystem.getTime();
+        for (uint32_t i = treeIndex; i < treeIndex - 1 + body->count; ++i) {
+            long descendant = this->slaves.find(&this->aggregationTree.nodes[i].id);
+            if (descendant != -1)
+                this->slaves.members[descendant].lastSeenTime = now;
+        }
+    }
+
+    this->countControlReplies(body->count);
+}
+
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct AggregationAssignBody *body, struct RecvBuffer *buffer)
+{
+    if (this->state != Slave || this->compareWithCurrentMaster(&sender->id) != 0)
+        return;
+
+    size_t childrenCount = body->childrenSize / AGGREGATION_CHILD_SIZE;
+    if (childrenCount > this->aggregationChildrenCapacity) {
+        struct sockaddr_in *children = (struct sockaddr_in *)realloc(this->aggregationChildren, childrenCount * sizeof(struct sockaddr_in));
+        if (children == NULL) {
+            logPosition();
+            return;
+        }
+        this->aggregationChildren = children;
+        this->aggregationChildrenCapacity = childrenCount;
+    }
+
+    for (size_t i = 0; i < childrenCount; ++i) {
+        const unsigned char *child = body->children + i * AGGREGATION_CHILD_SIZE;
+        struct sockaddr_in *address = &this->aggregationChildren[i];
+        memset(address, 0, sizeof(struct sockaddr_in));
+        address->sin_family = AF_INET;
+        memcpy(&address->sin_addr.s_addr, child, 4);
+        memcpy(&address->sin_port, child + 4, 2);
+    }
+    this->aggregationChildrenCount = childrenCount;
+    this->assignedTreeEpoch = body->treeEpoch;
+    this->underAggregator = body->underAggregator != 0;
+    this->aggregationCollectMs = body->collectMs;
+    this->aggregationDescendantsCount = body->descendantsCount > 0 ? body->descendantsCount : 0;
+}
+
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct DeputySyncBody *body, struct RecvBuffer *buffer)
+{
+    if (this->state != Slave || this->compareWithCurrentMaster(&sender->id) != 0)
+        return;
+
+    if (!body->isDeputy) {
+        this->isDeputy = false;
+        this->standbySlaves.clear();
+        return;
+    }
+
+    // a newer full sync starts over, parts of an earlier one are late;
+    // the parts of a sync may arrive in any order, a missed one leaves
+    // the copy incomplete until the next full sync
+    uint32_t sequence = (uint32_t)body->sequence;
+    if (!this->isDeputy)
+        this->standbyFullySynced = false;
+    if (body->firstMember >= 0) {
+        uint32_t base = sequence - (uint32_t)(body->firstMember / DEPUTY_SYNC_MEMBERS_PER_MESSAGE);
+        if (!this->standbyFullySynced || (int32_t)(base - this->standbySyncBase) > 0) {
+            this->standbySlaves.clear();
+            this->standbyFullySynced = true;
+            this->standbySyncBase = base;
+            this->standbyPartsCount = 0;
+        }
+    }
+    if (this->standbyFullySynced && (int32_t)(sequence - this->standbySyncBase) < 0)
+        return;
+    this->isDeputy = true;
+    if (this->standbyPartsCount++ == 0 || (int32_t)(sequence - this->standbyLastSequence) > 0) {
+        this->standbyLastSequence = sequence;
+        this->standbyControlRound = (uint32_t)body->controlRound;
+        this->standbyMembersCount = body->membersCount > 0 ? body->membersCount : 0;
+    }
+
+    size_t count = body->membersSize / DEPUTY_MEMBER_SIZE;
+    size_t leftCount = body->firstMember == -1 && body->leftCount > 0 ? body->leftCount : 0;
+    for (size_t i = 0; i < count; ++i) {
+        struct NodeIdentity id;
+        struct sockaddr_in address;
+        loadMemberRecord(body->members + i * DEPUTY_MEMBER_SIZE, &id, &address);
+
+        if (i < leftCount) {
+            this->standbySlaves.remove(&id);
+            continue;
+        }
+        long position = this->standbySlaves.findOrAdd(&id);
+        if (position == -1) {
+            logPosition();
+            return;
+        }
+        this->standbySlaves.members[position].address = address;
     }
 }
 
-void SelfNode::onSensorsInfoReceived(NodeDescriptor *sender, int luminosity, int temperature)
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct AbdicationBody *body, struct RecvBuffer *buffer)
 {
-    if (this->clientsCount == CLIENTS_MAX_COUNT - 1) {
+    if (this->state != Slave || this->compareWithCurrentMaster(&sender->id) != 0
+            || body->successorSize < DEPUTY_MEMBER_SIZE)
+        return;
+
+    struct NodeDescriptor successor;
+    loadMemberRecord(body->successor, &successor.id, &successor.peerAddress);
+    successor.wireVersion = sender->wireVersion;
+    this->abdicatedMaster = sender->id;
+    this->hasAbdicatedMaster = true;
+
+    int order = this->compareWithSelf(&successor.id);
+    if (order == 0) {
+        this->standbyControlRound = (uint32_t)body->controlRound;
+        if (this->takeOverAsDeputy() == -1) {
+            logPosition();
+        }
+        return;
+    }
+    // a node the master did not know of would win against the successor,
+    // it waits for the failure detector and an election
+    if (order < 0)
+        return;
+
+    // the successor's IAmMaster would do the same, a round trip later
+    struct MasterHeartbeatBody heartbeat;
+    heartbeat.heartbeatIntervalMs = this->heartbeatIntervalMs;
+    heartbeat.isHeartbeat = 0;
+    heartbeat.hasDeputy = 0;
+    heartbeat.masterForMs = 0;
+    if (this->becomeSlave(&successor, &heartbeat) == -1) {
+        logPosition();
+    }
+}
+
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct MembershipMergeBody *body, struct RecvBuffer *buffer)
+{
+    if (this->state != Master)
+        return;
+
+    uint64_t now = this->loop->timerSystem.getTime();
+    long position = this->slaves.findOrAdd(&sender->id);
+    if (position == -1) {
         logPosition();
         return;
     }
+    this->slaves.members[position].address = sender->peerAddress;
+    this->slaves.members[position].lastSeenTime = now;
+    this->slaves.members[position].wireVersion = (uint8_t)sender->wireVersion;
+
+    size_t count = body->membersSize / DEPUTY_MEMBER_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        struct NodeIdentity id;
+        struct sockaddr_in address;
+        loadMemberRecord(body->members + i * DEPUTY_MEMBER_SIZE, &id, &address);
+        if (this->compareWithSelf(&id) == 0)
+            continue;
+
+        position = this->slaves.findOrAdd(&id);
+        if (position == -1) {
+            logPosition();
+            return;
+        }
+        this->slaves.members[position].address = address;
+        this->slaves.members[position].lastSeenTime = now;
+    }
+    this->aggregationTreeDirty = true;
+}
+
+long SelfNode::recordControlReply(struct NodeDescriptor *sender, bool *isFirstReply)
+{
+    long position = this->slaves.findOrAdd(&sender->id);
+    if (position == -1) {
+        logPosition();
+        return -1;
+    }
 
-    SensorInfo *sensorInfo = &this->receivedSensorsInfo[this->clientsCount];
-    sensorInfo->luminosity = luminosity;
-    sensorInfo->temperature = temperature;
-    ++this->clientsCount;
+    struct Member *member = &this->slaves.members[position];
+    member->address = sender->peerAddress;
+    member->lastSeenTime = this->loop->timerSystem.getTime();
+    // a node restarted with another format leaves its place in the tree
+    if (member->wireVersion != sender->wireVersion && member->treeIndex != 0)
+        this->aggregationTreeDirty = true;
+    member->wireVersion = (uint8_t)sender->wireVersion;
+
+    // the first reply of a slave in an open round is aggregated, a
+    // duplicate only updates the sample
+    struct MemberSample *sample = &this->slaves.samples[position];
+    *isFirstReply = this->controlRoundOpen && sample->round != this->controlRound;
+    sample->round = this->controlRound;
+    return position;
 }
 
-void SelfNode::onDisplayInfoReceived(NodeDescriptor *sender, int brightness, char *displayText, size_t textLength)
+void SelfNode::countControlReplies(size_t count)
 {
-    logInfo("Display info received");
-    this->brightness = brightness;
-    strncpy(this->displayText, displayText, textLength);
+    this->controlRoundResponsesCount += count;
+
+    // the deadline is only left for stragglers
+    if (this->controlRoundQuorum > 0 && this->controlRoundResponsesCount >= this->controlRoundQuorum) {
+        if (this->controlWaitResponceTimer.stop() == -1) {
+            logPosition();
+            return;
+        }
+        if (this->state == Master)
+            ++this->roundStats.quorumRoundsCount;
+        this->closeControlRound();
+    }
+}
+
+void SelfNode::onMessageReceived(MessageType type, struct NodeDescriptor *sender,
+                                 const struct DisplayInfoBody *body, struct RecvBuffer *buffer)
+{
+    this->brightness = body->brightness;
+    // the text is shown from the receive buffer, without a copy
+    this->setShownText(body->text, body->textLength, buffer);
     this->displayInfo();
+
+    if (this->state == Slave && this->forwardControlSet) {
+        this->forwardControlSet = false;
+        if (this->sendToAggregationChildren<ControlSet>(body) == -1) {
+            logPosition();
+            return;
+        }
+    }
 }
 
 void SelfNode::onWhoIsMasterTimeout()
@@ -622,6 +1302,24 @@ void SelfNode::onWhoIsMasterTimeout()
     }
 }
 
+void SelfNode::onWhoIsMasterBackoffTimeout()
+{
+    logInfo("\033[0;32mWhoIsMaster backoff timeout\033[0m");
+    this->whoIsMasterPending = false;
+    ++this->electionStats.whoIsMasterSent;
+    if (this->broadcastMessage<WhoIsMaster>() == -1) {
+        logPosition();
+    }
+}
+
+void SelfNode::onIAmMasterReplyTimeout()
+{
+    this->iAmMasterReplyPending = false;
+    if (this->state == Master && this->broadcastIAmMaster(false) == -1) {
+        logPosition();
+    }
+}
+
 void SelfNode::onWaitForMasterTimeout()
 {
     logInfo("\033[0;32mWaitForMaster timeout\033[0m");
@@ -633,7 +1331,19 @@ void SelfNode::onWaitForMasterTimeout()
 void SelfNode::onMonitoringMasterTimeout()
 {
     logInfo("\033[0;32mMonitoringMaster timeout\033[0m");
-    if (this->becomeWithoutMaster() == -1) {
+    if (this->state == Slave && this->isDeputy) {
+        if (this->takeOverAsDeputy() == -1) {
+            logPosition();
+        }
+    }
+    // the deputy suspects the master about as soon, its IAmMaster is
+    // waited for rather than an election started
+    else if (this->state == Slave && this->masterHasDeputy) {
+        if (this->becomeWaitingForMaster() == -1) {
+            logPosition();
+        }
+    }
+    else if (this->becomeWithoutMaster() == -1) {
         logPosition();
     }
 }
@@ -642,8 +1352,9 @@ void SelfNode::onIAmAliveHeartbeetTimeout()
 {
     logInfo("\033[0;32mMasterAlive timeout\033[0m");
     if (this->state == Master) {
-        logInfo("\t\tBroadcast IAmMaster");
-        this->broadcastMessage(IAmMaster);
+        // nothing sent before the handover is in flight any more
+        this->hasAbdicatedMaster = false;
+        this->broadcastIAmMaster(true);
     }
     else {
         logError("Error: Master Heartbeet timer is not stopped!!");
@@ -654,49 +1365,546 @@ void SelfNode::onControlRequestTimeoutHandler()
 {
     logInfo("\033[0;32mControlRequest timeout\033[0m");
 
-    this->clientsCount = 0;
+    // 0 is the round of no sample
+    if (++this->controlRound == 0)
+        this->controlRound = 1;
+
+    uint64_t now = this->loop->timerSystem.getTime();
+    if (now > SLAVE_TIMEOUT_MS && this->slaves.removeNotSeenSince(now - SLAVE_TIMEOUT_MS) > 0)
+        this->aggregationTreeDirty = true;
+
+    // the master's own sensors count as one more sample
+    this->luminosityAggregate.reset();
+    this->temperatureAggregate.reset();
+    this->luminosityAggregate.add(this->luminosity);
+    this->temperatureAggregate.add(this->temperature);
+    this->controlRoundOpen = true;
+    this->controlRoundStartTime = now;
+    this->controlRoundResponsesCount = 0;
+    // without known slaves the round waits for the deadline to find them
+    this->controlRoundQuorum = (size_t)ceil(this->roundQuorum * this->slaves.count);
+
+    struct ControlRequestBody request;
+    request.responseWindowMs = this->getControlResponseWindow(this->getDirectSlavesCount(false));
+    request.treeEpoch = this->aggregationTree.epoch;
+    if (this->broadcastMessage<ControlRequest>(&request) == -1) {
+        logPosition();
+        return;
+    }
+
+    // an aggregator's round may have set it shorter
+    if (this->controlWaitResponceTimer.setInterval(CONTROL_WAIT_RESPONSE_MS) == -1) {
+        logPosition();
+        return;
+    }
+    if (this->controlWaitResponceTimer.start() == -1) {
+        logPosition();
+        return;
+    }
+}
+
+// Responses arrive at about CONTROL_RESPONSES_PER_SECOND over the window
+// rather than all at once. Slaves not known yet reply at once.
+int SelfNode::getControlResponseWindow(size_t repliesCount)
+{
+    size_t window = repliesCount * 1000 / CONTROL_RESPONSES_PER_SECOND;
+    if (window > CONTROL_RESPONSE_MAX_WINDOW_MS)
+        window = CONTROL_RESPONSE_MAX_WINDOW_MS;
+    return (int)window;
+}
+
+bool SelfNode::isDirectSlave(size_t position)
+{
+    uint32_t treeIndex = this->slaves.members[position].treeIndex;
+    return this->aggregationTree.epoch == 0 || treeIndex == 0
+        || this->aggregationTree.nodes[treeIndex - 1].parent == -1;
+}
+
+size_t SelfNode::getDirectSlavesCount(bool assignableOnly)
+{
+    if (this->aggregationTree.epoch == 0 && !assignableOnly)
+        return this->slaves.count;
+
+    size_t count = 0;
+    for (size_t i = 0; i < this->slaves.count; ++i) {
+        if (assignableOnly && this->slaves.members[i].wireVersion < WireV2)
+            continue;
+        if (this->isDirectSlave(i))
+            ++count;
+    }
+    return count;
+}
+
+// Members not heard from yet are sent as the node itself
+enum WireVersion SelfNode::getMemberWireVersion(size_t position)
+{
+    if (this->slaves.members[position].wireVersion == WireV1)
+        return WireV1;
+    return this->wireVersion;
+}
+
+int SelfNode::rebuildAggregationTree()
+{
+    if (this->aggregationTree.build(&this->slaves) == -1) {
+        logPosition();
+        return -1;
+    }
+    this->aggregationTreeDirty = false;
+    this->nextTreeRebuildTime = this->loop->timerSystem.getTime() + AGGREGATION_REBUILD_INTERVAL_MS;
+
+    for (size_t i = 0; i < this->aggregationTree.count; ++i) {
+        if (this->sendAggregationAssign(i) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Subtrees close their rounds by their height, the lowest first, so that
+// the summaries reach the master before its deadline
+int SelfNode::sendAggregationAssign(size_t index)
+{
+    struct AggregationTree *tree = &this->aggregationTree;
+    struct AggregationTreeNode *node = &tree->nodes[index];
+
+    unsigned char children[AGGREGATION_MAX_DEGREE * AGGREGATION_CHILD_SIZE];
+    size_t childrenCount = tree->getChildrenCount(index);
+    for (size_t i = 0; i < childrenCount; ++i) {
+        struct sockaddr_in *address = &this->slaves.members[tree->nodes[tree->getChild(index, i)].position].address;
+        memcpy(children + i * AGGREGATION_CHILD_SIZE, &address->sin_addr.s_addr, 4);
+        memcpy(children + i * AGGREGATION_CHILD_SIZE + 4, &address->sin_port, 2);
+    }
+
+    struct AggregationAssignBody assign;
+    assign.treeEpoch = tree->epoch;
+    assign.underAggregator = node->parent != -1;
+    assign.collectMs = CONTROL_WAIT_RESPONSE_MS * node->height / (tree->height + 1);
+    assign.descendantsCount = node->subtreeSize - 1;
+    assign.children = children;
+    assign.childrenSize = childrenCount * AGGREGATION_CHILD_SIZE;
+
+    struct NodeDescriptor peer;
+    peer.peerAddress = this->slaves.members[node->position].address;
+    peer.id = node->id;
+    peer.wireVersion = this->getMemberWireVersion(node->position);
+    return this->sendMessage<AggregationAssign>(&peer, &assign);
+}
 
-    if (this->broadcastMessage(ControlRequest) == -1) {
+// The subtree's round is the master's round on a smaller scale, its
+// summary goes to the parent when it closes
+void SelfNode::openAggregationRound(uint32_t treeEpoch)
+{
+    if (++this->controlRound == 0)
+        this->controlRound = 1;
+
+    uint64_t now = this->loop->timerSystem.getTime();
+    if (now > SLAVE_TIMEOUT_MS)
+        this->slaves.removeNotSeenSince(now - SLAVE_TIMEOUT_MS);
+
+    this->luminosityAggregate.reset();
+    this->temperatureAggregate.reset();
+    this->luminosityAggregate.add(this->luminosity);
+    this->temperatureAggregate.add(this->temperature);
+    this->controlRoundOpen = true;
+    this->controlRoundStartTime = now;
+    this->controlRoundResponsesCount = 0;
+    this->controlRoundQuorum = (size_t)ceil(this->roundQuorum * this->aggregationDescendantsCount);
+    this->forwardControlSet = true;
+
+    struct ControlRequestBody request;
+    request.responseWindowMs = this->getControlResponseWindow(this->aggregationChildrenCount);
+    request.treeEpoch = treeEpoch;
+    if (this->sendToAggregationChildren<ControlRequest>(&request) == -1) {
         logPosition();
         return;
     }
 
+    if (this->controlWaitResponceTimer.setInterval(this->aggregationCollectMs) == -1) {
+        logPosition();
+        return;
+    }
     if (this->controlWaitResponceTimer.start() == -1) {
         logPosition();
         return;
     }
 }
 
+void SelfNode::sendControlSummary()
+{
+    struct SensorsSummaryBody summary;
+    summary.count = (int32_t)this->luminosityAggregate.count;
+    summary.luminositySum = this->luminosityAggregate.sum;
+    summary.luminosityM2 = llround(this->luminosityAggregate.m2);
+    summary.luminosityMin = this->luminosityAggregate.min;
+    summary.luminosityMax = this->luminosityAggregate.max;
+    summary.temperatureSum = this->temperatureAggregate.sum;
+    summary.temperatureM2 = llround(this->temperatureAggregate.m2);
+    summary.temperatureMin = this->temperatureAggregate.min;
+    summary.temperatureMax = this->temperatureAggregate.max;
+    if (this->sendMessage<ControlSummary>(&this->controlResponsePeer, &summary) == -1) {
+        logPosition();
+        return;
+    }
+}
+
+// Encoded once per wire version, the node's own first
+int SelfNode::sendControlSetToDirectSlaves(const struct DisplayInfoBody *body)
+{
+    enum WireVersion versions[] = { this->wireVersion, WireV1 };
+    size_t versionsCount = this->wireVersion == WireV1 ? 1 : 2;
+
+    struct SendBatch batch;
+    batch.init(&this->net);
+    for (size_t v = 0; v < versionsCount; ++v) {
+        int size = -1;
+        for (size_t i = 0; i < this->slaves.count; ++i) {
+            if (!this->isDirectSlave(i) || this->getMemberWireVersion(i) != versions[v])
+                continue;
+            if (size == -1) {
+                size = this->encodeMessage<ControlSet>(versions[v], body);
+                if (size == -1) {
+                    logPosition();
+                    return -1;
+                }
+            }
+            if (batch.add(&this->slaves.members[i].address, this->sendMessageBuffer, size) == -1) {
+                logPosition();
+                return -1;
+            }
+        }
+        // the next version is encoded over the same buffer
+        if (batch.flush() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void SelfNode::onControlResponseTimeout()
+{
+    // the node may have left its master meanwhile
+    if (this->state != Slave)
+        return;
+
+    struct SensorsInfoBody sensorsInfo;
+    sensorsInfo.luminosity = this->luminosity;
+    sensorsInfo.temperature = this->temperature;
+    if (this->sendMessage<ControlResponse>(&this->controlResponsePeer, &sensorsInfo) == -1) {
+        logPosition();
+        return;
+    }
+}
+
 void SelfNode::onControlWaitResponceTimeoutHandler()
 {
     logInfo("\033[0;32mControlWaitResponce timeout\033[0m");
+    this->closeControlRound();
+}
 
-    if (this->clientsCount == 0) {
-        logInfo("\tReceived sensors info is empty");
+void SelfNode::closeControlRound()
+{
+    // the aggregates are up to date with every reply of the round
+    this->controlRoundOpen = false;
+
+    if (this->state != Master) {
+        if (this->state == Slave)
+            this->sendControlSummary();
+        return;
     }
 
-    int meanTemperature = this->temperature;
-    int meanLuminosity = this->luminosity;
+    uint64_t latency = this->loop->timerSystem.getTime() - this->controlRoundStartTime;
+    ++this->roundStats.roundsCount;
+    this->roundStats.lastLatency = latency;
+    this->roundStats.totalLatency += latency;
+    if (latency > this->roundStats.maxLatency)
+        this->roundStats.maxLatency = latency;
 
-    for(int i = 0; i < this->clientsCount; ++i) {
-        meanLuminosity += this->receivedSensorsInfo[i].luminosity;
-        meanTemperature += this->receivedSensorsInfo[i].temperature;
+    if (this->luminosityAggregate.count == 1) {
+        logInfo("\tReceived sensors info is empty");
     }
-    meanLuminosity /= this->clientsCount + 1;
-    meanTemperature /= this->clientsCount + 1;
+    if (isLogInfoEnabled()) {
+        printAggregate("luminosity", &this->luminosityAggregate);
+        printAggregate("temperature", &this->temperatureAggregate);
+    }
+
+    double meanTemperature = this->temperatureAggregate.mean;
+    double meanLuminosity = this->luminosityAggregate.mean;
 
-    sprintf(this->displayText, "Temperature: %d", temperature);
+    snprintf(this->displayText, DISPLAY_TEXT_MAX_SIZE, "Temperature: %.1f", meanTemperature);
+    this->setShownText(this->displayText, strlen(this->displayText), NULL);
 
-    this->brightness = meanLuminosity * 4 + 1000; // for example
+    this->brightness = (int)lround(meanLuminosity * 4 + 1000); // for example
 
     logInfo("\t\tSend display info");
     this->displayInfo();
-    if (this->sendMessageWithDisplayInfo(this->brightness, this->displayText, strlen(this->displayText)) == -1) {
+    struct DisplayInfoBody displayInfo;
+    displayInfo.brightness = this->brightness;
+    displayInfo.text = this->displayText;
+    displayInfo.textLength = strlen(this->displayText);
+    // down the tree, or to all at once without one
+    if (this->aggregationTree.epoch != 0) {
+        if (this->sendControlSetToDirectSlaves(&displayInfo) == -1) {
+            logPosition();
+            return;
+        }
+    }
+    else if (this->broadcastMessage<ControlSet>(&displayInfo) == -1) {
         logPosition();
         return;
     }
 
-    this->clientsCount = 0;
+    // new slaves reply directly until the next build, which also waits
+    // out the rebuild interval so that slaves timing out one by one do
+    // not reassign the whole tree each round
+    if (this->aggregationTree.degree > 0 && this->loop->timerSystem.getTime() >= this->nextTreeRebuildTime
+            && (this->aggregationTreeDirty || this->getDirectSlavesCount(true) > this->aggregationTree.degree)) {
+        if (this->rebuildAggregationTree() == -1) {
+            logPosition();
+            return;
+        }
+    }
+
+    if (this->syncDeputy() == -1) {
+        logPosition();
+        return;
+    }
+}
+
+int SelfNode::syncDeputy()
+{
+    // nodes which only know v1 could not read DeputySync
+    long deputy = -1;
+    for (size_t i = 0; i < this->slaves.count; ++i) {
+        if (this->slaves.members[i].wireVersion < WireV2)
+            continue;
+        if (deputy == -1 || NodeIdentity::compareNodeIdentities(&this->slaves.members[i].id,
+                                                               &this->slaves.members[deputy].id) > 0)
+            deputy = (long)i;
+    }
+
+    // the former deputy must not take over along with the new one
+    if (this->hasDeputy && (deputy == -1
+            || NodeIdentity::compareNodeIdentities(&this->slaves.members[deputy].id, &this->deputy.id) != 0)) {
+        if (this->sendDeputySync(&this->deputy, false) == -1) {
+            logPosition();
+            return -1;
+        }
+        this->hasDeputy = false;
+    }
+    if (deputy == -1)
+        return 0;
+
+    bool isNewDeputy = !this->hasDeputy;
+    this->deputy.peerAddress = this->slaves.members[deputy].address;
+    this->deputy.id = this->slaves.members[deputy].id;
+    this->deputy.wireVersion = this->getMemberWireVersion(deputy);
+    this->hasDeputy = true;
+
+    // a part the deputy has missed is made up for by the next full sync
+    uint64_t now = this->loop->timerSystem.getTime();
+    if (isNewDeputy || now >= this->deputyFullSyncTime + DEPUTY_FULL_SYNC_INTERVAL_MS) {
+        this->deputyFullSyncTime = now;
+        if (this->sendDeputySync(&this->deputy, true) == -1) {
+            logPosition();
+            return -1;
+        }
+        return 0;
+    }
+    if (this->sendDeputyChanges(&this->deputy) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int SelfNode::handOver()
+{
+    if (this->state != Master)
+        return 0;
+
+    // the successor gets the membership as of now
+    if (this->syncDeputy() == -1) {
+        logPosition();
+        return -1;
+    }
+    if (!this->hasDeputy)
+        return 0;
+
+    logInfo("\033[1;33m\tHand over to the deputy\033[0m");
+    unsigned char successor[DEPUTY_MEMBER_SIZE];
+    storeMemberRecord(successor, &this->deputy.id, &this->deputy.peerAddress);
+
+    struct AbdicationBody abdication;
+    abdication.controlRound = (int32_t)this->controlRound;
+    abdication.successor = successor;
+    abdication.successorSize = sizeof(successor);
+    if (this->broadcastMessage<Abdication>(&abdication) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+// a part with its header fits its share of sendMessageBuffer
+static_assert(DEPUTY_SYNC_MEMBERS_PER_MESSAGE * DEPUTY_MEMBER_SIZE + 64 <= MESSAGE_BUFFER_SIZE / DEPUTY_SYNC_MESSAGES_PER_BATCH,
+    "DeputySync part does not fit the send buffer");
+
+int SelfNode::sendDeputySync(struct NodeDescriptor *peer, bool isDeputy)
+{
+    unsigned char members[DEPUTY_SYNC_MEMBERS_PER_MESSAGE * DEPUTY_MEMBER_SIZE];
+    struct SendBatch batch;
+    batch.init(&this->net);
+    size_t part = 0;
+
+    struct DeputySyncBody sync;
+    sync.isDeputy = isDeputy;
+    sync.controlRound = (int32_t)this->controlRound;
+    sync.membersCount = isDeputy ? (int32_t)this->slaves.count : 0;
+    sync.leftCount = 0;
+    sync.members = members;
+
+    // the changes sent later are relative to it
+    if (isDeputy)
+        this->deputySlaves.clear();
+
+    // a resignation is a single empty part
+    size_t first = 0;
+    do {
+        size_t count = (size_t)sync.membersCount - first;
+        if (count > DEPUTY_SYNC_MEMBERS_PER_MESSAGE)
+            count = DEPUTY_SYNC_MEMBERS_PER_MESSAGE;
+
+        for (size_t i = 0; i < count; ++i) {
+            struct Member *member = &this->slaves.members[first + i];
+            storeMemberRecord(members + i * DEPUTY_MEMBER_SIZE, &member->id, &member->address);
+
+            long position = this->deputySlaves.findOrAdd(&member->id);
+            if (position == -1) {
+                logPosition();
+                return -1;
+            }
+            this->deputySlaves.members[position].address = member->address;
+        }
+        sync.firstMember = (int32_t)first;
+        if (this->addDeputySyncPart(&batch, &part, peer, &sync, count) == -1) {
+            logPosition();
+            return -1;
+        }
+        first += count;
+    } while (first < (size_t)sync.membersCount);
+
+    if (batch.flush() == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int SelfNode::sendDeputyChanges(struct NodeDescriptor *peer)
+{
+    unsigned char members[DEPUTY_SYNC_MEMBERS_PER_MESSAGE * DEPUTY_MEMBER_SIZE];
+    struct SendBatch batch;
+    batch.init(&this->net);
+    size_t part = 0;
+
+    struct DeputySyncBody sync;
+    sync.isDeputy = 1;
+    sync.controlRound = (int32_t)this->controlRound;
+    sync.firstMember = -1;
+    sync.membersCount = (int32_t)this->slaves.count;
+    sync.leftCount = 0;
+    sync.members = members;
+    size_t count = 0;
+    size_t partsCount = 0;
+
+    // the members gone go first, the last member moves to i
+    size_t i = 0;
+    while (i < this->deputySlaves.count) {
+        struct Member *member = &this->deputySlaves.members[i];
+        if (this->slaves.find(&member->id) != -1) {
+            ++i;
+            continue;
+        }
+        storeMemberRecord(members + count * DEPUTY_MEMBER_SIZE, &member->id, &member->address);
+        ++sync.leftCount;
+        this->deputySlaves.remove(&member->id);
+        if (++count == DEPUTY_SYNC_MEMBERS_PER_MESSAGE) {
+            if (this->addDeputySyncPart(&batch, &part, peer, &sync, count) == -1) {
+                logPosition();
+                return -1;
+            }
+            ++partsCount;
+            count = 0;
+            sync.leftCount = 0;
+        }
+    }
+
+    // then the members joined or moved to another address
+    for (i = 0; i < this->slaves.count; ++i) {
+        struct Member *member = &this->slaves.members[i];
+        size_t sentCount = this->deputySlaves.count;
+        long position = this->deputySlaves.findOrAdd(&member->id);
+        if (position == -1) {
+            logPosition();
+            return -1;
+        }
+        struct Member *sent = &this->deputySlaves.members[position];
+        if (this->deputySlaves.count == sentCount
+                && sent->address.sin_addr.s_addr == member->address.sin_addr.s_addr
+                && sent->address.sin_port == member->address.sin_port)
+            continue;
+        sent->address = member->address;
+        storeMemberRecord(members + count * DEPUTY_MEMBER_SIZE, &member->id, &member->address);
+        if (++count == DEPUTY_SYNC_MEMBERS_PER_MESSAGE) {
+            if (this->addDeputySyncPart(&batch, &part, peer, &sync, count) == -1) {
+                logPosition();
+                return -1;
+            }
+            ++partsCount;
+            count = 0;
+            sync.leftCount = 0;
+        }
+    }
+
+    // without changes an empty part still carries the round
+    if (count > 0 || partsCount == 0) {
+        if (this->addDeputySyncPart(&batch, &part, peer, &sync, count) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    if (batch.flush() == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+// Encodes the part with the first membersCount records of sync->members
+// into its share of sendMessageBuffer and sends the batch once full
+int SelfNode::addDeputySyncPart(struct SendBatch *batch, size_t *part, struct NodeDescriptor *peer,
+                                struct DeputySyncBody *sync, size_t membersCount)
+{
+    const size_t partSize = MESSAGE_BUFFER_SIZE / DEPUTY_SYNC_MESSAGES_PER_BATCH;
+    sync->sequence = (int32_t)++this->deputySyncSequence;
+    sync->membersSize = membersCount * DEPUTY_MEMBER_SIZE;
+    unsigned char *content = this->sendMessageBuffer + *part * partSize;
+    int size = this->encodeMessage<DeputySync>(peer->wireVersion, sync, content, partSize);
+    if (size == -1 || batch->add(&peer->peerAddress, content, size) == -1) {
+        logPosition();
+        return -1;
+    }
+    // the parts of the buffer are written over once sent
+    if (++*part == DEPUTY_SYNC_MESSAGES_PER_BATCH) {
+        if (batch->flush() == -1) {
+            logPosition();
+            return -1;
+        }
+        *part = 0;
+    }
+    return 0;
 }
 
 void SelfNode::onSensorsEmulationTimeout()
@@ -708,15 +1916,31 @@ void SelfNode::onSensorsEmulationTimeout()
 void SelfNode::generateSensorsInfo()
 {
     this->luminosity = rand() % 100 + 1000;
-    printf("\033[0;33mluminosity = %d\n\033[0m", this->luminosity);
-
     this->temperature = rand() % 20 + 10;
-    printf("\033[0;33mtemperature = %d\n\033[0m", this->temperature);
+
+    if (isLogInfoEnabled()) {
+        printf("\033[0;33mluminosity = %d\n\033[0m", this->luminosity);
+        printf("\033[0;33mtemperature = %d\n\033[0m", this->temperature);
+    }
+}
+
+void SelfNode::setShownText(const char *text, size_t textLength, struct RecvBuffer *buffer)
+{
+    if (buffer != NULL)
+        buffer->retain();
+    if (this->shownTextBuffer != NULL)
+        this->shownTextBuffer->release();
+
+    this->shownText = text;
+    this->shownTextLength = textLength;
+    this->shownTextBuffer = buffer;
 }
 
 void SelfNode::displayInfo()
 {
-    printf("\033[1;37m\nBrightness: %d, Text: %s\n\n\033[0m", this->brightness, this->displayText);
+    if (!isLogInfoEnabled())
+        return;
+    printf("\033[1;37m\nBrightness: %d, Text: %.*s\n\n\033[0m", this->brightness, (int)this->shownTextLength, this->shownText);
 }
 
 void SelfNode::whoIsMasterTimeoutHandler(TimerHandlerArgument arg)
@@ -743,6 +1967,18 @@ void SelfNode::iAmAliveHeartbeetTimeoutHandler(TimerHandlerArgument arg)
         ((SelfNode*)arg.ptrValue)->onIAmAliveHeartbeetTimeout();
 }
 
+void SelfNode::whoIsMasterBackoffTimeoutHandler(TimerHandlerArgument arg)
+{
+    if (arg.ptrValue)
+        ((SelfNode*)arg.ptrValue)->onWhoIsMasterBackoffTimeout();
+}
+
+void SelfNode::iAmMasterReplyTimeoutHandler(TimerHandlerArgument arg)
+{
+    if (arg.ptrValue)
+        ((SelfNode*)arg.ptrValue)->onIAmMasterReplyTimeout();
+}
+
 void SelfNode::controlRequestTimeoutHandler(TimerHandlerArgument arg)
 {
     if (arg.ptrValue)
@@ -755,6 +1991,12 @@ void SelfNode::controlWaitResponceTimeoutHandler(TimerHandlerArgument arg)
         ((SelfNode*)arg.ptrValue)->onControlWaitResponceTimeoutHandler();
 }
 
+void SelfNode::controlResponseTimeoutHandler(TimerHandlerArgument arg)
+{
+    if (arg.ptrValue)
+        ((SelfNode*)arg.ptrValue)->onControlResponseTimeout();
+}
+
 void SelfNode::sensorsEmulationTimeoutHandler(TimerHandlerArgument arg)
 {
     if (arg.ptrValue)
@@ -763,46 +2005,108 @@ void SelfNode::sensorsEmulationTimeoutHandler(TimerHandlerArgument arg)
 
 int SelfNode::initTimers()
 {
-    if (Timer::initTimerSystem() == -1) {
-        logPosition();
-        return -1;
-    }
+    struct TimerSystem *timers = &this->loop->timerSystem;
 
     TimerHandlerArgument arg;
     arg.ptrValue = (void*)this;
-    if (this->whoIsMasterTimer.init(5000, false, SelfNode::whoIsMasterTimeoutHandler, arg) == -1) {
+    if (this->whoIsMasterTimer.init(timers, 5000, false, SelfNode::whoIsMasterTimeoutHandler, arg) == -1) {
+        logPosition();
+        return -1;
+    }
+    // the interval is set from the failure detector by each IAmMaster
+    if (this->monitoringMasterTimer.init(timers, LEGACY_HEARTBEAT_INTERVAL_MS, false, SelfNode::monitoringMasterTimeoutHandler, arg) == -1) {
+        logPosition();
+        return -1;
+    }
+    if (this->waitForMasterTimer.init(timers, 10000, false, SelfNode::waitForMasterTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
-    if (this->monitoringMasterTimer.init(16000, false, SelfNode::monitoringMasterTimeoutHandler, arg) == -1) {
+    if (this->iAmAliveHeartbeetTimer.init(timers, this->heartbeatIntervalMs, true, SelfNode::iAmAliveHeartbeetTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
-    if (this->waitForMasterTimer.init(10000, false, SelfNode::waitForMasterTimeoutHandler, arg) == -1) {
+    // the intervals are set by start() and replyIAmMaster()
+    if (this->whoIsMasterBackoffTimer.init(timers, ELECTION_BACKOFF_MS, false, SelfNode::whoIsMasterBackoffTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
-    if (this->iAmAliveHeartbeetTimer.init(10000, true, SelfNode::iAmAliveHeartbeetTimeoutHandler, arg) == -1) {
+    if (this->iAmMasterReplyTimer.init(timers, ELECTION_REPLY_HOLDOFF_MS, false, SelfNode::iAmMasterReplyTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
 
-    if (this->controlRequestTimer.init(20000, true, SelfNode::controlRequestTimeoutHandler, arg) == -1) {
+    if (this->controlRequestTimer.init(timers, 20000, true, SelfNode::controlRequestTimeoutHandler, arg) == -1) {
+        logPosition();
+        return -1;
+    }
+    if (this->controlWaitResponceTimer.init(timers, CONTROL_WAIT_RESPONSE_MS, false, SelfNode::controlWaitResponceTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
-    if (this->controlWaitResponceTimer.init(3000, false, SelfNode::controlWaitResponceTimeoutHandler, arg) == -1) {
+    // the interval is set by each ControlRequest
+    if (this->controlResponseTimer.init(timers, CONTROL_RESPONSE_MAX_WINDOW_MS, false, SelfNode::controlResponseTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
 
-    if (this->sensorsEmulationTimer.init(30000, true, SelfNode::sensorsEmulationTimeoutHandler, arg) == -1) {
+    if (this->sensorsEmulationTimer.init(timers, 30000, true, SelfNode::sensorsEmulationTimeoutHandler, arg) == -1) {
         logPosition();
         return -1;
     }
     return 0;
 }
 
+void SelfNode::listTimers(struct Timer *timers[NODE_TIMERS_COUNT])
+{
+    timers[0] = &this->whoIsMasterTimer;
+    timers[1] = &this->waitForMasterTimer;
+    timers[2] = &this->monitoringMasterTimer;
+    timers[3] = &this->iAmAliveHeartbeetTimer;
+    timers[4] = &this->whoIsMasterBackoffTimer;
+    timers[5] = &this->iAmMasterReplyTimer;
+    timers[6] = &this->controlRequestTimer;
+    timers[7] = &this->controlWaitResponceTimer;
+    timers[8] = &this->controlResponseTimer;
+    timers[9] = &this->sensorsEmulationTimer;
+}
+
+int SelfNode::deinitTimers()
+{
+    struct Timer *timers[NODE_TIMERS_COUNT];
+    this->listTimers(timers);
+
+    for (int i = 0; i < NODE_TIMERS_COUNT; ++i) {
+        if (timers[i]->deinit() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// The MAC address, the process id, the IPv4 address and the port of
+// a member, DEPUTY_MEMBER_SIZE bytes in network order
+static void storeMemberRecord(unsigned char *record, struct NodeIdentity *id, struct sockaddr_in *address)
+{
+    memcpy(record, id->macAddress, 6);
+    storeInt32(record + 6, (uint32_t)id->processId);
+    memcpy(record + 10, &address->sin_addr.s_addr, 4);
+    memcpy(record + 14, &address->sin_port, 2);
+}
+
+static void loadMemberRecord(const unsigned char *record, struct NodeIdentity *id, struct sockaddr_in *address)
+{
+    memset(id, 0, sizeof(struct NodeIdentity));
+    memcpy(id->macAddress, record, 6);
+    id->processId = (pid_t)loadInt32(record + 6);
+
+    memset(address, 0, sizeof(struct sockaddr_in));
+    address->sin_family = AF_INET;
+    memcpy(&address->sin_addr.s_addr, record + 10, 4);
+    memcpy(&address->sin_port, record + 14, 2);
+}
+
 static void printNodeDescriptor(struct NodeDescriptor *node)
 {
     struct NodeIdentity *nodeId = &node->id;
@@ -822,3 +2126,11 @@ static void printNodeIdentity(struct NodeIdentity *nodeId)
     printf("%d, %02x:%02x:%02x:%02x:%02x:%02x\n", nodeId->processId,
            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
+
+static void printAggregate(const char *name, struct StreamingAggregate *aggregate)
+{
+    printf("\033[0;33m%s: count %llu, mean %.1f, stddev %.1f, min %d, p50 %d, p90 %d, p99 %d, max %d\n\033[0m",
+           name, (unsigned long long)aggregate->count, aggregate->mean, sqrt(aggregate->getVariance()),
+           aggregate->min, aggregate->getQuantile(0.5), aggregate->getQuantile(0.9),
+           aggregate->getQuantile(0.99), aggregate->max);
+}
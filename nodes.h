@@ -8,6 +8,11 @@
 #include "timers.h"
 #include "networking.h"
 #include "identity.h"
+#include "messages.h"
+#include "membership.h"
+#include "aggregation.h"
+#include "aggregationtree.h"
+#include "failuredetector.h"
 
 enum NodeState
 {
@@ -16,32 +21,134 @@ enum NodeState
     Slave
 };
 
-enum MessageType
+
+struct NodeDescriptor
 {
-    WhoIsMaster,
-    IAmMaster,
-    PleaseWait,
+    struct sockaddr_in peerAddress;
+    struct NodeIdentity id;
+    // of the message received from the node, replies are sent in it
+    enum WireVersion wireVersion;
+};
+
+struct SelfNode;
 
-    ControlRequest,
-    ControlResponse,
-    ControlSet
+typedef void (*NodeStateHandler)(struct SelfNode *node, enum NodeState oldState, enum NodeState newState, void *arg);
+
+struct SelfNodeConfig
+{
+    struct NetworkingConfig net;
+    // NULL to identify the node by the host MAC address and the process
+    // id, else e.g. to run several nodes in one process
+    struct NodeIdentity *identity;
+
+    // Called on each state change and when a slave follows another
+    // master, e.g. to observe an election. NULL by default.
+    NodeStateHandler stateHandler;
+    void *stateHandlerArgument;
+
+    // Fraction of the slaves known at the start of a control round whose
+    // responses close the round before its deadline, 1 by default; 0
+    // always waits for the deadline
+    double roundQuorum;
+
+    // Format of the broadcasts, WireV2 by default. WireV1 talks to nodes
+    // which only know v1. Messages of both formats are received.
+    enum WireVersion wireVersion;
+
+    // Fan-in of the aggregation tree the master polls its slaves
+    // through, from 2 to AGGREGATION_MAX_DEGREE; 0 by default polls
+    // every slave directly
+    size_t aggregationDegree;
+
+    // Period of the master's IAmMaster heartbeats, 1000 ms by default
+    int heartbeatIntervalMs;
+    // Phi of the master's silence at which a slave suspects it and seeks
+    // a new one, 8 by default. A higher one detects a failure later and
+    // gives fewer false suspicions under load.
+    double phiThreshold;
+
+    void setDefaults();
 };
 
+// Control rounds run by the node as a master
+struct ControlRoundStats
+{
+    uint64_t roundsCount;
+    // closed by the quorum of responses rather than by the deadline
+    uint64_t quorumRoundsCount;
+    // from the ControlRequest to the ControlSet, in ms
+    uint64_t lastLatency;
+    uint64_t totalLatency;
+    uint64_t maxLatency;
+};
 
-struct NodeDescriptor
+// Election messages sent and received by a node
+struct ElectionStats
 {
-    struct sockaddr_in peerAddress;
-    struct NodeIdentity id;
+    uint64_t whoIsMasterSent;
+    // not sent, as a higher node had been heard first
+    uint64_t whoIsMasterSuppressed;
+    // IAmMasters other than heartbeats
+    uint64_t iAmMasterSent;
+    // replies merged into an IAmMaster sent or scheduled
+    uint64_t iAmMasterRepliesCoalesced;
+    uint64_t pleaseWaitSent;
+    // WhoIsMaster, PleaseWait and IAmMaster other than heartbeats
+    uint64_t messagesReceived;
 };
 
-struct SensorInfo
+// Masters live at once, as seen by the masters. Only masters which have
+// both lasted a heartbeat interval make a split brain, shorter ones are
+// collisions of a single election.
+struct SplitBrainStats
 {
-    int temperature;
-    int luminosity;
+    // IAmMasters of another master received as a master
+    uint64_t competingMastersHeard;
+    // yields to a higher master within the same election
+    uint64_t collisionsCount;
+    // split brains ended by this master yielding to a higher one, and
+    // how long both masters had been live, in ms
+    uint64_t yieldsCount;
+    uint64_t lastDuration;
+    uint64_t totalDuration;
+    uint64_t maxDuration;
 };
 
 #define DISPLAY_TEXT_MAX_SIZE 1024
-#define CLIENTS_MAX_COUNT 128
+#define MESSAGE_BUFFER_SIZE 8192
+#define NODE_TIMERS_COUNT 10
+// slaves which have not answered a ControlRequest within it are forgotten
+#define SLAVE_TIMEOUT_MS 60000
+// v2 nodes broadcast in v1 while v1 messages have been received within it
+#define WIRE_V1_FALLBACK_MS 60000
+// ControlResponses the master takes in without losses, the window the
+// slaves reply over is sized from it by the count of slaves
+#define CONTROL_RESPONSES_PER_SECOND 20000
+// half of the wait for responses, so that late slots still make it
+#define CONTROL_RESPONSE_MAX_WINDOW_MS 1500
+// deadline of a control round, subtrees of the aggregation tree close
+// theirs earlier by their height
+#define CONTROL_WAIT_RESPONSE_MS 3000
+// the tree is rebuilt at most once within it, each rebuild sends an
+// AggregationAssign to every member of the tree
+#define AGGREGATION_REBUILD_INTERVAL_MS 60000
+// heartbeat interval assumed for masters which do not tell theirs
+#define LEGACY_HEARTBEAT_INTERVAL_MS 10000
+// a starting node sends its WhoIsMaster after a random delay below it,
+// and not at all if a higher node has been heard meanwhile
+#define ELECTION_BACKOFF_MS 1000
+// a master replies to election messages with at most one IAmMaster
+// within it
+#define ELECTION_REPLY_HOLDOFF_MS 200
+// members per DeputySync or MembershipMerge, so that each fits an
+// unfragmented datagram
+#define DEPUTY_SYNC_MEMBERS_PER_MESSAGE 64
+// DeputySync parts encoded into sendMessageBuffer side by side and sent
+// in one batch
+#define DEPUTY_SYNC_MESSAGES_PER_BATCH 4
+// a deputy gets the whole membership when picked and again within it,
+// only the changes after each round otherwise
+#define DEPUTY_FULL_SYNC_INTERVAL_MS 600000
 
 struct SelfNode
 {
@@ -49,70 +156,273 @@ private:
     struct NodeIdentity nodeIdentity;
 
     enum NodeState state;
+    NodeStateHandler stateHandler;
+    void *stateHandlerArgument;
 
     struct NodeDescriptor myMaster;
     bool masterIsAvailable;
 
+    // WithoutMaster since a higher node has been heard, which is left to
+    // reply to lower ones
+    bool waitingForMaster;
+    // the WhoIsMaster of the start is yet to be sent
+    bool whoIsMasterPending;
+    bool iAmMasterReplyPending;
+    uint64_t lastIAmMasterTime;
+    struct ElectionStats electionStats;
+    uint64_t masterSinceTime;
+    struct SplitBrainStats splitBrainStats;
+
+    int heartbeatIntervalMs;
+    double phiThreshold;
+    // of the heartbeats of myMaster, monitoringMasterTimer fires when it
+    // suspects the master
+    struct PhiAccrualDetector masterFailureDetector;
+
+    // the highest of the master's slaves, which the master streams the
+    // changes of its membership to after each round, and the membership
+    // as sent to it
+    struct NodeDescriptor deputy;
+    bool hasDeputy;
+    struct MembershipTable deputySlaves;
+    uint32_t deputySyncSequence;
+    uint64_t deputyFullSyncTime;
+    // of a slave: whether it is its master's deputy, whether the master
+    // has one, and the state streamed to the deputy, which it takes over
+    // with when the master fails. The copy is complete once every part
+    // from the first one of the last full sync, standbySyncBase, up to
+    // the latest one has arrived, in any order, and it has the master's
+    // count of members.
+    bool isDeputy;
+    bool masterHasDeputy;
+    struct MembershipTable standbySlaves;
+    uint32_t standbyControlRound;
+    bool standbyFullySynced;
+    uint32_t standbySyncBase;
+    uint32_t standbyLastSequence;
+    uint32_t standbyPartsCount;
+    size_t standbyMembersCount;
+    // messages of the master which has handed over may still be in
+    // flight, its IAmMasters are ignored until a heartbeat of another
+    // master, a heartbeat interval after the takeover at the earliest
+    struct NodeIdentity abdicatedMaster;
+    bool hasAbdicatedMaster;
+
+    struct EventLoop *loop;
     struct Networking net;
 
+    enum WireVersion wireVersion;
+    bool v1MessageReceived;
+    uint64_t lastV1MessageTime;
+
+    unsigned char sendMessageBuffer[MESSAGE_BUFFER_SIZE];
+
     char displayText[DISPLAY_TEXT_MAX_SIZE];
     int brightness;
 
+    // text shown by displayInfo(): displayText or the text of the last
+    // ControlSet, which stays in its receive buffer
+    const char *shownText;
+    size_t shownTextLength;
+    struct RecvBuffer *shownTextBuffer;
+
     int temperature;
     int luminosity;
 
-    SensorInfo receivedSensorsInfo[CLIENTS_MAX_COUNT];
-    int clientsCount;
+    // slaves known to the master with their latest sensor samples
+    struct MembershipTable slaves;
+    // numbers ControlRequests, samples of older rounds are not counted
+    uint32_t controlRound;
+    // from a ControlRequest to the end of the wait for responses
+    bool controlRoundOpen;
+    uint64_t controlRoundStartTime;
+    // responses which close the round early, 0 to wait for the deadline
+    size_t controlRoundQuorum;
+    size_t controlRoundResponsesCount;
+    double roundQuorum;
+    struct ControlRoundStats roundStats;
+    // of the master's own sample and the first response of each slave
+    // in the round, updated as responses arrive
+    struct StreamingAggregate luminosityAggregate;
+    struct StreamingAggregate temperatureAggregate;
+
+    // master or aggregator to reply to when controlResponseTimer fires
+    // or the subtree's round closes
+    struct NodeDescriptor controlResponsePeer;
+
+    // the master's tree, rebuilt when slaves are gone or too many reply
+    // directly, but not before nextTreeRebuildTime
+    struct AggregationTree aggregationTree;
+    bool aggregationTreeDirty;
+    uint64_t nextTreeRebuildTime;
+
+    // place of the slave in its master's tree, epoch 0 for none
+    uint32_t assignedTreeEpoch;
+    bool underAggregator;
+    int aggregationCollectMs;
+    size_t aggregationDescendantsCount;
+    struct sockaddr_in *aggregationChildren;
+    size_t aggregationChildrenCount;
+    size_t aggregationChildrenCapacity;
+    // the ControlSet of the round collected is passed to the children
+    bool forwardControlSet;
 
     struct Timer whoIsMasterTimer,
             waitForMasterTimer,
             monitoringMasterTimer,
             iAmAliveHeartbeetTimer,
+            whoIsMasterBackoffTimer,
+            iAmMasterReplyTimer,
 
             controlRequestTimer,
             controlWaitResponceTimer,
+            controlResponseTimer,
 
             sensorsEmulationTimer;
 
 public:
-    int init(struct NetworkingConfig *netConfig);
+    // Nodes sharing a loop must run on the loop's thread
+    int init(struct SelfNodeConfig *config, struct EventLoop *loop);
+    int deinit();
+
+    enum NodeState getState();
+    void getIdentity(struct NodeIdentity *id);
+    // Returns false unless the node is a slave
+    bool getMasterIdentity(struct NodeIdentity *id);
+    void getControlRoundStats(struct ControlRoundStats *stats);
+    void getElectionStats(struct ElectionStats *stats);
+    void getSplitBrainStats(struct SplitBrainStats *stats);
+
+    // Starts the node on its loop without running the loop
+    int start();
+    // A stopped node leaves the election as WithoutMaster
+    int stop();
+    // A master names its deputy as its successor and passes its state
+    // on, before it is stopped; other nodes do nothing
+    int handOver();
+
+    // Starts the node and runs the loop
     int run();
 
 private:
+    void setState(enum NodeState state);
+    void notifyStateChanged(enum NodeState oldState);
+
     int becomeWithoutMaster();
     int becomeWaitingForMaster();
     int becomeMaster();
-    int becomeSlave(struct NodeDescriptor *master);
+    int becomeSlave(struct NodeDescriptor *master, const struct MasterHeartbeatBody *heartbeat);
+    // Becomes the master with the membership streamed by the former one,
+    // or starts an election when the copy of it is incomplete
+    int takeOverAsDeputy();
+    bool isStandbyComplete();
 
     int stopMasterTimers();
 
-    int sendMessage(enum MessageType type, sockaddr_in *peerAddress);
-    int broadcastMessage(enum MessageType type);
-
-    int sendMessageWithSensorInfo(sockaddr_in *peerAddress, int luminosity, int temperature);
-
-    int sendMessageWithDisplayInfo(int brightness, char *displayText, size_t textLength);
+    // Only the heartbeat timer's IAmMasters are heartbeats, replies to
+    // election messages would skew the intervals slaves measure
+    int broadcastIAmMaster(bool isHeartbeat);
+    // Replies to an election message with an IAmMaster, at once or
+    // merged with the others of ELECTION_REPLY_HOLDOFF_MS
+    int replyIAmMaster();
+    // The WhoIsMaster of the start is not needed any more
+    int cancelWhoIsMaster();
+
+    // Encodes the message by its schema into sendMessageBuffer,
+    // returns its size or -1
+    template <enum MessageType type>
+    int encodeMessage(enum WireVersion version, const typename MessageSchemaOf<type>::Body *body);
+    template <enum MessageType type>
+    int encodeMessage(enum WireVersion version, const typename MessageSchemaOf<type>::Body *body,
+                      unsigned char *buffer, size_t bufferSize);
+
+    // Sends in the wire format the peer has used
+    template <enum MessageType type>
+    int sendMessage(struct NodeDescriptor *peer, const typename MessageSchemaOf<type>::Body *body);
+    template <enum MessageType type>
+    int sendMessage(struct NodeDescriptor *peer);
+
+    enum WireVersion getBroadcastWireVersion();
+
+    template <enum MessageType type>
+    int broadcastMessage(const typename MessageSchemaOf<type>::Body *body);
+    template <enum MessageType type>
+    int broadcastMessage();
+
+    template <enum MessageType type>
+    int sendToAggregationChildren(const typename MessageSchemaOf<type>::Body *body);
 
     int compareWithSelf(struct NodeIdentity *senderId);
     int compareWithCurrentMaster(struct NodeIdentity *senderId);
 
-    static void recvDgramHandler(struct sockaddr_in* senderAddress, unsigned char *message, size_t messageSize, void *arg);
-
-    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender);
-
-    void onSensorsInfoReceived(struct NodeDescriptor *sender, int luminosity, int temperature);
-    void onDisplayInfoReceived(struct NodeDescriptor *sender, int brightness, char *displayText, size_t textLength);
+    static void recvDgramBatchHandler(struct RecvDatagram *datagrams, size_t count, void *arg);
+
+    void onDatagramReceived(struct RecvDatagram *datagram);
+
+    // Decodes the body of a message of the type and passes it to the
+    // onMessageReceived() overload for its body
+    typedef void (*MessageReceiver)(struct SelfNode *self, struct NodeDescriptor *sender,
+                                    struct ReadByteStream *s, struct RecvBuffer *buffer);
+    template <enum MessageType type>
+    static void receiveMessage(struct SelfNode *self, struct NodeDescriptor *sender,
+                               struct ReadByteStream *s, struct RecvBuffer *buffer);
+
+    // receivers[type] is receiveMessage<type>
+    template <typename List>
+    struct MessageReceivers;
+
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct EmptyBody *body, struct RecvBuffer *buffer);
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct MasterHeartbeatBody *body, struct RecvBuffer *buffer);
+    void onIAmMaster(struct NodeDescriptor *sender, const struct MasterHeartbeatBody *body);
+    // Two masters have heard each other, the lower one yields and passes
+    // its slaves on
+    int yieldToMaster(struct NodeDescriptor *master, const struct MasterHeartbeatBody *heartbeat);
+    // How long this master and the other one have both been live, 0 for
+    // a collision of an election
+    uint64_t getSplitBrainDuration(const struct MasterHeartbeatBody *heartbeat);
+    int sendMembershipMerge(struct NodeDescriptor *master);
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct MembershipMergeBody *body, struct RecvBuffer *buffer);
+    // A slave replies in its slot of the response window
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct ControlRequestBody *body, struct RecvBuffer *buffer);
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct SensorsInfoBody *body, struct RecvBuffer *buffer);
+    // The text is shown from buffer, without a copy
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct DisplayInfoBody *body, struct RecvBuffer *buffer);
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct AggregationAssignBody *body, struct RecvBuffer *buffer);
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct SensorsSummaryBody *body, struct RecvBuffer *buffer);
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct DeputySyncBody *body, struct RecvBuffer *buffer);
+    // Slaves follow the successor at once, the successor takes over
+    void onMessageReceived(enum MessageType type, struct NodeDescriptor *sender,
+                           const struct AbdicationBody *body, struct RecvBuffer *buffer);
+
+    // Updates the sender as a member, returns its position or -1
+    long recordControlReply(struct NodeDescriptor *sender, bool *isFirstReply);
+    // Counts the samples of a first reply, closes the round at the quorum
+    void countControlReplies(size_t count);
 
     int initTimers();
+    int deinitTimers();
+    void listTimers(struct Timer *timers[NODE_TIMERS_COUNT]);
 
 
     static void whoIsMasterTimeoutHandler(TimerHandlerArgument arg);
     static void waitForMasterTimeoutHandler(TimerHandlerArgument arg);
     static void monitoringMasterTimeoutHandler(TimerHandlerArgument arg);
     static void iAmAliveHeartbeetTimeoutHandler(TimerHandlerArgument arg);
+    static void whoIsMasterBackoffTimeoutHandler(TimerHandlerArgument arg);
+    static void iAmMasterReplyTimeoutHandler(TimerHandlerArgument arg);
 
     static void controlRequestTimeoutHandler(TimerHandlerArgument arg);
     static void controlWaitResponceTimeoutHandler(TimerHandlerArgument arg);
+    static void controlResponseTimeoutHandler(TimerHandlerArgument arg);
 
     static void sensorsEmulationTimeoutHandler(TimerHandlerArgument arg);
 
@@ -121,13 +431,40 @@ private:
     void onWaitForMasterTimeout();
     void onMonitoringMasterTimeout();
     void onIAmAliveHeartbeetTimeout();
+    void onWhoIsMasterBackoffTimeout();
+    void onIAmMasterReplyTimeout();
 
     void onControlRequestTimeoutHandler();
     void onControlWaitResponceTimeoutHandler();
+    void closeControlRound();
+    int getControlResponseWindow(size_t repliesCount);
+    // Slaves which reply to the master rather than to an aggregator
+    // assignableOnly counts only those the tree may take in
+    size_t getDirectSlavesCount(bool assignableOnly);
+    enum WireVersion getMemberWireVersion(size_t position);
+    bool isDirectSlave(size_t position);
+    int rebuildAggregationTree();
+    int sendAggregationAssign(size_t index);
+    // of a slave whose children are to reply to it
+    void openAggregationRound(uint32_t treeEpoch);
+    void sendControlSummary();
+    int sendControlSetToDirectSlaves(const struct DisplayInfoBody *body);
+    void onControlResponseTimeout();
+    // Picks the highest slave as the deputy and streams the membership
+    // to it
+    int syncDeputy();
+    // The whole membership, or the resignation of a former deputy
+    int sendDeputySync(struct NodeDescriptor *peer, bool isDeputy);
+    // Members gone and joined since the last sync to the deputy
+    int sendDeputyChanges(struct NodeDescriptor *peer);
+    int addDeputySyncPart(struct SendBatch *batch, size_t *part, struct NodeDescriptor *peer,
+                          struct DeputySyncBody *sync, size_t membersCount);
 
     void onSensorsEmulationTimeout();
 
     void generateSensorsInfo();
+    // buffer holds text, or is NULL when text is displayText
+    void setShownText(const char *text, size_t textLength, struct RecvBuffer *buffer);
     void displayInfo();
 };
 
@@ -0,0 +1,150 @@
+#include "recvbufferpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logging.h"
+
+#define FREE_LIST_END 0xffffffffu
+
+static uint64_t makeFreeListHead(uint32_t index, uint32_t tag)
+{
+    return ((uint64_t)tag << 32) | index;
+}
+
+void RecvBuffer::retain()
+{
+    this->refsCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RecvBuffer::release()
+{
+    // acq_rel: the last owner sees every write of the previous ones
+    if (this->refsCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        this->pool->putFree(this);
+}
+
+int RecvBufferPool::init(int initialCount)
+{
+    this->chunksCount.store(0, std::memory_order_relaxed);
+    this->freeListHead.store(makeFreeListHead(FREE_LIST_END, 0), std::memory_order_relaxed);
+    this->acquiredCount.store(0, std::memory_order_relaxed);
+    this->exhaustedCount.store(0, std::memory_order_relaxed);
+
+    if (pthread_mutex_init(&this->growMutex, NULL) != 0) {
+        logPosition();
+        return -1;
+    }
+
+    while (this->chunksCount.load(std::memory_order_relaxed) * RECV_BUFFERS_CHUNK_SIZE < initialCount) {
+        if (this->addChunk() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int RecvBufferPool::deinit()
+{
+    int chunksCount = this->chunksCount.load(std::memory_order_acquire);
+    for (int i = 0; i < chunksCount; ++i) {
+        free(this->chunks[i]);
+        this->chunks[i] = NULL;
+    }
+    this->chunksCount.store(0, std::memory_order_relaxed);
+    this->freeListHead.store(makeFreeListHead(FREE_LIST_END, 0), std::memory_order_relaxed);
+
+    pthread_mutex_destroy(&this->growMutex);
+    return 0;
+}
+
+struct RecvBuffer *RecvBufferPool::getBufferByIndex(int index)
+{
+    return &this->chunks[index / RECV_BUFFERS_CHUNK_SIZE][index % RECV_BUFFERS_CHUNK_SIZE];
+}
+
+void RecvBufferPool::putFree(struct RecvBuffer *buffer)
+{
+    uint64_t head = this->freeListHead.load(std::memory_order_relaxed);
+    uint64_t newHead;
+    do {
+        buffer->nextFreeIndex.store((int)(uint32_t)head, std::memory_order_relaxed);
+        newHead = makeFreeListHead(buffer->index, (uint32_t)(head >> 32) + 1);
+    // release: the link is visible before the buffer is
+    } while (!this->freeListHead.compare_exchange_weak(head, newHead,
+            std::memory_order_release, std::memory_order_relaxed));
+}
+
+struct RecvBuffer *RecvBufferPool::acquire()
+{
+    while (true) {
+        uint64_t head = this->freeListHead.load(std::memory_order_acquire);
+        uint32_t index = (uint32_t)head;
+
+        if (index == FREE_LIST_END) {
+            if (this->grow() == -1) {
+                this->exhaustedCount.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+            continue;
+        }
+
+        // the buffer may be taken concurrently: then the tag has changed
+        // and the stale link is never used
+        struct RecvBuffer *buffer = this->getBufferByIndex(index);
+        uint32_t next = (uint32_t)buffer->nextFreeIndex.load(std::memory_order_relaxed);
+        uint64_t newHead = makeFreeListHead(next, (uint32_t)(head >> 32) + 1);
+
+        if (this->freeListHead.compare_exchange_weak(head, newHead,
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+            buffer->refsCount.store(1, std::memory_order_relaxed);
+            this->acquiredCount.fetch_add(1, std::memory_order_relaxed);
+            return buffer;
+        }
+    }
+}
+
+int RecvBufferPool::grow()
+{
+    pthread_mutex_lock(&this->growMutex);
+
+    // another thread may have grown the pool meanwhile
+    int res = 0;
+    if ((uint32_t)this->freeListHead.load(std::memory_order_acquire) == FREE_LIST_END)
+        res = this->addChunk();
+
+    pthread_mutex_unlock(&this->growMutex);
+    return res;
+}
+
+int RecvBufferPool::addChunk()
+{
+    int chunkIndex = this->chunksCount.load(std::memory_order_relaxed);
+    if (chunkIndex == RECV_BUFFERS_MAX_CHUNKS)
+        return -1;
+
+    void *chunk;
+    if (posix_memalign(&chunk, CACHE_LINE_SIZE, RECV_BUFFERS_CHUNK_SIZE * sizeof(struct RecvBuffer)) != 0) {
+        logPosition();
+        return -1;
+    }
+    this->chunks[chunkIndex] = (struct RecvBuffer *)chunk;
+    this->chunksCount.store(chunkIndex + 1, std::memory_order_release);
+
+    for (int i = 0; i < RECV_BUFFERS_CHUNK_SIZE; ++i) {
+        struct RecvBuffer *buffer = &this->chunks[chunkIndex][i];
+        buffer->index = chunkIndex * RECV_BUFFERS_CHUNK_SIZE + i;
+        buffer->pool = this;
+        buffer->refsCount.store(0, std::memory_order_relaxed);
+        this->putFree(buffer);
+    }
+    return 0;
+}
+
+void RecvBufferPool::getStats(struct RecvBufferPoolStats *stats)
+{
+    stats->buffersCount = this->chunksCount.load(std::memory_order_acquire) * RECV_BUFFERS_CHUNK_SIZE;
+    stats->acquiredCount = this->acquiredCount.load(std::memory_order_relaxed);
+    stats->exhaustedCount = this->exhaustedCount.load(std::memory_order_relaxed);
+}
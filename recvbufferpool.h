@@ -0,0 +1,85 @@
+#ifndef RECVBUFFERPOOL_H
+#define RECVBUFFERPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include <atomic>
+
+#include "spscqueue.h"
+
+// largest datagram payload
+#define RECV_BUFFER_SIZE 8196
+// room in front of the payload, e.g. for the io_uring recvmsg header
+#define RECV_BUFFER_HEADROOM 64
+
+#define RECV_BUFFERS_CHUNK_SIZE 64
+// buffer indexes have to fit io_uring 16 bit buffer ids
+#define RECV_BUFFERS_MAX_CHUNKS 64
+
+struct RecvBufferPool;
+
+// A received datagram stays in its buffer until the last reference is
+// released. Networking holds one reference while the datagram is
+// dispatched. A handler that keeps the datagram past the callback, e.g.
+// to queue it for a worker thread, takes its own with retain() and gives
+// it back with release() from any thread. The payload is never copied
+// between the kernel and its final consumer.
+struct RecvBuffer
+{
+    std::atomic<int> refsCount;
+    std::atomic<int> nextFreeIndex;
+    int index;
+    struct RecvBufferPool *pool;
+
+    alignas(CACHE_LINE_SIZE) unsigned char data[RECV_BUFFER_HEADROOM + RECV_BUFFER_SIZE];
+
+    void retain();
+    void release();
+};
+
+struct RecvBufferPoolStats
+{
+    int buffersCount;
+    uint64_t acquiredCount;
+    // acquire() failed because the pool has reached its maximal size
+    uint64_t exhaustedCount;
+};
+
+// Buffers are allocated by chunks that are never freed before deinit,
+// so buffer pointers and indexes stay valid. Free buffers form a
+// lock-free stack: any thread may acquire or release buffers.
+struct RecvBufferPool
+{
+    struct RecvBuffer *chunks[RECV_BUFFERS_MAX_CHUNKS];
+    std::atomic<int> chunksCount;
+    pthread_mutex_t growMutex;
+
+    // index of the first free buffer in the low half, ABA tag in the high one
+    std::atomic<uint64_t> freeListHead;
+
+    std::atomic<uint64_t> acquiredCount;
+    std::atomic<uint64_t> exhaustedCount;
+
+    int init(int initialCount);
+    // All buffers must have been released
+    int deinit();
+
+    // Returns a buffer holding one reference, NULL when exhausted
+    struct RecvBuffer *acquire();
+    struct RecvBuffer *getBufferByIndex(int index);
+
+    void getStats(struct RecvBufferPoolStats *stats);
+
+private:
+    friend struct RecvBuffer;
+
+    void putFree(struct RecvBuffer *buffer);
+    int grow();
+    // with growMutex held
+    int addChunk();
+};
+
+#endif // RECVBUFFERPOOL_H
@@ -0,0 +1,330 @@
+#include "recvshard.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <errno.h>
+
+#include "eventloop.h"
+#include "logging.h"
+
+// the ring is full: look again later instead of spinning
+#define RECV_SHARD_BACKLOG_POLL_MS 1
+
+int RecvShard::init(int index, int cpu, struct sockaddr_in *address, struct RecvBufferPool *pool)
+{
+    this->index = index;
+    this->pool = pool;
+    this->cpu = cpu;
+    this->threadStarted = false;
+    this->stopRequested.store(false, std::memory_order_relaxed);
+    this->loop = NULL;
+    this->queue.init();
+    this->wakeFd = -1;
+    this->notifyFd = -1;
+
+    this->socketFd = Networking::bindDgramSocket(address, true);
+    if (this->socketFd == -1) {
+        logPosition();
+        return -1;
+    }
+
+    // tells broadcasts apart, those are received by the owner socket too
+    int packetInfoSocketOption = 1;
+    if (setsockopt(this->socketFd,
+            IPPROTO_IP, IP_PKTINFO,
+            &packetInfoSocketOption, sizeof(int)) == -1) {
+        perror("Set packet info socket option");
+        logPosition();
+        return -1;
+    }
+
+    this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wakeFd == -1) {
+        perror("Create receive shard wake eventfd");
+        logPosition();
+        return -1;
+    }
+
+    this->notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->notifyFd == -1) {
+        perror("Create receive shard notify eventfd");
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int RecvShard::deinit()
+{
+    if (this->stop() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    int fds[] = { this->socketFd, this->wakeFd, this->notifyFd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+        if (fds[i] != -1 && close(fds[i]) == -1) {
+            perror("Close receive shard fd");
+            logPosition();
+            return -1;
+        }
+    }
+    this->socketFd = -1;
+    this->wakeFd = -1;
+    this->notifyFd = -1;
+    return 0;
+}
+
+int RecvShard::start(struct EventLoop *loop, RecvBatchHandler handler, void *arg)
+{
+    if (this->threadStarted) {
+        logPosition();
+        return -1;
+    }
+
+    this->loop = loop;
+    this->handler = handler;
+    this->handlerArgument = arg;
+    this->stopRequested.store(false, std::memory_order_relaxed);
+
+    if (loop->addFd(this->notifyFd, EPOLLIN, notifyEventHandler, this) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    int res = pthread_create(&this->thread, NULL, threadMain, this);
+    if (res != 0) {
+        errno = res;
+        perror("Create receive thread");
+        logPosition();
+        loop->removeFd(this->notifyFd);
+        return -1;
+    }
+    this->threadStarted = true;
+    return 0;
+}
+
+int RecvShard::stop()
+{
+    if (!this->threadStarted)
+        return 0;
+
+    this->stopRequested.store(true, std::memory_order_relaxed);
+    uint64_t value = 1;
+    if (write(this->wakeFd, &value, sizeof(value)) == -1) {
+        perror("Wake receive thread");
+        logPosition();
+        return -1;
+    }
+
+    int res = pthread_join(this->thread, NULL);
+    if (res != 0) {
+        errno = res;
+        perror("Join receive thread");
+        logPosition();
+        return -1;
+    }
+    this->threadStarted = false;
+
+    if (this->loop->removeFd(this->notifyFd) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    // datagrams left in the ring are dropped, as they would be in the socket
+    size_t available = this->queue.available();
+    for (size_t i = 0; i < available; ++i)
+        this->queue.itemAt(i)->buffer->release();
+    this->queue.commitPop(available);
+    return 0;
+}
+
+static bool isBroadcastDestination(struct msghdr *header)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg)) {
+        if (cmsg->cmsg_level != IPPROTO_IP || cmsg->cmsg_type != IP_PKTINFO)
+            continue;
+
+        struct in_pktinfo packetInfo;
+        memcpy(&packetInfo, CMSG_DATA(cmsg), sizeof(packetInfo));
+        // ipi_addr is the destination from the IP header, ipi_spec_dst
+        // the local address: they differ for subnet broadcasts
+        return packetInfo.ipi_addr.s_addr != packetInfo.ipi_spec_dst.s_addr
+            || packetInfo.ipi_addr.s_addr == htonl(INADDR_BROADCAST);
+    }
+    return false;
+}
+
+// Receive thread side. Returns the count of queued datagrams,
+// 0 when the socket is empty or the ring or the pool is full, -1 on error.
+int RecvShard::drainSocket()
+{
+    struct mmsghdr messages[RECV_BATCH_SIZE];
+    struct iovec vectors[RECV_BATCH_SIZE];
+
+    size_t freeSlots = this->queue.freeSlots();
+    if (freeSlots > RECV_BATCH_SIZE)
+        freeSlots = RECV_BATCH_SIZE;
+
+    size_t batchSize = 0;
+    for (; batchSize < freeSlots; ++batchSize) {
+        struct RecvBuffer *buffer = this->pool->acquire();
+        if (buffer == NULL)
+            break;
+        this->queue.slotAt(batchSize)->buffer = buffer;
+    }
+    // out of ring slots or pool buffers: the socket may stay readable
+    this->backlogged = freeSlots == 0 || batchSize < freeSlots;
+    if (batchSize == 0)
+        return 0;
+
+    for (size_t i = 0; i < batchSize; ++i) {
+        struct ShardDatagram *datagram = this->queue.slotAt(i);
+        vectors[i].iov_base = datagram->buffer->data + RECV_BUFFER_HEADROOM;
+        vectors[i].iov_len = RECV_BUFFER_SIZE;
+
+        struct msghdr *header = &messages[i].msg_hdr;
+        memset(header, 0, sizeof(struct msghdr));
+        header->msg_name = &datagram->senderAddress;
+        header->msg_namelen = sizeof(struct sockaddr_in);
+        header->msg_iov = &vectors[i];
+        header->msg_iovlen = 1;
+        header->msg_control = datagram->control;
+        header->msg_controllen = sizeof(datagram->control);
+    }
+
+    int count = recvmmsg(this->socketFd, messages, batchSize, MSG_DONTWAIT, NULL);
+    int res = count;
+    if (count < 0) {
+        count = 0;
+        res = 0;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("Receive shard dgram batch");
+            logPosition();
+            res = -1;
+        }
+    }
+
+    for (size_t i = count; i < batchSize; ++i)
+        this->queue.slotAt(i)->buffer->release();
+
+    for (int i = 0; i < count; ++i) {
+        struct ShardDatagram *datagram = this->queue.slotAt(i);
+        datagram->messageSize = messages[i].msg_len;
+        datagram->isBroadcast = isBroadcastDestination(&messages[i].msg_hdr);
+    }
+    this->queue.commitPush(count);
+    return res;
+}
+
+void *RecvShard::threadMain(void *arg)
+{
+    struct RecvShard *self = (struct RecvShard*)arg;
+
+    if (self->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(self->cpu, &cpus);
+        int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+        if (res != 0) {
+            errno = res;
+            perror("Set receive thread affinity");
+            logPosition();
+        }
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = self->wakeFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = self->socketFd;
+    fds[1].events = POLLIN;
+
+    self->backlogged = false;
+    bool backlogged = false;
+    while (!self->stopRequested.load(std::memory_order_relaxed)) {
+        // the socket stays readable while the ring is full: wait for the owner
+        int res = backlogged
+            ? poll(fds, 1, RECV_SHARD_BACKLOG_POLL_MS)
+            : poll(fds, 2, -1);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Poll receive shard");
+            logPosition();
+            break;
+        }
+
+        int queued = 0;
+        while (!self->stopRequested.load(std::memory_order_relaxed)) {
+            int count = self->drainSocket();
+            if (count == -1)
+                break;
+            queued += count;
+            if (count < RECV_BATCH_SIZE)
+                break;
+        }
+        backlogged = self->backlogged;
+
+        if (queued > 0) {
+            uint64_t value = 1;
+            if (write(self->notifyFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+                perror("Notify receive shard owner");
+                logPosition();
+            }
+        }
+    }
+    return NULL;
+}
+
+// Owner loop side
+void RecvShard::dispatchQueued()
+{
+    struct RecvDatagram datagrams[RECV_BATCH_SIZE];
+
+    size_t available;
+    while ((available = this->queue.available()) > 0) {
+        if (available > RECV_BATCH_SIZE)
+            available = RECV_BATCH_SIZE;
+
+        size_t count = 0;
+        for (size_t i = 0; i < available; ++i) {
+            struct ShardDatagram *queued = this->queue.itemAt(i);
+            if (queued->isBroadcast)
+                continue;
+            datagrams[count].senderAddress = queued->senderAddress;
+            datagrams[count].buffer = queued->buffer;
+            datagrams[count].message = queued->buffer->data + RECV_BUFFER_HEADROOM;
+            datagrams[count].messageSize = queued->messageSize;
+            ++count;
+        }
+
+        if (count > 0)
+            this->handler(datagrams, count, this->handlerArgument);
+
+        // buffers retained by the handler stay out of the pool
+        for (size_t i = 0; i < available; ++i)
+            this->queue.itemAt(i)->buffer->release();
+        this->queue.commitPop(available);
+    }
+}
+
+void RecvShard::notifyEventHandler(uint32_t events, void *arg)
+{
+    struct RecvShard *self = (struct RecvShard*)arg;
+
+    uint64_t value;
+    if (read(self->notifyFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("Read receive shard notification");
+        logPosition();
+    }
+
+    self->dispatchQueued();
+}
@@ -0,0 +1,434 @@
+#include "simnetwork.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "eventloop.h"
+#include "logging.h"
+
+#define SIM_INITIAL_ENDPOINTS_CAPACITY 64
+#define SIM_INITIAL_IN_FLIGHT_CAPACITY 256
+#define SIM_INITIAL_BUFFERS_COUNT 256
+
+void SimNetworkConfig::setDefaults()
+{
+    this->udpPort = 10500;
+    this->latencyMs = 1;
+    this->jitterMs = 0;
+    this->seed = 1;
+    this->recvBufferDatagrams = 0;
+    this->recvDrainPerMs = 1;
+}
+
+static struct SimEndpoint *toEndpoint(struct Transport *transport)
+{
+    return (struct SimEndpoint *)transport;
+}
+
+static int simBroadcastDgram(struct Transport *transport, unsigned char *content, size_t contentSize)
+{
+    struct SimEndpoint *endpoint = toEndpoint(transport);
+    return endpoint->network->sendDgram(endpoint, -1, content, contentSize);
+}
+
+static int simSendDgram(struct Transport *transport, struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize)
+{
+    struct SimEndpoint *endpoint = toEndpoint(transport);
+
+    uint32_t address = ntohl(peerAddress->sin_addr.s_addr);
+    if (address == INADDR_BROADCAST)
+        return endpoint->network->sendDgram(endpoint, -1, content, contentSize);
+
+    int destination = (int)(address - SIM_NETWORK_BASE_ADDRESS) - 1;
+    return endpoint->network->sendDgram(endpoint, destination, content, contentSize);
+}
+
+static int simStartRecv(struct Transport *transport, RecvBatchHandler handler, void *arg)
+{
+    struct SimEndpoint *endpoint = toEndpoint(transport);
+    if (endpoint->recvStarted) {
+        logPosition();
+        return -1;
+    }
+    endpoint->handler = handler;
+    endpoint->handlerArgument = arg;
+    endpoint->recvStarted = true;
+    return 0;
+}
+
+static int simStopRecv(struct Transport *transport)
+{
+    toEndpoint(transport)->recvStarted = false;
+    return 0;
+}
+
+static const struct TransportOps simTransportOps = {
+    simBroadcastDgram,
+    simSendDgram,
+    simStartRecv,
+    simStopRecv
+};
+
+int SimNetwork::init(struct SimNetworkConfig *config, struct EventLoop *loop)
+{
+    this->config = *config;
+    this->loop = loop;
+    this->endpointsCount = 0;
+    this->endpointsCapacity = 0;
+    this->endpoints = NULL;
+    this->inFlightCount = 0;
+    this->inFlightCapacity = 0;
+    this->inFlight = NULL;
+    this->nextSequence = 0;
+    this->deliveryTimerArmed = false;
+    this->deliveryTimerDeadline = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+
+    this->bufferPoolsCount = 0;
+    if (this->addBufferPool() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    TimerHandlerArgument arg;
+    arg.ptrValue = this;
+    if (this->deliveryTimer.init(&loop->timerSystem, 0, false, deliveryTimeoutHandler, arg) == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int SimNetwork::deinit()
+{
+    if (this->deliveryTimer.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    // datagrams still on their way are lost
+    for (size_t i = 0; i < this->inFlightCount; ++i)
+        this->inFlight[i].buffer->release();
+    free(this->inFlight);
+    this->inFlight = NULL;
+    this->inFlightCount = 0;
+
+    free(this->endpoints);
+    this->endpoints = NULL;
+    this->endpointsCount = 0;
+
+    for (int i = 0; i < this->bufferPoolsCount; ++i) {
+        if (this->bufferPools[i]->deinit() == -1) {
+            logPosition();
+            return -1;
+        }
+        free(this->bufferPools[i]);
+    }
+    this->bufferPoolsCount = 0;
+    return 0;
+}
+
+int SimNetwork::addBufferPool()
+{
+    if (this->bufferPoolsCount == SIM_MAX_BUFFER_POOLS)
+        return -1;
+
+    struct RecvBufferPool *pool = (struct RecvBufferPool *)malloc(sizeof(struct RecvBufferPool));
+    if (pool == NULL) {
+        logPosition();
+        return -1;
+    }
+    if (pool->init(SIM_INITIAL_BUFFERS_COUNT) == -1) {
+        free(pool);
+        logPosition();
+        return -1;
+    }
+    this->bufferPools[this->bufferPoolsCount++] = pool;
+    return 0;
+}
+
+// NULL when all pools are exhausted and no more may be added
+struct RecvBuffer *SimNetwork::acquireBuffer()
+{
+    for (int i = this->bufferPoolsCount - 1; i >= 0; --i) {
+        struct RecvBuffer *buffer = this->bufferPools[i]->acquire();
+        if (buffer != NULL)
+            return buffer;
+    }
+    if (this->addBufferPool() == -1)
+        return NULL;
+    return this->bufferPools[this->bufferPoolsCount - 1]->acquire();
+}
+
+int SimNetwork::addEndpoint(struct SimEndpoint *endpoint)
+{
+    if (this->endpointsCount == this->endpointsCapacity) {
+        int capacity = this->endpointsCapacity > 0 ? this->endpointsCapacity * 2 : SIM_INITIAL_ENDPOINTS_CAPACITY;
+        struct SimEndpoint **endpoints = (struct SimEndpoint **)realloc(this->endpoints, capacity * sizeof(struct SimEndpoint *));
+        if (endpoints == NULL) {
+            logPosition();
+            return -1;
+        }
+        this->endpoints = endpoints;
+        this->endpointsCapacity = capacity;
+    }
+
+    endpoint->transport.ops = &simTransportOps;
+    endpoint->network = this;
+    endpoint->index = this->endpointsCount;
+    endpoint->segment = 0;
+    endpoint->recvStarted = false;
+    endpoint->handler = NULL;
+    endpoint->handlerArgument = NULL;
+    endpoint->recvBufferUsed = 0;
+    endpoint->recvBufferTime = 0;
+
+    memset(&endpoint->address, 0, sizeof(struct sockaddr_in));
+    endpoint->address.sin_family = AF_INET;
+    endpoint->address.sin_port = htons(this->config.udpPort);
+    endpoint->address.sin_addr.s_addr = htonl(SIM_NETWORK_BASE_ADDRESS + endpoint->index + 1);
+
+    this->endpoints[this->endpointsCount++] = endpoint;
+    return 0;
+}
+
+void SimNetwork::getStats(struct SimNetworkStats *stats)
+{
+    *stats = this->stats;
+}
+
+void SimNetwork::setSegment(int index, int segment)
+{
+    this->endpoints[index]->segment = segment;
+}
+
+int SimNetwork::deliveryDelay()
+{
+    int delay = this->config.latencyMs;
+    if (this->config.jitterMs > 0)
+        delay += rand_r(&this->config.seed) % (this->config.jitterMs + 1);
+    return delay;
+}
+
+int SimNetwork::sendDgram(struct SimEndpoint *sender, int destination, unsigned char *content, size_t contentSize)
+{
+    if (contentSize > RECV_BUFFER_SIZE) {
+        logPosition();
+        return -1;
+    }
+
+    if (destination == -1) {
+        ++this->stats.broadcastsSent;
+    }
+    else {
+        ++this->stats.unicastsSent;
+        if (destination < 0 || destination >= this->endpointsCount) {
+            // lost, as a datagram to an absent host
+            ++this->stats.unroutable;
+            return contentSize;
+        }
+    }
+    this->stats.bytesSent += contentSize;
+
+    struct RecvBuffer *buffer = this->acquireBuffer();
+    if (buffer == NULL) {
+        ++this->stats.drops;
+        return contentSize;
+    }
+    memcpy(buffer->data + RECV_BUFFER_HEADROOM, content, contentSize);
+
+    struct SimInFlight datagram;
+    datagram.source = sender->index;
+    datagram.destination = destination;
+    datagram.senderAddress = sender->address;
+    datagram.buffer = buffer;
+    datagram.size = contentSize;
+
+    uint64_t now = this->loop->timerSystem.getTime();
+
+    // with jitter each endpoint gets its copy of a broadcast at its own time
+    if (destination == -1 && this->config.jitterMs > 0) {
+        for (int i = 0; i < this->endpointsCount; ++i) {
+            datagram.destination = i;
+            datagram.deliveryTime = now + this->deliveryDelay();
+            buffer->retain();
+            if (this->pushInFlight(&datagram) == -1) {
+                buffer->release();
+                ++this->stats.drops;
+            }
+        }
+        // the reference taken by acquire
+        buffer->release();
+        return contentSize;
+    }
+
+    datagram.deliveryTime = now + this->deliveryDelay();
+    if (this->pushInFlight(&datagram) == -1) {
+        buffer->release();
+        ++this->stats.drops;
+    }
+    return contentSize;
+}
+
+static bool isDeliveredBefore(struct SimInFlight *a, struct SimInFlight *b)
+{
+    if (a->deliveryTime != b->deliveryTime)
+        return a->deliveryTime < b->deliveryTime;
+    return a->sequence < b->sequence;
+}
+
+int SimNetwork::pushInFlight(struct SimInFlight *datagram)
+{
+    if (this->inFlightCount == this->inFlightCapacity) {
+        size_t capacity = this->inFlightCapacity > 0 ? this->inFlightCapacity * 2 : SIM_INITIAL_IN_FLIGHT_CAPACITY;
+        struct SimInFlight *inFlight = (struct SimInFlight *)realloc(this->inFlight, capacity * sizeof(struct SimInFlight));
+        if (inFlight == NULL) {
+            logPosition();
+            return -1;
+        }
+        this->inFlight = inFlight;
+        this->inFlightCapacity = capacity;
+    }
+
+    datagram->sequence = this->nextSequence++;
+
+    // sift up
+    size_t index = this->inFlightCount++;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!isDeliveredBefore(datagram, &this->inFlight[parent]))
+            break;
+        this->inFlight[index] = this->inFlight[parent];
+        index = parent;
+    }
+    this->inFlight[index] = *datagram;
+
+    if (index == 0 && (!this->deliveryTimerArmed || datagram->deliveryTime < this->deliveryTimerDeadline))
+        return this->armDeliveryTimer();
+    return 0;
+}
+
+void SimNetwork::popInFlight(struct SimInFlight *datagram)
+{
+    *datagram = this->inFlight[0];
+
+    struct SimInFlight last = this->inFlight[--this->inFlightCount];
+    size_t count = this->inFlightCount;
+
+    // sift down
+    size_t index = 0;
+    while (true) {
+        size_t child = index * 2 + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && isDeliveredBefore(&this->inFlight[child + 1], &this->inFlight[child]))
+            ++child;
+        if (!isDeliveredBefore(&this->inFlight[child], &last))
+            break;
+        this->inFlight[index] = this->inFlight[child];
+        index = child;
+    }
+    if (count > 0)
+        this->inFlight[index] = last;
+}
+
+int SimNetwork::armDeliveryTimer()
+{
+    if (this->inFlightCount == 0) {
+        this->deliveryTimerArmed = false;
+        return this->deliveryTimer.stop();
+    }
+
+    uint64_t deadline = this->inFlight[0].deliveryTime;
+    uint64_t now = this->loop->timerSystem.getTime();
+
+    if (this->deliveryTimer.setInterval(deadline > now ? (int)(deadline - now) : 0) == -1
+            || this->deliveryTimer.start() == -1) {
+        logPosition();
+        return -1;
+    }
+    this->deliveryTimerArmed = true;
+    this->deliveryTimerDeadline = deadline;
+    return 0;
+}
+
+// The buffer is drained by the time passed since the last datagram, then
+// takes this one if it has room
+bool SimNetwork::acceptIntoRecvBuffer(struct SimEndpoint *endpoint, uint64_t now)
+{
+    if (this->config.recvBufferDatagrams <= 0)
+        return true;
+
+    uint64_t drained = (now - endpoint->recvBufferTime) * this->config.recvDrainPerMs;
+    if (drained >= (uint64_t)endpoint->recvBufferUsed)
+        endpoint->recvBufferUsed = 0;
+    else
+        endpoint->recvBufferUsed -= (int)drained;
+    endpoint->recvBufferTime = now;
+
+    if (endpoint->recvBufferUsed >= this->config.recvBufferDatagrams)
+        return false;
+    ++endpoint->recvBufferUsed;
+    return true;
+}
+
+void SimNetwork::deliver(struct SimInFlight *datagram)
+{
+    struct RecvDatagram received;
+    received.senderAddress = datagram->senderAddress;
+    received.message = datagram->buffer->data + RECV_BUFFER_HEADROOM;
+    received.messageSize = datagram->size;
+    received.buffer = datagram->buffer;
+
+    int first = datagram->destination;
+    int last = datagram->destination;
+    // as with a real broadcast, the sender receives its own datagram too
+    if (datagram->destination == -1) {
+        first = 0;
+        last = this->endpointsCount - 1;
+    }
+
+    int segment = this->endpoints[datagram->source]->segment;
+    for (int i = first; i <= last; ++i) {
+        struct SimEndpoint *endpoint = this->endpoints[i];
+        if (!endpoint->recvStarted)
+            continue;
+        if (endpoint->segment != segment) {
+            ++this->stats.partitioned;
+            continue;
+        }
+        if (!this->acceptIntoRecvBuffer(endpoint, datagram->deliveryTime)) {
+            ++this->stats.overflows;
+            continue;
+        }
+        ++this->stats.deliveries;
+        endpoint->handler(&received, 1, endpoint->handlerArgument);
+    }
+    datagram->buffer->release();
+}
+
+void SimNetwork::deliverDue()
+{
+    uint64_t now = this->loop->timerSystem.getTime();
+
+    while (this->inFlightCount > 0 && this->inFlight[0].deliveryTime <= now) {
+        struct SimInFlight datagram;
+        this->popInFlight(&datagram);
+        // handlers may send, which pushes into the heap
+        this->deliver(&datagram);
+    }
+
+    if (this->armDeliveryTimer() == -1) {
+        logPosition();
+    }
+}
+
+void SimNetwork::deliveryTimeoutHandler(TimerHandlerArgument arg)
+{
+    struct SimNetwork *self = (struct SimNetwork*)arg.ptrValue;
+    self->deliveryTimerArmed = false;
+    self->deliverDue();
+}
@@ -0,0 +1,148 @@
+#ifndef SIMNETWORK_H
+#define SIMNETWORK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include "transport.h"
+#include "networking.h"
+#include "recvbufferpool.h"
+#include "timers.h"
+
+// endpoint i has address 10.0.0.0 + i + 1
+#define SIM_NETWORK_BASE_ADDRESS 0x0a000000u
+// Hosts keep buffers past delivery, e.g. nodes the text of the last
+// ControlSet, so one pool may not do for a large network
+#define SIM_MAX_BUFFER_POOLS 64
+
+struct SimNetworkConfig
+{
+    uint16_t udpPort;
+    // delivery delay is latencyMs plus a uniform random 0..jitterMs
+    int latencyMs;
+    int jitterMs;
+    unsigned int seed;
+    // Socket receive buffer of each endpoint in datagrams, 0 for an
+    // unlimited one. The receiver drains recvDrainPerMs datagrams per ms
+    // of the clock, a burst beyond the buffer is dropped (incast).
+    int recvBufferDatagrams;
+    int recvDrainPerMs;
+
+    void setDefaults();
+};
+
+struct SimNetworkStats
+{
+    uint64_t unicastsSent;
+    uint64_t broadcastsSent;
+    uint64_t bytesSent;
+    // datagrams handed to receive handlers
+    uint64_t deliveries;
+    // sent to an address without a receiving endpoint
+    uint64_t unroutable;
+    // out of receive buffers, as a real receiver dropping a burst
+    uint64_t drops;
+    // dropped by a full receive buffer of the destination
+    uint64_t overflows;
+    // not delivered between endpoints of different segments
+    uint64_t partitioned;
+};
+
+struct SimNetwork;
+
+// One host of the simulated network. Its Transport is put into the
+// NetworkingConfig of the node the endpoint belongs to.
+struct SimEndpoint
+{
+    struct Transport transport;
+
+    struct SimNetwork *network;
+    int index;
+    struct sockaddr_in address;
+    // only endpoints of the same segment reach each other, all are in 0
+    // until the network is partitioned
+    int segment;
+
+    bool recvStarted;
+    RecvBatchHandler handler;
+    void *handlerArgument;
+
+    // datagrams in the receive buffer as of recvBufferTime
+    int recvBufferUsed;
+    uint64_t recvBufferTime;
+};
+
+// A datagram on its way. A broadcast shares its buffer between
+// the deliveries to each endpoint.
+struct SimInFlight
+{
+    uint64_t deliveryTime;
+    // ties are delivered in send order
+    uint64_t sequence;
+    // index of the sending endpoint
+    int source;
+    // -1 for every endpoint
+    int destination;
+    struct sockaddr_in senderAddress;
+    struct RecvBuffer *buffer;
+    size_t size;
+};
+
+// In-memory network delivering datagrams between the endpoints of one
+// event loop. Datagrams are delivered from a timer of the loop, never
+// from inside the send, as with a real network.
+struct SimNetwork
+{
+    struct SimNetworkConfig config;
+    struct EventLoop *loop;
+
+    struct SimEndpoint **endpoints;
+    int endpointsCount;
+    int endpointsCapacity;
+
+    // binary min-heap by delivery time
+    struct SimInFlight *inFlight;
+    size_t inFlightCount;
+    size_t inFlightCapacity;
+    uint64_t nextSequence;
+
+    // allocated one by one as the former ones run out
+    struct RecvBufferPool *bufferPools[SIM_MAX_BUFFER_POOLS];
+    int bufferPoolsCount;
+    struct Timer deliveryTimer;
+    bool deliveryTimerArmed;
+    uint64_t deliveryTimerDeadline;
+
+    struct SimNetworkStats stats;
+
+    int init(struct SimNetworkConfig *config, struct EventLoop *loop);
+    int deinit();
+
+    // The endpoint must stay at its place until the network is deinited
+    int addEndpoint(struct SimEndpoint *endpoint);
+
+    void getStats(struct SimNetworkStats *stats);
+
+    // Datagrams in flight are dropped as well when they arrive across
+    // segments. Putting every endpoint back into 0 heals the network.
+    void setSegment(int index, int segment);
+
+    int sendDgram(struct SimEndpoint *sender, int destination, unsigned char *content, size_t contentSize);
+
+private:
+    int addBufferPool();
+    struct RecvBuffer *acquireBuffer();
+    int pushInFlight(struct SimInFlight *datagram);
+    void popInFlight(struct SimInFlight *datagram);
+    int deliveryDelay();
+    int armDeliveryTimer();
+    bool acceptIntoRecvBuffer(struct SimEndpoint *endpoint, uint64_t now);
+    void deliver(struct SimInFlight *datagram);
+    void deliverDue();
+
+    static void deliveryTimeoutHandler(TimerHandlerArgument arg);
+};
+
+#endif // SIMNETWORK_H
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simulation.h"
+#include "logging.h"
+
+// Runs election scenarios on the virtual clock: all nodes start at once
+// and the simulation runs for the given virtual time. Prints one
+// tab-separated line per seed:
+// seed, nodes, ms to a single master, unicasts, broadcasts, bytes sent,
+// deliveries, receive buffer overflows, election messages sent and
+// received, split brain ms, peak masters, masters at the end, control
+// rounds, rounds closed by quorum, mean round ms, wall ms.
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-n nodes] [-s first seed] [-r runs] [-d virtual ms] [-l latency ms] [-j jitter ms] [-w wire version] [-q round quorum] [-b receive buffer datagrams] [-R drained datagrams per ms] [-a aggregation degree] [-h heartbeat ms] [-p phi threshold]\n", program);
+}
+
+static uint64_t nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int runScenario(struct SimulationConfig *config, uint64_t duration)
+{
+    uint64_t startTime = nowMs();
+
+    struct Simulation simulation;
+    if (simulation.init(config) == -1) {
+        logPosition();
+        return -1;
+    }
+    if (simulation.startAllNodes() == -1 || simulation.runFor(duration) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    struct SimulationStats stats;
+    simulation.getStats(&stats);
+
+    if (simulation.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    printf("%u\t%d\t%lld\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%d\t%d\t%llu\t%llu\t%.1f\t%llu\n",
+        config->seed, config->nodesCount,
+        (long long)stats.firstSingleMasterTime,
+        (unsigned long long)stats.network.unicastsSent,
+        (unsigned long long)stats.network.broadcastsSent,
+        (unsigned long long)stats.network.bytesSent,
+        (unsigned long long)stats.network.deliveries,
+        (unsigned long long)stats.network.overflows,
+        (unsigned long long)(stats.election.whoIsMasterSent + stats.election.iAmMasterSent + stats.election.pleaseWaitSent),
+        (unsigned long long)stats.election.messagesReceived,
+        (unsigned long long)stats.splitBrainTime,
+        stats.peakMastersCount, stats.mastersCount,
+        (unsigned long long)stats.rounds.roundsCount,
+        (unsigned long long)stats.rounds.quorumRoundsCount,
+        stats.rounds.roundsCount > 0 ? (double)stats.rounds.totalLatency / stats.rounds.roundsCount : 0.0,
+        (unsigned long long)(nowMs() - startTime));
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    setLogInfoEnabled(false);
+
+    struct SimulationConfig config;
+    config.setDefaults();
+    int runs = 1;
+    uint64_t duration = 60000;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:s:r:d:l:j:w:q:b:R:a:h:p:")) != -1) {
+        switch (option) {
+        case 'n':
+            config.nodesCount = atoi(optarg);
+            break;
+        case 's':
+            config.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'd':
+            duration = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            config.network.latencyMs = atoi(optarg);
+            break;
+        case 'j':
+            config.network.jitterMs = atoi(optarg);
+            break;
+        case 'b':
+            config.network.recvBufferDatagrams = atoi(optarg);
+            break;
+        case 'R':
+            config.network.recvDrainPerMs = atoi(optarg);
+            break;
+        case 'a':
+            config.aggregationDegree = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            config.heartbeatIntervalMs = atoi(optarg);
+            break;
+        case 'p':
+            config.phiThreshold = atof(optarg);
+            break;
+        case 'q':
+            config.roundQuorum = atof(optarg);
+            break;
+        case 'w':
+            config.wireVersion = atoi(optarg) == 1 ? WireV1 : WireV2;
+            break;
+        default:
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    printf("seed\tnodes\tsingle master ms\tunicasts\tbroadcasts\tbytes\tdeliveries\toverflows\telection sent\telection received\tsplit brain ms\tpeak masters\tmasters\trounds\tquorum rounds\tround ms\twall ms\n");
+
+    unsigned int firstSeed = config.seed;
+    for (int i = 0; i < runs; ++i) {
+        config.seed = firstSeed + i;
+        if (runScenario(&config, duration) == -1)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+#include "simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+void SimulationConfig::setDefaults()
+{
+    this->nodesCount = 3;
+    this->network.setDefaults();
+    this->seed = 1;
+    this->wireVersion = WireV2;
+    this->roundQuorum = 1;
+    this->aggregationDegree = 0;
+    this->heartbeatIntervalMs = 1000;
+    this->phiThreshold = 8;
+}
+
+int Simulation::init(struct SimulationConfig *config)
+{
+    this->config = *config;
+    this->endpoints = NULL;
+    this->identities = NULL;
+    this->nodes = NULL;
+    this->running = NULL;
+
+    this->runningCount = 0;
+    this->mastersCount = 0;
+    this->slavesCount = 0;
+    this->firstSingleMasterTime = -1;
+    this->singleMasterSince = -1;
+    this->splitBrainTime = 0;
+    this->splitBrainSince = 0;
+    this->peakMastersCount = 0;
+
+    int nodesCount = config->nodesCount;
+    if (nodesCount <= 0) {
+        logPosition();
+        return -1;
+    }
+
+    // the nodes draw their sensor values from rand()
+    srand(config->seed);
+
+    if (this->loop.init() == -1) {
+        logPosition();
+        return -1;
+    }
+    if (this->loop.timerSystem.useVirtualClock(0) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    this->config.network.seed = config->seed;
+    if (this->network.init(&this->config.network, &this->loop) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    this->endpoints = (struct SimEndpoint *)calloc(nodesCount, sizeof(struct SimEndpoint));
+    this->identities = (struct NodeIdentity *)calloc(nodesCount, sizeof(struct NodeIdentity));
+    this->nodes = (struct SelfNode *)calloc(nodesCount, sizeof(struct SelfNode));
+    this->running = (bool *)calloc(nodesCount, sizeof(bool));
+    if (this->endpoints == NULL || this->identities == NULL || this->nodes == NULL || this->running == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    // the seed decides which node wins the election
+    unsigned int seed = config->seed;
+    for (int i = 0; i < nodesCount; ++i)
+        this->identities[i].processId = i + 1;
+    for (int i = nodesCount - 1; i > 0; --i) {
+        int j = rand_r(&seed) % (i + 1);
+        pid_t processId = this->identities[i].processId;
+        this->identities[i].processId = this->identities[j].processId;
+        this->identities[j].processId = processId;
+    }
+
+    for (int i = 0; i < nodesCount; ++i) {
+        if (this->network.addEndpoint(&this->endpoints[i]) == -1) {
+            logPosition();
+            return -1;
+        }
+
+        memset(this->identities[i].macAddress, 0x02, sizeof(this->identities[i].macAddress));
+
+        struct SelfNodeConfig nodeConfig;
+        nodeConfig.setDefaults();
+        nodeConfig.net.transport = &this->endpoints[i].transport;
+        nodeConfig.identity = &this->identities[i];
+        nodeConfig.wireVersion = config->wireVersion;
+        nodeConfig.roundQuorum = config->roundQuorum;
+        nodeConfig.aggregationDegree = config->aggregationDegree;
+        nodeConfig.heartbeatIntervalMs = config->heartbeatIntervalMs;
+        nodeConfig.phiThreshold = config->phiThreshold;
+        nodeConfig.stateHandler = Simulation::stateHandler;
+        nodeConfig.stateHandlerArgument = this;
+
+        if (this->nodes[i].init(&nodeConfig, &this->loop) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int Simulation::deinit()
+{
+    for (int i = 0; i < this->config.nodesCount; ++i) {
+        if (this->running[i] && this->stopNode(i) == -1) {
+            logPosition();
+            return -1;
+        }
+        if (this->nodes[i].deinit() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    if (this->network.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    free(this->running);
+    free(this->nodes);
+    free(this->identities);
+    free(this->endpoints);
+    this->running = NULL;
+    this->nodes = NULL;
+    this->identities = NULL;
+    this->endpoints = NULL;
+
+    if (this->loop.deinit() == -1) {
+        logPosition();
+        return -1;
+    }
+    return 0;
+}
+
+int Simulation::startNode(int index)
+{
+    if (index < 0 || index >= this->config.nodesCount || this->running[index]) {
+        logPosition();
+        return -1;
+    }
+
+    this->running[index] = true;
+    ++this->runningCount;
+
+    if (this->nodes[index].start() == -1) {
+        logPosition();
+        return -1;
+    }
+    this->updateSingleMaster();
+    return 0;
+}
+
+int Simulation::stopNode(int index)
+{
+    if (index < 0 || index >= this->config.nodesCount || !this->running[index]) {
+        logPosition();
+        return -1;
+    }
+
+    this->running[index] = false;
+    --this->runningCount;
+
+    // leaves the election through a state change to WithoutMaster
+    if (this->nodes[index].stop() == -1) {
+        logPosition();
+        return -1;
+    }
+    this->updateSingleMaster();
+    return 0;
+}
+
+int Simulation::shutdownNode(int index)
+{
+    if (index < 0 || index >= this->config.nodesCount || !this->running[index]) {
+        logPosition();
+        return -1;
+    }
+
+    if (this->nodes[index].handOver() == -1) {
+        logPosition();
+        return -1;
+    }
+    return this->stopNode(index);
+}
+
+int Simulation::setSegment(int index, int segment)
+{
+    if (index < 0 || index >= this->config.nodesCount) {
+        logPosition();
+        return -1;
+    }
+    this->network.setSegment(index, segment);
+    return 0;
+}
+
+int Simulation::startAllNodes()
+{
+    for (int i = 0; i < this->config.nodesCount; ++i) {
+        if (!this->running[i] && this->startNode(i) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int Simulation::runUntil(uint64_t time)
+{
+    return this->loop.timerSystem.advanceVirtualClock(time);
+}
+
+int Simulation::runFor(uint64_t duration)
+{
+    return this->runUntil(this->getTime() + duration);
+}
+
+uint64_t Simulation::getTime()
+{
+    return this->loop.timerSystem.getTime();
+}
+
+int Simulation::getMaster()
+{
+    if (this->mastersCount != 1)
+        return -1;
+
+    for (int i = 0; i < this->config.nodesCount; ++i) {
+        if (this->running[i] && this->nodes[i].getState() == Master)
+            return i;
+    }
+    return -1;
+}
+
+void Simulation::getStats(struct SimulationStats *stats)
+{
+    stats->time = this->getTime();
+    stats->runningCount = this->runningCount;
+    stats->mastersCount = this->mastersCount;
+    stats->slavesCount = this->slavesCount;
+    stats->firstSingleMasterTime = this->firstSingleMasterTime;
+    stats->singleMasterSince = this->singleMasterSince;
+    stats->peakMastersCount = this->peakMastersCount;
+
+    stats->splitBrainTime = this->splitBrainTime;
+    // the split brain still going on
+    if (this->mastersCount > 1)
+        stats->splitBrainTime += stats->time - this->splitBrainSince;
+
+    memset(&stats->rounds, 0, sizeof(struct ControlRoundStats));
+    for (int i = 0; i < this->config.nodesCount; ++i) {
+        struct ControlRoundStats rounds;
+        this->nodes[i].getControlRoundStats(&rounds);
+        stats->rounds.roundsCount += rounds.roundsCount;
+        stats->rounds.quorumRoundsCount += rounds.quorumRoundsCount;
+        stats->rounds.totalLatency += rounds.totalLatency;
+        if (rounds.maxLatency > stats->rounds.maxLatency)
+            stats->rounds.maxLatency = rounds.maxLatency;
+        if (rounds.roundsCount > 0)
+            stats->rounds.lastLatency = rounds.lastLatency;
+    }
+
+    memset(&stats->election, 0, sizeof(struct ElectionStats));
+    for (int i = 0; i < this->config.nodesCount; ++i) {
+        struct ElectionStats election;
+        this->nodes[i].getElectionStats(&election);
+        stats->election.whoIsMasterSent += election.whoIsMasterSent;
+        stats->election.whoIsMasterSuppressed += election.whoIsMasterSuppressed;
+        stats->election.iAmMasterSent += election.iAmMasterSent;
+        stats->election.iAmMasterRepliesCoalesced += election.iAmMasterRepliesCoalesced;
+        stats->election.pleaseWaitSent += election.pleaseWaitSent;
+        stats->election.messagesReceived += election.messagesReceived;
+    }
+
+    memset(&stats->splitBrain, 0, sizeof(struct SplitBrainStats));
+    for (int i = 0; i < this->config.nodesCount; ++i) {
+        struct SplitBrainStats splitBrain;
+        this->nodes[i].getSplitBrainStats(&splitBrain);
+        stats->splitBrain.competingMastersHeard += splitBrain.competingMastersHeard;
+        stats->splitBrain.collisionsCount += splitBrain.collisionsCount;
+        stats->splitBrain.yieldsCount += splitBrain.yieldsCount;
+        stats->splitBrain.totalDuration += splitBrain.totalDuration;
+        if (splitBrain.maxDuration > stats->splitBrain.maxDuration)
+            stats->splitBrain.maxDuration = splitBrain.maxDuration;
+        if (splitBrain.yieldsCount > 0)
+            stats->splitBrain.lastDuration = splitBrain.lastDuration;
+    }
+
+    this->network.getStats(&stats->network);
+}
+
+void Simulation::onStateChanged(enum NodeState oldState, enum NodeState newState)
+{
+    uint64_t now = this->getTime();
+    int oldMastersCount = this->mastersCount;
+
+    if (oldState == Master)
+        --this->mastersCount;
+    else if (oldState == Slave)
+        --this->slavesCount;
+
+    if (newState == Master)
+        ++this->mastersCount;
+    else if (newState == Slave)
+        ++this->slavesCount;
+
+    if (this->mastersCount > this->peakMastersCount)
+        this->peakMastersCount = this->mastersCount;
+
+    if (oldMastersCount <= 1 && this->mastersCount > 1)
+        this->splitBrainSince = now;
+    else if (oldMastersCount > 1 && this->mastersCount <= 1)
+        this->splitBrainTime += now - this->splitBrainSince;
+
+    this->updateSingleMaster();
+}
+
+// A single master is reached when every running node but it is its slave
+void Simulation::updateSingleMaster()
+{
+    bool isSingleMaster = this->mastersCount == 1 && this->slavesCount == this->runningCount - 1;
+
+    // slaves may still follow a master that has gone
+    int master = isSingleMaster ? this->getMaster() : -1;
+    if (master == -1)
+        isSingleMaster = false;
+    for (int i = 0; isSingleMaster && i < this->config.nodesCount; ++i) {
+        struct NodeIdentity masterId;
+        if (i != master && this->running[i]
+                && (!this->nodes[i].getMasterIdentity(&masterId)
+                    || NodeIdentity::compareNodeIdentities(&masterId, &this->identities[master]) != 0))
+            isSingleMaster = false;
+    }
+
+    if (!isSingleMaster) {
+        this->singleMasterSince = -1;
+        return;
+    }
+
+    if (this->singleMasterSince == -1) {
+        this->singleMasterSince = this->getTime();
+        if (this->firstSingleMasterTime == -1)
+            this->firstSingleMasterTime = this->singleMasterSince;
+    }
+}
+
+void Simulation::stateHandler(struct SelfNode *node, enum NodeState oldState, enum NodeState newState, void *arg)
+{
+    ((struct Simulation*)arg)->onStateChanged(oldState, newState);
+}
@@ -0,0 +1,110 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+
+#include "eventloop.h"
+#include "simnetwork.h"
+#include "nodes.h"
+
+struct SimulationConfig
+{
+    int nodesCount;
+    struct SimNetworkConfig network;
+    // seeds the network and the nodes, equal seeds give equal runs
+    unsigned int seed;
+    // broadcast format of all nodes
+    enum WireVersion wireVersion;
+    double roundQuorum;
+    // 0 for no aggregation tree
+    size_t aggregationDegree;
+    int heartbeatIntervalMs;
+    double phiThreshold;
+
+    void setDefaults();
+};
+
+// Times are virtual milliseconds since the simulation start,
+// -1 when the event has not happened
+struct SimulationStats
+{
+    uint64_t time;
+
+    int runningCount;
+    int mastersCount;
+    int slavesCount;
+
+    // first time the running nodes had a single master
+    int64_t firstSingleMasterTime;
+    // since when the current single master lasts
+    int64_t singleMasterSince;
+    // total time with more than one master
+    uint64_t splitBrainTime;
+    int peakMastersCount;
+
+    // control rounds of all nodes, maxLatency the largest of them
+    struct ControlRoundStats rounds;
+    // election messages of all nodes
+    struct ElectionStats election;
+    // split brains as the yielding masters have reported them,
+    // maxDuration the largest of them
+    struct SplitBrainStats splitBrain;
+
+    struct SimNetworkStats network;
+};
+
+// Runs nodes on the simulated network with a virtual clock: one thread,
+// no sleeping, every timer and delivery happens at its virtual time in
+// a reproducible order. The loop is never run, the simulation advances
+// its timers directly.
+struct Simulation
+{
+    struct SimulationConfig config;
+
+    struct EventLoop loop;
+    struct SimNetwork network;
+
+    struct SimEndpoint *endpoints;
+    struct NodeIdentity *identities;
+    struct SelfNode *nodes;
+    bool *running;
+
+    int runningCount;
+    int mastersCount;
+    int slavesCount;
+
+    int64_t firstSingleMasterTime;
+    int64_t singleMasterSince;
+    uint64_t splitBrainTime;
+    uint64_t splitBrainSince;
+    int peakMastersCount;
+
+    int init(struct SimulationConfig *config);
+    int deinit();
+
+    int startNode(int index);
+    // The node disappears from the network, as killed
+    int stopNode(int index);
+    // The node hands its mastership over, then stops, as on SIGTERM
+    int shutdownNode(int index);
+    int startAllNodes();
+    // Nodes of different segments do not reach each other, see
+    // SimNetwork::setSegment
+    int setSegment(int index, int segment);
+
+    int runUntil(uint64_t time);
+    int runFor(uint64_t duration);
+    uint64_t getTime();
+
+    // Index of the only master, -1 when there is none or several
+    int getMaster();
+    void getStats(struct SimulationStats *stats);
+
+private:
+    void onStateChanged(enum NodeState oldState, enum NodeState newState);
+    void updateSingleMaster();
+
+    static void stateHandler(struct SelfNode *node, enum NodeState oldState, enum NodeState newState, void *arg);
+};
+
+#endif // SIMULATION_H
@@ -0,0 +1,101 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+#define CACHE_LINE_SIZE 64
+
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. Positions grow monotonically and are masked on access, so a full
+// ring and an empty ring are never confused. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+struct SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // written by the consumer only
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+    // written by the producer only
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+
+    alignas(CACHE_LINE_SIZE) T items[Capacity];
+
+    void init()
+    {
+        this->head.store(0, std::memory_order_relaxed);
+        this->tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side. Returns false if the ring is full.
+    bool push(const T &item)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        // acquire: the consumer has finished reading the slot being reused
+        if (tail - this->head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        this->items[tail & (Capacity - 1)] = item;
+        // release: the item is visible before the new tail
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T *item)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        // acquire: pairs with the release of push
+        if (head == this->tail.load(std::memory_order_acquire))
+            return false;
+
+        *item = this->items[head & (Capacity - 1)];
+        // release: the slot may be reused by the producer
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // In-place access lets both sides work on slots without copying items.
+    // Producer side: fill freeSlots() slots through slotAt(), then
+    // publish them with commitPush().
+    size_t freeSlots()
+    {
+        return Capacity - (this->tail.load(std::memory_order_relaxed) - this->head.load(std::memory_order_acquire));
+    }
+
+    T *slotAt(size_t offset)
+    {
+        return &this->items[(this->tail.load(std::memory_order_relaxed) + offset) & (Capacity - 1)];
+    }
+
+    void commitPush(size_t count)
+    {
+        this->tail.store(this->tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Consumer side: read available() items through itemAt(), then
+    // give their slots back with commitPop().
+    size_t available()
+    {
+        return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_relaxed);
+    }
+
+    T *itemAt(size_t offset)
+    {
+        return &this->items[(this->head.load(std::memory_order_relaxed) + offset) & (Capacity - 1)];
+    }
+
+    void commitPop(size_t count)
+    {
+        this->head.store(this->head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Exact only when called from the producer or the consumer thread
+    size_t size()
+    {
+        return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+    }
+};
+
+#endif // SPSCQUEUE_H
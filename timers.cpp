@@ -3,94 +3,134 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
 
 // timers
 #include <time.h>
-#include <signal.h>
+#include <sys/timerfd.h>
 
+#include "eventloop.h"
 #include "logging.h"
 
-#define MAX_TIMERS_COUNT 10
-#define TIMEOUTS_QUEUE_SIZE 20
-
-#define TIMEOUT_SIGNAL_CODE SIGUSR1
-
-struct TimerDescriptor
+uint64_t TimerSystem::now()
 {
-    bool created;
-    int nextFreeIndex;
-
-    bool isArmed;
-    int timeout;
-    bool isInterval;
-
-    timer_t timerId;
-    TimerHandler handler;
-    TimerHandlerArgument handlerArgument;
-};
-
-static void signalHandler(int sig, siginfo_t *si, void *uc);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-struct TimerSystem
+int TimerSystem::init(struct EventLoop *loop)
 {
-private:
-    bool isInited;
-
-    struct TimerDescriptor timers[MAX_TIMERS_COUNT];
-    int firstFreeIndex;
-
-    volatile int timeoutQueue[TIMEOUTS_QUEUE_SIZE];
-    volatile int timeoutHead;
-    volatile int timeoutTail;
+    this->isInited = false;
+    this->chunks = NULL;
+    this->chunksCount = 0;
+    this->firstFreeIndex = -1;
+    this->isVirtualClock = false;
+    this->virtualTime = 0;
+
+    this->wheel.init(TimerSystem::now());
+
+    this->timeoutQueue.init();
+    this->expirationsCount.store(0, std::memory_order_relaxed);
+    this->overrunsCount.store(0, std::memory_order_relaxed);
+    this->overflowsCount.store(0, std::memory_order_relaxed);
+    this->overflowHead = -1;
+    this->overflowTail = -1;
+
+    this->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (this->timerFd == -1) {
+        perror("timerfd_create");
+        logPosition();
+        return -1;
+    }
+    this->timerFdArmed = false;
+    this->timerFdDeadline = 0;
 
-public:
-    int init();
-    int createTimer(int interval, bool repeat, TimerHandler handler, TimerHandlerArgument argument);
-    int startTimerByIndex(int index);
-    int stopTimerByIndex(int index);
-    int deleteTimerByIndex(int index);
+    if (loop->addFd(this->timerFd, EPOLLIN, TimerSystem::timerFdEventHandler, this) == -1) {
+        logPosition();
+        return -1;
+    }
+    this->loop = loop;
 
-    int runAllTimeouts();
+    this->isInited = true;
+    return 0;
+}
 
+int TimerSystem::deinit()
+{
+    if (!this->isInited)
+        return 0;
 
-    int lockTimers(sigset_t *old_mask);
-    int unlockTimers(const sigset_t *old_mask);
-private:
-    int getNextTimerIndex();
-    int raiseTimerByIndex(int index);
+    this->isInited = false;
 
-    static int registerSignalHandler();
+    for (int i = 0; i < this->chunksCount; ++i)
+        free(this->chunks[i]);
+    free(this->chunks);
+    this->chunks = NULL;
+    this->chunksCount = 0;
+    this->firstFreeIndex = -1;
 
-    friend void signalHandler(int sig, siginfo_t *si, void *uc);
-} timerSystem;
+    if (this->loop->removeFd(this->timerFd) == -1) {
+        logPosition();
+        return -1;
+    }
+    if (close(this->timerFd) == -1) {
+        logPosition();
+        return -1;
+    }
+    this->timerFd = -1;
+    return 0;
+}
 
-int TimerSystem::init()
+struct TimerDescriptor *TimerSystem::getTimerByIndex(int index)
 {
-    if (this->isInited) {
+    if (index < 0 || index >= this->chunksCount * TIMERS_CHUNK_SIZE) {
         logPosition();
-        return 0;
+        return NULL;
     }
+    return &this->chunks[index / TIMERS_CHUNK_SIZE][index % TIMERS_CHUNK_SIZE];
+}
 
-    for (int i = 0; i < MAX_TIMERS_COUNT; ++i) {
-        TimerDescriptor *timer = &this->timers[i];
-        timer->handler = NULL;
-        timer->handlerArgument.ptrValue = NULL;
-        timer->created = false;
-        timer->nextFreeIndex = i + 1;
+int TimerSystem::growTimersPool()
+{
+    struct TimerDescriptor **chunks = (struct TimerDescriptor **)
+        realloc(this->chunks, (this->chunksCount + 1) * sizeof(struct TimerDescriptor *));
+    if (chunks == NULL) {
+        logPosition();
+        return -1;
     }
+    this->chunks = chunks;
 
-    this->timers[MAX_TIMERS_COUNT - 1].nextFreeIndex = -1;
-    this->firstFreeIndex = 0;
-
-    this->timeoutHead = -1;
-    this->timeoutTail = -1;
-
-    if (TimerSystem::registerSignalHandler() == -1) {
+    struct TimerDescriptor *chunk = (struct TimerDescriptor *)
+        malloc(TIMERS_CHUNK_SIZE * sizeof(struct TimerDescriptor));
+    if (chunk == NULL) {
         logPosition();
         return -1;
     }
 
-    this->isInited = true;
+    int firstIndex = this->chunksCount * TIMERS_CHUNK_SIZE;
+    for (int i = 0; i < TIMERS_CHUNK_SIZE; ++i) {
+        TimerDescriptor *timer = &chunk[i];
+        TimerWheel::initNode(&timer->wheelNode);
+        timer->index = firstIndex + i;
+        timer->generation = 0;
+        timer->pending.store(false, std::memory_order_relaxed);
+        timer->overrun.store(0, std::memory_order_relaxed);
+        timer->lastOverrun = 0;
+        timer->inOverflow = false;
+        timer->overflowGeneration = 0;
+        timer->nextOverflowIndex = -1;
+        timer->handler = NULL;
+        timer->handlerArgument.ptrValue = NULL;
+        timer->created = false;
+        timer->nextFreeIndex = firstIndex + i + 1;
+    }
+    chunk[TIMERS_CHUNK_SIZE - 1].nextFreeIndex = this->firstFreeIndex;
+
+    this->chunks[this->chunksCount] = chunk;
+    ++this->chunksCount;
+    this->firstFreeIndex = firstIndex;
     return 0;
 }
 
@@ -101,24 +141,13 @@ int TimerSystem::getNextTimerIndex()
         return -1;
     }
 
-    int currentIndex = this->firstFreeIndex;
-
-    if (currentIndex == -1) {
+    if (this->firstFreeIndex == -1 && this->growTimersPool() == -1) {
         logPosition();
         return -1;
     }
 
-    struct TimerDescriptor *current = &this->timers[currentIndex];
-
-    struct sigevent sigev;
-    sigev.sigev_notify = SIGEV_SIGNAL;
-    sigev.sigev_signo = TIMEOUT_SIGNAL_CODE;
-    sigev.sigev_value.sival_int = currentIndex;
-    if (timer_create(CLOCK_REALTIME, &sigev, &current->timerId) == -1) {
-        perror("Create timer");
-        logPosition();
-        return -1;
-    }
+    int currentIndex = this->firstFreeIndex;
+    struct TimerDescriptor *current = this->getTimerByIndex(currentIndex);
 
     this->firstFreeIndex = current->nextFreeIndex;
     current->created = true;
@@ -139,11 +168,10 @@ int TimerSystem::createTimer(int interval, bool repeat, TimerHandler handler, Ti
         return -1;
     }
 
-    struct TimerDescriptor *timer = &this->timers[index];
+    struct TimerDescriptor *timer = this->getTimerByIndex(index);
 
     timer->timeout = interval;
     timer->isInterval = repeat;
-    timer->isArmed = false;
 
     timer->handler = handler;
     timer->handlerArgument = argument;
@@ -151,73 +179,106 @@ int TimerSystem::createTimer(int interval, bool repeat, TimerHandler handler, Ti
     return index;
 }
 
-int TimerSystem::startTimerByIndex(int index)
+int TimerSystem::setTimerFd(bool armed, uint64_t deadline)
 {
-    if (!this->isInited) {
-        logPosition();
-        return -1;
-    }
-
-    if (index < 0 || index >= MAX_TIMERS_COUNT) {
-        logPosition();
-        return -1;
+    // virtual deadlines are reached by advanceVirtualClock()
+    if (this->isVirtualClock) {
+        this->timerFdArmed = armed;
+        this->timerFdDeadline = deadline;
+        return 0;
     }
 
-    struct TimerDescriptor *timer = &this->timers[index];
-
-    int seconds = timer->timeout / 1000;
-    int nanoseconds = (timer->timeout % 1000) * 1000000;
-
-    /* Start the timer */
     struct itimerspec its;
-    its.it_value.tv_sec = seconds;
-    its.it_value.tv_nsec = nanoseconds;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 0;
 
-    if (timer->isInterval) {
-        its.it_interval.tv_sec = seconds;
-        its.it_interval.tv_nsec = nanoseconds;
+    if (armed) {
+        its.it_value.tv_sec = deadline / 1000;
+        its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+        // a zero it_value would disarm the timer
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
     }
     else {
-        its.it_interval.tv_sec = 0;
-        its.it_interval.tv_nsec = 0;
+        its.it_value.tv_sec = 0;
+        its.it_value.tv_nsec = 0;
     }
 
-    if (timer_settime(timer->timerId, 0, &its, NULL) == -1) {
+    if (timerfd_settime(this->timerFd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+        perror("timerfd_settime");
         logPosition();
         return -1;
     }
 
-    timer->isArmed = true;
+    this->timerFdArmed = armed;
+    this->timerFdDeadline = deadline;
     return 0;
 }
 
-int TimerSystem::stopTimerByIndex(int index)
+// Arms the timerfd to the next tick the wheel has work at,
+// or disarms it if the wheel is empty
+int TimerSystem::armTimerFd()
+{
+    uint64_t deadline;
+    bool armed = this->wheel.nextExpiry(&deadline);
+
+    if (armed == this->timerFdArmed && (!armed || deadline == this->timerFdDeadline))
+        return 0;
+
+    return this->setTimerFd(armed, deadline);
+}
+
+int TimerSystem::startTimerByIndex(int index)
 {
     if (!this->isInited) {
         logPosition();
         return -1;
     }
 
-    if (index < 0 || index >= MAX_TIMERS_COUNT) {
+    struct TimerDescriptor *timer = this->getTimerByIndex(index);
+    if (timer == NULL) {
         logPosition();
         return -1;
     }
 
-    struct TimerDescriptor *timer = &this->timers[index];
+    uint64_t currentTime = this->getTime();
 
-    /* Stop the timer */
-    struct itimerspec its;
-    its.it_value.tv_sec = 0;
-    its.it_value.tv_nsec = 0;
-    its.it_interval.tv_sec = 0;
-    its.it_interval.tv_nsec = 0;
+    // an empty wheel is not advanced, bring it to the current time
+    if (this->wheel.count == 0 && this->wheel.currentTick < currentTime)
+        this->wheel.currentTick = currentTime;
+
+    this->invalidatePendingTimeout(timer);
+
+    uint64_t deadline = currentTime + timer->timeout;
+    this->wheel.schedule(&timer->wheelNode, deadline);
+
+    // the timerfd only needs to fire no later than the earliest deadline
+    if (!this->timerFdArmed || deadline < this->timerFdDeadline) {
+        if (this->setTimerFd(true, deadline) == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    if (timer_settime(timer->timerId, 0, &its, NULL) == -1) {
+int TimerSystem::stopTimerByIndex(int index)
+{
+    if (!this->isInited) {
         logPosition();
         return -1;
     }
 
-    timer->isArmed = false;
+    struct TimerDescriptor *timer = this->getTimerByIndex(index);
+    if (timer == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    this->invalidatePendingTimeout(timer);
+
+    // the timerfd is left armed, a spurious wakeup re-arms it
+    this->wheel.cancel(&timer->wheelNode);
     return 0;
 }
 
@@ -228,58 +289,116 @@ int TimerSystem::deleteTimerByIndex(int index)
         return -1;
     }
 
-    if (index < 0 || index >= MAX_TIMERS_COUNT) {
+    struct TimerDescriptor *timer = this->getTimerByIndex(index);
+    if (timer == NULL) {
         logPosition();
         return -1;
     }
 
-    struct TimerDescriptor *timer = &this->timers[index];
-
     if (!timer->created) {
         logPosition();
         return -1;
     }
 
+    this->invalidatePendingTimeout(timer);
+    this->wheel.cancel(&timer->wheelNode);
+
+    timer->created = false;
     timer->nextFreeIndex = this->firstFreeIndex;
     this->firstFreeIndex = index;
 
-    if (timer_delete(timer->timerId) == -1) {
-        logPosition();
-        return -1;
-    }
-
     return 0;
 }
 
-// in signal handler !!!!!!!
-int TimerSystem::raiseTimerByIndex(int index)
+// A queued expiration of a stopped or restarted timer must not fire
+void TimerSystem::invalidatePendingTimeout(struct TimerDescriptor *timer)
 {
-    if (!this->isInited) {
-        //logError(); // TODO: cannot use printf in signal handler
-        return -1;
-    }
+    ++timer->generation;
+    timer->pending.store(false, std::memory_order_release);
+    timer->overrun.store(0, std::memory_order_relaxed);
+}
 
-    if (index < 0 || index > MAX_TIMERS_COUNT) {
-        //logError();// TODO: cannot use printf in signal handler
-        return -1;
+void TimerSystem::queueTimeout(struct TimerDescriptor *timer)
+{
+    // coalesce with an expiration that has not been handled yet
+    if (timer->pending.exchange(true, std::memory_order_acq_rel)) {
+        timer->overrun.fetch_add(1, std::memory_order_relaxed);
+        this->overrunsCount.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
-    if (this->timeoutHead == this->timeoutTail && this->timeoutTail != -1) {
-        //logError();// TODO: cannot use printf in signal handler
-        return -1;
-    }
+    struct TimeoutEvent event;
+    event.timerIndex = timer->index;
+    event.generation = timer->generation;
 
-    if (this->timeoutTail != -1) {
-        this->timeoutQueue[this->timeoutTail] = index;
-        ++this->timeoutTail;
-        if (this->timeoutTail == TIMEOUTS_QUEUE_SIZE)
-            this->timeoutTail = 0;
-        this->timeoutQueue[this->timeoutTail] = index;
+    if (this->timeoutQueue.push(event))
+        return;
+
+    // more timers have expired at once than the queue holds: the wheel
+    // runs on the loop thread as the dispatcher, so the expiration goes
+    // to the overflow list rather than being lost
+    this->overflowsCount.fetch_add(1, std::memory_order_relaxed);
+    timer->overflowGeneration = timer->generation;
+    // a stale expiration of the timer is still linked, it takes its place
+    if (timer->inOverflow)
+        return;
+    timer->inOverflow = true;
+    timer->nextOverflowIndex = -1;
+    if (this->overflowTail == -1)
+        this->overflowHead = timer->index;
+    else
+        this->getTimerByIndex(this->overflowTail)->nextOverflowIndex = timer->index;
+    this->overflowTail = timer->index;
+}
+
+void TimerSystem::expireHandler(struct TimerWheelNode *node, void *arg)
+{
+    struct TimerSystem *self = (struct TimerSystem*)arg;
+    struct TimerDescriptor *timer = (struct TimerDescriptor*)node;
+
+    if (timer->isInterval) {
+        uint64_t deadline = node->expires + timer->timeout;
+        // the loop has been late for whole periods: keep the phase
+        // and account the skipped expirations
+        if (deadline <= self->currentTime && timer->timeout > 0) {
+            uint64_t missed = (self->currentTime - node->expires) / timer->timeout;
+            deadline = node->expires + (missed + 1) * timer->timeout;
+            timer->overrun.fetch_add(missed, std::memory_order_relaxed);
+            self->overrunsCount.fetch_add(missed, std::memory_order_relaxed);
+        }
+        self->wheel.schedule(node, deadline);
     }
-    else {
-        this->timeoutQueue[0] = index;
-        this->timeoutTail = 0;
-        this->timeoutHead = 0;
+
+    self->queueTimeout(timer);
+}
+
+void TimerSystem::dispatchTimeout(int timerIndex, uint32_t generation)
+{
+    struct TimerDescriptor *timer = this->getTimerByIndex(timerIndex);
+    if (timer == NULL || !timer->created || timer->generation != generation)
+        return;
+
+    timer->pending.store(false, std::memory_order_release);
+    timer->lastOverrun = timer->overrun.exchange(0, std::memory_order_acq_rel);
+    this->expirationsCount.fetch_add(1, std::memory_order_relaxed);
+
+    timer->handler(timer->handlerArgument);
+}
+
+// The overflow list holds expirations later than those of the queue
+void TimerSystem::dispatchTimeouts()
+{
+    struct TimeoutEvent event;
+    while (this->timeoutQueue.pop(&event))
+        this->dispatchTimeout(event.timerIndex, event.generation);
+
+    while (this->overflowHead != -1) {
+        struct TimerDescriptor *timer = this->getTimerByIndex(this->overflowHead);
+        this->overflowHead = timer->nextOverflowIndex;
+        if (this->overflowHead == -1)
+            this->overflowTail = -1;
+        timer->inOverflow = false;
+        this->dispatchTimeout(timer->index, timer->overflowGeneration);
     }
 }
 
@@ -290,112 +409,128 @@ int TimerSystem::runAllTimeouts()
         return -1;
     }
 
-    sigset_t orig_mask;
+    this->currentTime = this->getTime();
+    this->wheel.advance(this->currentTime, TimerSystem::expireHandler, this);
+    this->dispatchTimeouts();
 
-    if (this->lockTimers(&orig_mask) == -1) {
+    if (this->armTimerFd() == -1) {
         logPosition();
         return -1;
     }
+    return 0;
+}
 
-    while(this->timeoutHead != -1) {
-        int raisedIndex = this->timeoutQueue[this->timeoutHead];
-        ++this->timeoutHead;
-
-        if (this->timeoutHead != this->timeoutTail) {
-            this->timeoutTail = -1;
-            this->timeoutHead = -1;
-        }
-
-        if (this->unlockTimers(&orig_mask) == -1) {
-            logPosition();
-            return -1;
-        }
-
-        TimerDescriptor *timer = &this->timers[raisedIndex];
-        timer->handler(timer->handlerArgument);
-
-        if (this->lockTimers(&orig_mask) == -1) {
-            logPosition();
-            return -1;
-        }
-    }
-
-    if (this->unlockTimers(&orig_mask) == -1) {
+int TimerSystem::setIntervalByIndex(int index, int interval)
+{
+    struct TimerDescriptor *timer = this->getTimerByIndex(index);
+    if (timer == NULL || interval < 0) {
         logPosition();
         return -1;
     }
+    timer->timeout = interval;
     return 0;
 }
 
-int TimerSystem::lockTimers(sigset_t *old_mask)
+uint64_t TimerSystem::getTime()
 {
-    sigset_t mask;
-    if (sigemptyset(&mask) == -1) {
-        perror("sigemptyset");
-        logPosition();
-        return -1;
-    }
-    if (sigaddset(&mask, TIMEOUT_SIGNAL_CODE) == -1) {
-        perror("sigaddset");
+    return this->isVirtualClock ? this->virtualTime : TimerSystem::now();
+}
+
+int TimerSystem::useVirtualClock(uint64_t startTime)
+{
+    if (!this->isInited || this->wheel.count > 0) {
         logPosition();
         return -1;
     }
 
-    if (sigprocmask(SIG_BLOCK, &mask, old_mask) < 0) {
-        perror("sigprocmask");
+    if (this->setTimerFd(false, 0) == -1) {
         logPosition();
         return -1;
     }
+
+    this->isVirtualClock = true;
+    this->virtualTime = startTime;
+    this->currentTime = startTime;
+    this->wheel.init(startTime);
     return 0;
 }
 
-int TimerSystem::unlockTimers(const sigset_t *old_mask)
+int TimerSystem::advanceVirtualClock(uint64_t time)
 {
-    if (sigprocmask(SIG_SETMASK, old_mask, NULL) < 0) {
-        perror("sigprocmask");
+    if (!this->isVirtualClock || time < this->virtualTime) {
         logPosition();
         return -1;
     }
+
+    // step from deadline to deadline, so that each handler sees the time
+    // its timer has expired at and timers it starts expire in order
+    uint64_t deadline;
+    while (this->getNextDeadline(&deadline) && deadline <= time) {
+        if (deadline > this->virtualTime)
+            this->virtualTime = deadline;
+        if (this->runAllTimeouts() == -1) {
+            logPosition();
+            return -1;
+        }
+    }
+
+    this->virtualTime = time;
     return 0;
 }
 
-static void signalHandler(int sig, siginfo_t *si, void *uc)
+bool TimerSystem::getNextDeadline(uint64_t *time)
 {
-    int index = si->si_value.sival_int;
-
-    if (timerSystem.raiseTimerByIndex(index) == -1) {
-        //logError();
-        return;
-    }
+    return this->wheel.nextExpiry(time);
 }
 
-int TimerSystem::registerSignalHandler()
+int TimerSystem::getOverrunByIndex(int index)
 {
-    struct sigaction sa;
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = signalHandler;
-    if (sigemptyset(&sa.sa_mask) == -1) {
-        perror("sigemptyset");
+    struct TimerDescriptor *timer = this->getTimerByIndex(index);
+    if (timer == NULL) {
         logPosition();
         return -1;
     }
-    if (sigaction(TIMEOUT_SIGNAL_CODE, &sa, NULL) == -1) {
-        perror("sigaction");
+    return timer->lastOverrun;
+}
+
+void TimerSystem::getStats(struct TimerStats *stats)
+{
+    stats->expirations = this->expirationsCount.load(std::memory_order_relaxed);
+    stats->overruns = this->overrunsCount.load(std::memory_order_relaxed);
+    stats->overflows = this->overflowsCount.load(std::memory_order_relaxed);
+}
+
+void TimerSystem::timerFdEventHandler(uint32_t events, void *arg)
+{
+    struct TimerSystem *self = (struct TimerSystem*)arg;
+
+    uint64_t expirations;
+    // edge-triggered: drain the expiration counter
+    while (read(self->timerFd, &expirations, sizeof(uint64_t)) == sizeof(uint64_t))
+        ;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Read timerfd");
         logPosition();
-        return -1;
     }
 
-    return 0;
+    // the timerfd is one-shot, it has to be re-armed
+    self->timerFdArmed = false;
+
+    if (self->runAllTimeouts() == -1) {
+        logPosition();
+    }
 }
 
 
-int Timer::init(int interval, bool repeat, TimerHandler handler, TimerHandlerArgument argument)
+int Timer::init(struct TimerSystem *system, int interval, bool repeat, TimerHandler handler, TimerHandlerArgument argument)
 {
-    int index = timerSystem.createTimer(interval, repeat, handler, argument);
+    int index = system->createTimer(interval, repeat, handler, argument);
     if (index == -1) {
         logPosition();
         return -1;
     }
+    this->system = system;
     this->timerIndex = index;
 
     return 0;
@@ -403,39 +538,29 @@ int Timer::init(int interval, bool repeat, TimerHandler handler, TimerHandlerArg
 
 int Timer::deinit()
 {
-    if (timerSystem.stopTimerByIndex(this->timerIndex) == -1) {
+    if (this->system->stopTimerByIndex(this->timerIndex) == -1) {
         logPosition();
         return -1;
     }
-    return timerSystem.deleteTimerByIndex(this->timerIndex);
+    return this->system->deleteTimerByIndex(this->timerIndex);
 }
 
 int Timer::start()
 {
-    return timerSystem.startTimerByIndex(this->timerIndex);
+    return this->system->startTimerByIndex(this->timerIndex);
 }
 
 int Timer::stop()
 {
-    return timerSystem.stopTimerByIndex(this->timerIndex);
-}
-
-int Timer::initTimerSystem()
-{
-    return timerSystem.init();
-}
-
-int Timer::runAllPendingTimouts()
-{
-    return timerSystem.runAllTimeouts();
+    return this->system->stopTimerByIndex(this->timerIndex);
 }
 
-int Timer::lockTimers(sigset_t *old_mask)
+int Timer::setInterval(int interval)
 {
-    return timerSystem.lockTimers(old_mask);
+    return this->system->setIntervalByIndex(this->timerIndex, interval);
 }
 
-int Timer::unlockTimers(const sigset_t *old_mask)
+int Timer::getOverrun()
 {
-    return timerSystem.unlockTimers(old_mask);
+    return this->system->getOverrunByIndex(this->timerIndex);
 }
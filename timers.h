@@ -1,7 +1,14 @@
 #ifndef TIMERS_H
 #define TIMERS_H
 
-#include <sys/signal.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "spscqueue.h"
+#include "timerwheel.h"
+
+struct EventLoop;
 
 typedef union {
     int intValue;
@@ -10,20 +17,154 @@ typedef union {
 
 typedef void (*TimerHandler)(TimerHandlerArgument);
 
+struct TimerStats
+{
+    // expirations delivered to handlers
+    uint64_t expirations;
+    // expirations merged into a pending one or skipped by a late interval timer
+    uint64_t overruns;
+    // expirations that did not fit the timeout queue, handed over
+    // through the overflow list instead
+    uint64_t overflows;
+};
+
+// Descriptors are allocated in chunks that never move, so wheel nodes
+// embedded into them stay valid while the pool grows.
+#define TIMERS_CHUNK_SIZE 256
+
+#define TIMEOUTS_QUEUE_SIZE 4096
+
+struct TimerDescriptor
+{
+    // first member: a descriptor is recovered from its expired wheel node
+    struct TimerWheelNode wheelNode;
+
+    int index;
+    bool created;
+    int nextFreeIndex;
+
+    int timeout;
+    bool isInterval;
+
+    // bumped by start/stop so that queued expirations become stale
+    uint32_t generation;
+    // an expiration is in the timeout queue
+    std::atomic<bool> pending;
+    // expirations merged into the pending one
+    std::atomic<int> overrun;
+    int lastOverrun;
+
+    // in the overflow list, which the expiration of overflowGeneration
+    // is handed over through
+    bool inOverflow;
+    uint32_t overflowGeneration;
+    int nextOverflowIndex;
+
+    TimerHandler handler;
+    TimerHandlerArgument handlerArgument;
+};
+
+struct TimeoutEvent
+{
+    int timerIndex;
+    uint32_t generation;
+};
+
+struct TimerSystem
+{
+private:
+    bool isInited;
+
+    struct TimerDescriptor **chunks;
+    int chunksCount;
+    int firstFreeIndex;
+
+    // ticks are CLOCK_MONOTONIC milliseconds
+    struct TimerWheel wheel;
+
+    struct EventLoop *loop;
+    int timerFd;
+    bool timerFdArmed;
+    uint64_t timerFdDeadline;
+
+    uint64_t currentTime;
+
+    // simulated time replaces CLOCK_MONOTONIC, the timerfd stays unarmed
+    bool isVirtualClock;
+    uint64_t virtualTime;
+
+    // expired timers are handed from the wheel to their handlers here
+    SpscQueue<struct TimeoutEvent, TIMEOUTS_QUEUE_SIZE> timeoutQueue;
+    // Expirations beyond the queue, linked through the descriptors: each
+    // timer is in it at most once, so it never runs out. -1 when empty.
+    int overflowHead;
+    int overflowTail;
+
+    std::atomic<uint64_t> expirationsCount;
+    std::atomic<uint64_t> overrunsCount;
+    std::atomic<uint64_t> overflowsCount;
+
+public:
+    // Timers expire from the event loop through a single timerfd
+    int init(struct EventLoop *loop);
+    int deinit();
+
+    int createTimer(int interval, bool repeat, TimerHandler handler, TimerHandlerArgument argument);
+    int startTimerByIndex(int index);
+    int stopTimerByIndex(int index);
+    int deleteTimerByIndex(int index);
+    // Takes effect on the next start
+    int setIntervalByIndex(int index, int interval);
+
+    int runAllTimeouts();
+
+    int getOverrunByIndex(int index);
+    void getStats(struct TimerStats *stats);
+
+    // Milliseconds on the clock timers are scheduled by
+    uint64_t getTime();
+
+    // Switches to a simulated clock starting at startTime, before any
+    // timer is started. Time then only moves by advanceVirtualClock(),
+    // which runs the handlers of every timer due until the given time,
+    // each at its own deadline, on the calling thread.
+    int useVirtualClock(uint64_t startTime);
+    int advanceVirtualClock(uint64_t time);
+    // Earliest time at which a timer may expire, false if none is started
+    bool getNextDeadline(uint64_t *time);
+
+private:
+    struct TimerDescriptor *getTimerByIndex(int index);
+    int growTimersPool();
+    int getNextTimerIndex();
+    int setTimerFd(bool armed, uint64_t deadline);
+    int armTimerFd();
+
+    void invalidatePendingTimeout(struct TimerDescriptor *timer);
+    void queueTimeout(struct TimerDescriptor *timer);
+    void dispatchTimeout(int timerIndex, uint32_t generation);
+    void dispatchTimeouts();
+
+    static uint64_t now();
+    static void timerFdEventHandler(uint32_t events, void *arg);
+    static void expireHandler(struct TimerWheelNode *node, void *arg);
+};
+
 struct Timer
 {
+    struct TimerSystem *system;
     int timerIndex;
 
-    int init(int interval, bool repeat, TimerHandler handler, TimerHandlerArgument argument);
+    int init(struct TimerSystem *system, int interval, bool repeat, TimerHandler handler, TimerHandlerArgument argument);
     int deinit();
     int start();
     int stop();
+    // Takes effect on the next start
+    int setInterval(int interval);
 
-    static int initTimerSystem();
-    static int runAllPendingTimouts();
-
-    static int lockTimers(sigset_t *old_mask);
-    static int unlockTimers(const sigset_t *old_mask);
+    // Like timer_getoverrun: extra expirations merged into the one
+    // being handled. Valid inside the handler.
+    int getOverrun();
 };
 
 #endif // TIMERS_H
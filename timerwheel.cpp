@@ -0,0 +1,208 @@
+#include "timerwheel.h"
+
+#include <string.h>
+
+static inline uint64_t rotateRight(uint64_t value, unsigned shift)
+{
+    return (value >> shift) | (value << ((64 - shift) & 63));
+}
+
+void TimerWheel::init(uint64_t startTick)
+{
+    memset(this->slots, 0, sizeof(this->slots));
+    memset(this->occupied, 0, sizeof(this->occupied));
+    this->currentTick = startTick;
+    this->count = 0;
+}
+
+void TimerWheel::initNode(struct TimerWheelNode *node)
+{
+    node->next = NULL;
+    node->prev = NULL;
+    node->slot = NULL;
+    node->expires = 0;
+}
+
+bool TimerWheel::isScheduled(struct TimerWheelNode *node)
+{
+    return node->slot != NULL;
+}
+
+void TimerWheel::insert(struct TimerWheelNode *node)
+{
+    uint64_t expires = node->expires;
+    if (expires < this->currentTick)
+        expires = this->currentTick;
+
+    uint64_t delta = expires - this->currentTick;
+    if (delta > TIMER_WHEEL_MAX_DELTA) {
+        expires = this->currentTick + TIMER_WHEEL_MAX_DELTA;
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1
+           && delta >= ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * (level + 1))))
+        ++level;
+
+    unsigned slotIndex = (expires >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+    struct TimerWheelNode **head = &this->slots[level][slotIndex];
+
+    node->prev = NULL;
+    node->next = *head;
+    if (*head != NULL)
+        (*head)->prev = node;
+    *head = node;
+    node->slot = head;
+
+    this->occupied[level] |= (uint64_t)1 << slotIndex;
+}
+
+void TimerWheel::unlink(struct TimerWheelNode *node)
+{
+    struct TimerWheelNode **head = node->slot;
+
+    if (node->prev != NULL)
+        node->prev->next = node->next;
+    else
+        *head = node->next;
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+
+    // nodes being expired are linked into a list outside of the wheel
+    uintptr_t first = (uintptr_t)&this->slots[0][0];
+    uintptr_t position = (uintptr_t)head;
+    if (*head == NULL && position >= first
+            && position < first + sizeof(this->slots)) {
+        size_t index = head - &this->slots[0][0];
+        this->occupied[index >> TIMER_WHEEL_SLOT_BITS] &= ~((uint64_t)1 << (index & TIMER_WHEEL_SLOT_MASK));
+    }
+
+    node->next = NULL;
+    node->prev = NULL;
+    node->slot = NULL;
+}
+
+void TimerWheel::schedule(struct TimerWheelNode *node, uint64_t expires)
+{
+    if (node->slot != NULL)
+        this->unlink(node);
+    else
+        ++this->count;
+
+    node->expires = expires;
+    this->insert(node);
+}
+
+void TimerWheel::cancel(struct TimerWheelNode *node)
+{
+    if (node->slot == NULL)
+        return;
+    this->unlink(node);
+    --this->count;
+}
+
+// Moves nodes of the current slot of each higher level down the wheel.
+// A level is cascaded only when all lower level indices wrapped to zero.
+void TimerWheel::cascade()
+{
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        unsigned slotIndex = (this->currentTick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+
+        struct TimerWheelNode *list = this->slots[level][slotIndex];
+        this->slots[level][slotIndex] = NULL;
+        this->occupied[level] &= ~((uint64_t)1 << slotIndex);
+
+        while (list != NULL) {
+            struct TimerWheelNode *node = list;
+            list = node->next;
+            this->insert(node);
+        }
+
+        if (slotIndex != 0)
+            break;
+    }
+}
+
+size_t TimerWheel::advance(uint64_t nowTick, TimerWheelExpireHandler handler, void *arg)
+{
+    size_t expiredCount = 0;
+
+    while (this->currentTick <= nowTick) {
+        unsigned slotIndex = this->currentTick & TIMER_WHEEL_SLOT_MASK;
+        if (slotIndex == 0)
+            this->cascade();
+
+        if (this->slots[0][slotIndex] == NULL) {
+            // skip to the next occupied slot or to the next cascade
+            uint64_t pending = this->occupied[0] >> slotIndex;
+            uint64_t nextTick;
+            if (pending != 0)
+                nextTick = this->currentTick + __builtin_ctzll(pending);
+            else
+                nextTick = (this->currentTick | TIMER_WHEEL_SLOT_MASK) + 1;
+
+            if (nextTick > nowTick + 1)
+                nextTick = nowTick + 1;
+            this->currentTick = nextTick;
+            continue;
+        }
+
+        // Detach the slot so that nodes scheduled by handlers land in fresh
+        // lists. Nodes keep pointing to the detached head so they can still
+        // be cancelled by other handlers.
+        struct TimerWheelNode *expired = this->slots[0][slotIndex];
+        this->slots[0][slotIndex] = NULL;
+        this->occupied[0] &= ~((uint64_t)1 << slotIndex);
+        for (struct TimerWheelNode *node = expired; node != NULL; node = node->next)
+            node->slot = &expired;
+
+        ++this->currentTick;
+
+        while (expired != NULL) {
+            struct TimerWheelNode *node = expired;
+            this->unlink(node);
+            --this->count;
+            ++expiredCount;
+            handler(node, arg);
+        }
+    }
+
+    return expiredCount;
+}
+
+bool TimerWheel::nextExpiry(uint64_t *tick)
+{
+    if (this->count == 0)
+        return false;
+
+    bool found = false;
+    uint64_t earliest = 0;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        uint64_t occupiedSlots = this->occupied[level];
+        if (occupiedSlots == 0)
+            continue;
+
+        unsigned shift = TIMER_WHEEL_SLOT_BITS * level;
+        uint64_t unit = (uint64_t)1 << shift;
+        uint64_t base = this->currentTick >> shift;
+        unsigned digit = base & TIMER_WHEEL_SLOT_MASK;
+
+        // the current slot of a level is processed at currentTick only
+        // at its boundary, otherwise it holds the next rotation
+        unsigned start = (this->currentTick & (unit - 1)) == 0 ? 0 : 1;
+
+        uint64_t rotated = rotateRight(occupiedSlots, (digit + start) & TIMER_WHEEL_SLOT_MASK);
+        uint64_t offset = start + __builtin_ctzll(rotated);
+        uint64_t levelTick = (base + offset) << shift;
+
+        if (!found || levelTick < earliest) {
+            earliest = levelTick;
+            found = true;
+        }
+    }
+
+    *tick = earliest;
+    return found;
+}
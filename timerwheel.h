@@ -0,0 +1,62 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 4 levels of 64 slots with 1 tick resolution cover 2^24 ticks (4.6 hours
+// of 1 ms ticks). Later deadlines are parked in the last level and
+// re-cascaded until they come in range.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MAX_DELTA (((uint64_t)1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+// Intrusive node: embed it in the timer owner
+struct TimerWheelNode
+{
+    struct TimerWheelNode *next;
+    struct TimerWheelNode *prev;
+    // slot list head the node is linked into, NULL when not scheduled
+    struct TimerWheelNode **slot;
+
+    uint64_t expires;
+};
+
+typedef void (*TimerWheelExpireHandler)(struct TimerWheelNode *node, void *arg);
+
+struct TimerWheel
+{
+    struct TimerWheelNode *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+
+    // next tick to be processed
+    uint64_t currentTick;
+    size_t count;
+
+    void init(uint64_t startTick);
+
+    static void initNode(struct TimerWheelNode *node);
+    static bool isScheduled(struct TimerWheelNode *node);
+
+    // O(1); a deadline in the past expires on the next advance
+    void schedule(struct TimerWheelNode *node, uint64_t expires);
+    // O(1); no-op for a node that is not scheduled
+    void cancel(struct TimerWheelNode *node);
+
+    // Expires every node with deadline <= nowTick. Handlers may schedule
+    // and cancel nodes. Returns the count of expired nodes.
+    size_t advance(uint64_t nowTick, TimerWheelExpireHandler handler, void *arg);
+
+    // Earliest tick at which advance() has work to do: either a deadline or
+    // a cascade of a higher level. Returns false if the wheel is empty.
+    bool nextExpiry(uint64_t *tick);
+
+private:
+    void insert(struct TimerWheelNode *node);
+    void unlink(struct TimerWheelNode *node);
+    void cascade();
+};
+
+#endif // TIMERWHEEL_H
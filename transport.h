@@ -0,0 +1,32 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+struct RecvDatagram;
+struct Transport;
+
+// Datagrams of the batch are valid only until the handler returns,
+// unless their buffer is retained
+typedef void (*RecvBatchHandler)(struct RecvDatagram *datagrams, size_t count, void *arg);
+
+// Operations of a datagram transport, same contracts as the
+// corresponding Networking methods
+struct TransportOps
+{
+    int (*broadcastDgram)(struct Transport *transport, unsigned char *content, size_t contentSize);
+    int (*sendDgram)(struct Transport *transport, struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize);
+    int (*startRecv)(struct Transport *transport, RecvBatchHandler handler, void *arg);
+    int (*stopRecv)(struct Transport *transport);
+};
+
+// Replaces the kernel sockets of a Networking, e.g. by an in-process
+// network. Implementations embed it as their first member.
+struct Transport
+{
+    const struct TransportOps *ops;
+};
+
+#endif // TRANSPORT_H
@@ -0,0 +1,579 @@
+#include "uringnet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <errno.h>
+
+#include "eventloop.h"
+#include "logging.h"
+
+#define URING_TAG_RECV 1
+#define URING_TAG_SEND 2
+#define URING_TAG_CANCEL 3
+
+#define URING_TAG_BITS 8
+
+// multishot recvmsg writes its header and the sender address before the payload
+static_assert(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) <= RECV_BUFFER_HEADROOM,
+    "recvmsg header does not fit the receive buffer headroom");
+
+static int uringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringRegister(int ringFd, unsigned opcode, void *arg, unsigned argsCount)
+{
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, argsCount);
+}
+
+static void *mapRing(int ringFd, size_t size, off_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+int UringNet::init(int socketFd, struct EventLoop *loop, struct RecvBufferPool *pool)
+{
+    this->ringFd = -1;
+    this->socketFd = socketFd;
+    this->loop = loop;
+    this->loopRegistered = false;
+    this->sqRing = NULL;
+    this->cqRing = NULL;
+    this->sqes = NULL;
+    this->bufRing = NULL;
+    this->pool = pool;
+    this->ringBuffersCount = 0;
+    this->sendSlots = NULL;
+    this->sqPending = 0;
+    this->bufRingTail = 0;
+    this->recvPosted = false;
+    this->recvStarted = false;
+    this->recvFailed = false;
+    memset(&this->stats, 0, sizeof(this->stats));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL;
+
+    this->ringFd = uringSetup(URING_ENTRIES, &params);
+    if (this->ringFd == -1) {
+        perror("io_uring setup");
+        logPosition();
+        return -1;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        logError("io_uring without single mmap rings is not supported");
+        logPosition();
+        return -1;
+    }
+
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (this->cqRingSize > this->sqRingSize)
+        this->sqRingSize = this->cqRingSize;
+    this->cqRingSize = this->sqRingSize;
+
+    this->sqRing = mapRing(this->ringFd, this->sqRingSize, IORING_OFF_SQ_RING);
+    if (this->sqRing == NULL) {
+        perror("Map io_uring rings");
+        logPosition();
+        return -1;
+    }
+    // both rings share one mapping
+    this->cqRing = this->sqRing;
+
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    this->sqes = (struct io_uring_sqe *)mapRing(this->ringFd, this->sqesSize, IORING_OFF_SQES);
+    if (this->sqes == NULL) {
+        perror("Map io_uring submission entries");
+        logPosition();
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)this->sqRing;
+    this->sqHead = (unsigned *)(sq + params.sq_off.head);
+    this->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    this->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    this->sqArray = (unsigned *)(sq + params.sq_off.array);
+
+    unsigned char *cq = (unsigned char *)this->cqRing;
+    this->cqHead = (unsigned *)(cq + params.cq_off.head);
+    this->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    this->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    this->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // receive buffers provided to the kernel through a buffer ring
+    this->bufRingSize = URING_RECV_BUFFERS_COUNT * sizeof(struct io_uring_buf);
+    void *bufRing = mmap(NULL, this->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED) {
+        perror("Map io_uring buffer ring");
+        logPosition();
+        return -1;
+    }
+    this->bufRing = (struct io_uring_buf_ring *)bufRing;
+
+    struct io_uring_buf_reg bufReg;
+    memset(&bufReg, 0, sizeof(bufReg));
+    bufReg.ring_addr = (uint64_t)(uintptr_t)this->bufRing;
+    bufReg.ring_entries = URING_RECV_BUFFERS_COUNT;
+    bufReg.bgid = URING_RECV_BUFFER_GROUP;
+    if (uringRegister(this->ringFd, IORING_REGISTER_PBUF_RING, &bufReg, 1) == -1) {
+        perror("Register io_uring buffer ring");
+        logPosition();
+        return -1;
+    }
+
+    this->refillBuffers();
+    this->publishBuffers();
+
+    memset(&this->recvHeader, 0, sizeof(this->recvHeader));
+    this->recvHeader.msg_namelen = sizeof(struct sockaddr_in);
+
+    if (this->probeMultishotRecv() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    this->sendSlots = (struct UringSendSlot *)malloc(URING_SEND_SLOTS_COUNT * sizeof(struct UringSendSlot));
+    if (this->sendSlots == NULL) {
+        logPosition();
+        return -1;
+    }
+    for (int i = 0; i < URING_SEND_SLOTS_COUNT; ++i)
+        this->sendSlots[i].nextFreeIndex = i + 1 < URING_SEND_SLOTS_COUNT ? i + 1 : -1;
+    this->firstFreeSendSlot = 0;
+
+    if (loop->addFd(this->ringFd, EPOLLIN, ringEventHandler, this) == -1) {
+        logPosition();
+        return -1;
+    }
+
+    if (loop->addPrepareHandler(prepareHandler, this) == -1) {
+        loop->removeFd(this->ringFd);
+        logPosition();
+        return -1;
+    }
+    this->loopRegistered = true;
+    return 0;
+}
+
+int UringNet::deinit()
+{
+    if (this->ringFd != -1) {
+        // flush sends queued since the last loop iteration
+        if (this->loopRegistered) {
+            this->submit();
+            this->loop->removePrepareHandler(prepareHandler, this);
+            this->loop->removeFd(this->ringFd);
+            this->loopRegistered = false;
+        }
+
+        // closing the ring cancels the pending requests
+        if (close(this->ringFd) == -1) {
+            perror("Close io_uring");
+            logPosition();
+            return -1;
+        }
+        this->ringFd = -1;
+    }
+
+    if (this->sqes != NULL)
+        munmap(this->sqes, this->sqesSize);
+    if (this->sqRing != NULL)
+        munmap(this->sqRing, this->sqRingSize);
+    if (this->bufRing != NULL)
+        munmap(this->bufRing, this->bufRingSize);
+    this->sqes = NULL;
+    this->sqRing = NULL;
+    this->cqRing = NULL;
+    this->bufRing = NULL;
+
+    // buffers left in the buffer ring go away with the pool
+    free(this->sendSlots);
+    this->sendSlots = NULL;
+    return 0;
+}
+
+struct io_uring_sqe *UringNet::getSqe()
+{
+    unsigned head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *this->sqTail + this->sqPending;
+
+    if (tail - head > this->sqMask) {
+        // the submission ring is full: hand it over to the kernel
+        if (this->submit() == -1)
+            return NULL;
+        head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+        tail = *this->sqTail;
+        if (tail - head > this->sqMask)
+            return NULL;
+    }
+
+    unsigned index = tail & this->sqMask;
+    this->sqArray[index] = index;
+    ++this->sqPending;
+
+    struct io_uring_sqe *sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+int UringNet::submit()
+{
+    if (this->sqPending == 0)
+        return 0;
+
+    // release: entries are visible to the kernel before the new tail
+    __atomic_store_n(this->sqTail, *this->sqTail + this->sqPending, __ATOMIC_RELEASE);
+    unsigned toSubmit = this->sqPending;
+    this->sqPending = 0;
+
+    while (toSubmit > 0) {
+        int res = uringEnter(this->ringFd, toSubmit, 0, 0);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("io_uring submit");
+            logPosition();
+            return -1;
+        }
+        ++this->stats.submitCalls;
+        toSubmit -= res;
+    }
+    return 0;
+}
+
+void UringNet::provideBuffer(struct RecvBuffer *buffer)
+{
+    // the ring is an array of io_uring_buf whose first resv field is the
+    // tail: bufs of the flexible array is misplaced when compiled as C++
+    struct io_uring_buf *buf = (struct io_uring_buf *)this->bufRing + (this->bufRingTail & (URING_RECV_BUFFERS_COUNT - 1));
+    buf->addr = (uint64_t)(uintptr_t)buffer->data;
+    buf->len = sizeof(buffer->data);
+    buf->bid = buffer->index;
+    ++this->bufRingTail;
+    ++this->ringBuffersCount;
+}
+
+void UringNet::refillBuffers()
+{
+    while (this->ringBuffersCount < URING_RECV_BUFFERS_COUNT) {
+        struct RecvBuffer *buffer = this->pool->acquire();
+        if (buffer == NULL)
+            return;
+        this->provideBuffer(buffer);
+    }
+}
+
+void UringNet::publishBuffers()
+{
+    __atomic_store_n(&this->bufRing->tail, this->bufRingTail, __ATOMIC_RELEASE);
+}
+
+int UringNet::postRecv()
+{
+    struct io_uring_sqe *sqe = this->getSqe();
+    if (sqe == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = this->socketFd;
+    sqe->addr = (uint64_t)(uintptr_t)&this->recvHeader;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_BUFFER_GROUP;
+    sqe->user_data = URING_TAG_RECV;
+
+    this->recvPosted = true;
+    return 0;
+}
+
+// Multishot recvmsg came in Linux 6.0, after the buffer ring of 5.19,
+// and a kernel without it only refuses the receive on its completion.
+// The receive is posted and cancelled at once to see which it is.
+int UringNet::probeMultishotRecv()
+{
+    if (this->postRecv() == -1) {
+        logPosition();
+        return -1;
+    }
+    struct io_uring_sqe *sqe = this->getSqe();
+    if (sqe == NULL) {
+        logPosition();
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = URING_TAG_RECV;
+    sqe->user_data = URING_TAG_CANCEL;
+    if (this->submit() == -1) {
+        logPosition();
+        return -1;
+    }
+
+    bool recvEnded = false;
+    bool cancelEnded = false;
+    int recvResult = 0;
+    while (!recvEnded || !cancelEnded) {
+        unsigned head = *this->cqHead;
+        unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (uringEnter(this->ringFd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+                perror("io_uring wait");
+                logPosition();
+                return -1;
+            }
+            continue;
+        }
+
+        for (; head != tail; ++head) {
+            struct io_uring_cqe *cqe = &this->cqes[head & this->cqMask];
+            unsigned tag = cqe->user_data & ((1 << URING_TAG_BITS) - 1);
+            if (tag == URING_TAG_CANCEL) {
+                cancelEnded = true;
+            }
+            else if (tag == URING_TAG_RECV) {
+                // a datagram before the receive is started is dropped
+                if (cqe->flags & IORING_CQE_F_BUFFER) {
+                    this->pool->getBufferByIndex(cqe->flags >> IORING_CQE_BUFFER_SHIFT)->release();
+                    --this->ringBuffersCount;
+                }
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    recvEnded = true;
+                    recvResult = cqe->res;
+                }
+            }
+        }
+        __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+    }
+    this->recvPosted = false;
+    this->refillBuffers();
+    this->publishBuffers();
+
+    if (recvResult < 0 && recvResult != -ECANCELED && recvResult != -ENOBUFS) {
+        errno = -recvResult;
+        perror("io_uring multishot recvmsg");
+        return -1;
+    }
+    return 0;
+}
+
+int UringNet::startRecv(RecvBatchHandler handler, void *arg)
+{
+    if (this->recvStarted) {
+        logPosition();
+        return -1;
+    }
+
+    this->handler = handler;
+    this->handlerArgument = arg;
+    this->recvStarted = true;
+
+    if (!this->recvPosted && this->postRecv() == -1) {
+        logPosition();
+        return -1;
+    }
+    return this->submit();
+}
+
+int UringNet::stopRecv()
+{
+    if (!this->recvStarted)
+        return 0;
+    this->recvStarted = false;
+
+    if (!this->recvPosted)
+        return 0;
+
+    struct io_uring_sqe *sqe = this->getSqe();
+    if (sqe == NULL) {
+        logPosition();
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = URING_TAG_RECV;
+    sqe->user_data = URING_TAG_CANCEL;
+    return this->submit();
+}
+
+int UringNet::queueSend(struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize)
+{
+    if (contentSize > RECV_BUFFER_SIZE) {
+        logPosition();
+        return -1;
+    }
+
+    int slotIndex = this->firstFreeSendSlot;
+    if (slotIndex == -1) {
+        ++this->stats.sendsFallback;
+        return sendto(this->socketFd, content, contentSize, 0,
+            (struct sockaddr*)peerAddress, sizeof(struct sockaddr_in));
+    }
+
+    struct io_uring_sqe *sqe = this->getSqe();
+    if (sqe == NULL) {
+        logPosition();
+        return -1;
+    }
+
+    struct UringSendSlot *slot = &this->sendSlots[slotIndex];
+    this->firstFreeSendSlot = slot->nextFreeIndex;
+
+    memcpy(slot->content, content, contentSize);
+    slot->peerAddress = *peerAddress;
+    slot->vector.iov_base = slot->content;
+    slot->vector.iov_len = contentSize;
+    memset(&slot->header, 0, sizeof(struct msghdr));
+    slot->header.msg_name = &slot->peerAddress;
+    slot->header.msg_namelen = sizeof(struct sockaddr_in);
+    slot->header.msg_iov = &slot->vector;
+    slot->header.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = this->socketFd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->header;
+    sqe->len = 1;
+    sqe->user_data = ((uint64_t)slotIndex << URING_TAG_BITS) | URING_TAG_SEND;
+
+    ++this->stats.sendsQueued;
+    return contentSize;
+}
+
+void UringNet::dispatch(struct RecvDatagram *datagrams, size_t count)
+{
+    this->handler(datagrams, count, this->handlerArgument);
+
+    // buffers retained by the handler stay out of the pool
+    for (size_t i = 0; i < count; ++i)
+        datagrams[i].buffer->release();
+}
+
+int UringNet::reapCompletions()
+{
+    struct RecvDatagram datagrams[RECV_BATCH_SIZE];
+    size_t count = 0;
+
+    unsigned head = *this->cqHead;
+    // acquire: pairs with the kernel publishing completions
+    unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &this->cqes[head & this->cqMask];
+        unsigned tag = cqe->user_data & ((1 << URING_TAG_BITS) - 1);
+
+        if (tag == URING_TAG_SEND) {
+            int slotIndex = (int)(cqe->user_data >> URING_TAG_BITS);
+            this->sendSlots[slotIndex].nextFreeIndex = this->firstFreeSendSlot;
+            this->firstFreeSendSlot = slotIndex;
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("Send dgram");
+            }
+            continue;
+        }
+
+        if (tag != URING_TAG_RECV)
+            continue;
+
+        // the multishot receive has ended, e.g. out of buffers:
+        // it is posted again before the loop sleeps, unless it failed
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            this->recvPosted = false;
+            if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+                logError("io_uring receive failed, it is not posted again");
+                this->recvFailed = true;
+            }
+        }
+
+        if (cqe->res < 0) {
+            if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+                errno = -cqe->res;
+                perror("Receive dgram");
+            }
+            continue;
+        }
+        if (!(cqe->flags & IORING_CQE_F_BUFFER))
+            continue;
+
+        struct RecvBuffer *buffer = this->pool->getBufferByIndex(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer->data;
+        --this->ringBuffersCount;
+
+        if (!this->recvStarted || out->namelen > sizeof(struct sockaddr_in)) {
+            buffer->release();
+            continue;
+        }
+
+        struct RecvDatagram *datagram = &datagrams[count];
+        unsigned char *name = buffer->data + sizeof(struct io_uring_recvmsg_out);
+        memcpy(&datagram->senderAddress, name, sizeof(struct sockaddr_in));
+        datagram->buffer = buffer;
+        datagram->message = name + this->recvHeader.msg_namelen + this->recvHeader.msg_controllen;
+        datagram->messageSize = out->payloadlen;
+
+        if (++count == RECV_BATCH_SIZE) {
+            this->dispatch(datagrams, count);
+            count = 0;
+        }
+    }
+
+    // release: the kernel may reuse the completion entries
+    __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+
+    if (count > 0)
+        this->dispatch(datagrams, count);
+
+    this->refillBuffers();
+    this->publishBuffers();
+    return 0;
+}
+
+void UringNet::ringEventHandler(uint32_t events, void *arg)
+{
+    struct UringNet *self = (struct UringNet*)arg;
+
+    // edge-triggered: handlers may post more completions while reaping
+    while (*self->cqHead != __atomic_load_n(self->cqTail, __ATOMIC_ACQUIRE)) {
+        if (self->reapCompletions() == -1) {
+            logPosition();
+            return;
+        }
+    }
+}
+
+void UringNet::prepareHandler(void *arg)
+{
+    struct UringNet *self = (struct UringNet*)arg;
+
+    if (self->recvStarted && !self->recvPosted && !self->recvFailed) {
+        self->refillBuffers();
+        self->publishBuffers();
+        // an exhausted pool would end the receive again at once
+        if (self->ringBuffersCount > 0) {
+            ++self->stats.recvRearms;
+            if (self->postRecv() == -1) {
+                logPosition();
+            }
+        }
+    }
+
+    if (self->submit() == -1) {
+        logPosition();
+    }
+}
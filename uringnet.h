@@ -0,0 +1,114 @@
+#ifndef URINGNET_H
+#define URINGNET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <linux/io_uring.h>
+
+#include "networking.h"
+
+#define URING_ENTRIES 256
+// pool buffers kept provided to the kernel,
+// a power of two, as required for a provided buffer ring
+#define URING_RECV_BUFFERS_COUNT 256
+#define URING_RECV_BUFFER_GROUP 0
+#define URING_SEND_SLOTS_COUNT 256
+
+struct UringSendSlot
+{
+    struct msghdr header;
+    struct iovec vector;
+    struct sockaddr_in peerAddress;
+    int nextFreeIndex;
+    unsigned char content[RECV_BUFFER_SIZE];
+};
+
+struct UringStats
+{
+    uint64_t submitCalls;
+    uint64_t sendsQueued;
+    // sent with a plain sendto because every send slot was in flight
+    uint64_t sendsFallback;
+    uint64_t recvRearms;
+};
+
+// io_uring backend of Networking for one socket. A multishot recvmsg
+// stays posted against a provided buffer ring of pool buffers, so the
+// kernel receives into them without a syscall per datagram. Sends are
+// copied to send slots and submitted together once per loop iteration.
+struct UringNet
+{
+    int ringFd;
+    int socketFd;
+    struct EventLoop *loop;
+    bool loopRegistered;
+
+    void *sqRing;
+    size_t sqRingSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    // filled but not yet submitted
+    unsigned sqPending;
+
+    void *cqRing;
+    size_t cqRingSize;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    struct RecvBufferPool *pool;
+    // buffers provided and not completed yet
+    int ringBuffersCount;
+    uint16_t bufRingTail;
+
+    // template of the multishot recvmsg, read by the kernel on each receive
+    struct msghdr recvHeader;
+    bool recvPosted;
+    bool recvStarted;
+    // the receive ended with an error which reposting would repeat
+    bool recvFailed;
+    RecvBatchHandler handler;
+    void *handlerArgument;
+
+    struct UringSendSlot *sendSlots;
+    int firstFreeSendSlot;
+
+    struct UringStats stats;
+
+    // Returns -1 when io_uring or one of the used features is unavailable
+    int init(int socketFd, struct EventLoop *loop, struct RecvBufferPool *pool);
+    int deinit();
+
+    int startRecv(RecvBatchHandler handler, void *arg);
+    int stopRecv();
+
+    // content is copied, the caller may reuse it at once
+    int queueSend(struct sockaddr_in *peerAddress, unsigned char *content, size_t contentSize);
+    int submit();
+
+private:
+    struct io_uring_sqe *getSqe();
+    int postRecv();
+    int probeMultishotRecv();
+    void provideBuffer(struct RecvBuffer *buffer);
+    void refillBuffers();
+    void publishBuffers();
+    void dispatch(struct RecvDatagram *datagrams, size_t count);
+    int reapCompletions();
+
+    static void ringEventHandler(uint32_t events, void *arg);
+    static void prepareHandler(void *arg);
+};
+
+#endif // URINGNET_H